@@ -0,0 +1,92 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <shader.h>
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+// Maximum number of (merged) taps per side that blurFS.txt can receive (must match MAX_BLUR_TAPS in the shader)
+const int MAX_BLUR_TAPS = 32;
+// Maximum blur radius of the compute path, blurCS.txt (must match MAX_BLUR_RADIUS in the shader)
+const int MAX_BLUR_RADIUS = 2 * (MAX_BLUR_TAPS - 1) + 1;
+// Texels blurred by every work group of blurCS.txt (must match TILE_SIZE in the shader)
+const int BLUR_TILE_SIZE = 128;
+
+// 1D gaussian kernel of the separable bloom blur, computed once on the CPU instead of per tap in the shader
+struct BlurKernel
+{
+    float stdDev = -1.0f; // standard deviation in pixels used to build the kernel
+    int kernelSize = -1; // number of discrete taps per side, center included (same meaning as config kernel_size)
+
+    std::vector<float> weights; // normalized discrete weights, weights[i] is the weight of the pixel at distance i
+    std::vector<float> tapOffsets; // linear-sampling taps: pixel offset of each bilinear fetch (tapOffsets[0] = 0 is the center)
+    std::vector<float> tapWeights; // linear-sampling taps: weight of each bilinear fetch
+};
+
+// Builds the normalized gaussian weights and merges neighbouring taps so that a single bilinear fetch placed
+// between two texels returns their weighted sum (N discrete taps per side need about N/2 fetches)
+// ------------------------------------------------------------------------------------------------------------
+inline BlurKernel computeBlurKernel(float stdDev, int kernelSize)
+{
+    BlurKernel kernel;
+    kernel.stdDev = stdDev;
+    kernel.kernelSize = kernelSize;
+
+    // the center plus (MAX_BLUR_TAPS - 1) merged pairs is the most the shader can take
+    int maxKernelSize = 2 * (MAX_BLUR_TAPS - 1) + 1;
+    if (kernelSize > maxKernelSize)
+    {
+        std::cout << "Blur kernel_size " << kernelSize << " too big, clamped to " << maxKernelSize << std::endl;
+        kernelSize = maxKernelSize;
+    }
+    if (kernelSize < 1)
+        kernelSize = 1;
+
+    // discrete weights (pixel units), normalized over the whole symmetric kernel
+    float sigma = std::max(stdDev, 1e-3f);
+    kernel.weights.resize(kernelSize);
+    float sum = 0.0f;
+    for (int i = 0; i < kernelSize; i++)
+    {
+        kernel.weights[i] = std::exp(-(float)(i * i) / (2.0f * sigma * sigma));
+        sum += (i == 0) ? kernel.weights[i] : 2.0f * kernel.weights[i];
+    }
+    for (int i = 0; i < kernelSize; i++)
+        kernel.weights[i] /= sum;
+
+    // linear-sampling taps: the center stays alone, then texels (i, i+1) are merged into one fetch
+    kernel.tapOffsets.push_back(0.0f);
+    kernel.tapWeights.push_back(kernel.weights[0]);
+    for (int i = 1; i < kernelSize; i += 2)
+    {
+        float w1 = kernel.weights[i];
+        float w2 = (i + 1 < kernelSize) ? kernel.weights[i + 1] : 0.0f;
+        float w = w1 + w2;
+        kernel.tapOffsets.push_back(w > 0.0f ? (i * w1 + (i + 1) * w2) / w : (float)i);
+        kernel.tapWeights.push_back(w);
+    }
+    return kernel;
+}
+
+// Uploads the merged taps of the kernel to the blur shader (blurFS.txt)
+// -------------------------------------------------------------------------
+inline void uploadBlurKernel(Shader& blurShader, const BlurKernel& kernel)
+{
+    blurShader.useProgram();
+    blurShader.setInt("tapCount", (int)kernel.tapOffsets.size());
+    blurShader.setFloatArray("tapOffsets", kernel.tapOffsets.data(), (int)kernel.tapOffsets.size());
+    blurShader.setFloatArray("tapWeights", kernel.tapWeights.data(), (int)kernel.tapWeights.size());
+}
+
+// Uploads the discrete taps of the kernel to the compute blur shader (blurCS.txt)
+// -------------------------------------------------------------------------
+inline void uploadBlurKernelCompute(Shader& blurComputeShader, const BlurKernel& kernel)
+{
+    blurComputeShader.useProgram();
+    blurComputeShader.setInt("radius", (int)kernel.weights.size() - 1);
+    blurComputeShader.setFloatArray("weights", kernel.weights.data(), (int)kernel.weights.size());
+}
+#endif
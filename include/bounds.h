@@ -0,0 +1,80 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+
+// Axis aligned bounding box
+struct BoundingBox
+{
+    glm::vec3 min = glm::vec3(0.0f);
+    glm::vec3 max = glm::vec3(0.0f);
+
+    BoundingBox() {}
+    BoundingBox(const glm::vec3& min, const glm::vec3& max) : min(min), max(max) {}
+
+    // box of a unit cube ([-1, 1] on every axis) transformed by model
+    static BoundingBox ofUnitCube(const glm::mat4& model)
+    {
+        glm::vec3 center = glm::vec3(model[3]);
+        BoundingBox box(center, center);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            glm::vec3 extent = glm::abs(glm::vec3(model[axis]));
+            box.min -= extent;
+            box.max += extent;
+        }
+        return box;
+    }
+
+    // sphere - box test (distance from the center to the closest point of the box)
+    bool intersectsSphere(const glm::vec3& center, float radius) const
+    {
+        glm::vec3 closest = glm::clamp(center, min, max);
+        glm::vec3 offset = center - closest;
+        return glm::dot(offset, offset) <= radius * radius;
+    }
+};
+
+// View frustum as six planes (normals pointing inside), extracted from a projection * view matrix
+struct Frustum
+{
+    glm::vec4 planes[6];
+
+    Frustum() {}
+    explicit Frustum(const glm::mat4& viewProjection)
+    {
+        glm::mat4 m = glm::transpose(viewProjection); // rows of the matrix as columns
+        planes[0] = m[3] + m[0]; // left
+        planes[1] = m[3] - m[0]; // right
+        planes[2] = m[3] + m[1]; // bottom
+        planes[3] = m[3] - m[1]; // top
+        planes[4] = m[3] + m[2]; // near
+        planes[5] = m[3] - m[2]; // far
+        for (glm::vec4& plane : planes)
+            plane /= glm::length(glm::vec3(plane));
+    }
+
+    // false only when the sphere is completely outside one of the planes
+    bool intersectsSphere(const glm::vec3& center, float radius) const
+    {
+        for (const glm::vec4& plane : planes)
+            if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+                return false;
+        return true;
+    }
+
+    // false only when the box is completely outside one of the planes (tests the corner farthest along the normal)
+    bool intersectsBox(const BoundingBox& box) const
+    {
+        for (const glm::vec4& plane : planes)
+        {
+            glm::vec3 corner(plane.x >= 0.0f ? box.max.x : box.min.x, plane.y >= 0.0f ? box.max.y : box.min.y, plane.z >= 0.0f ? box.max.z : box.min.z);
+            if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+};
+#endif
@@ -0,0 +1,583 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <bounds.h>
+#include <thread_pool.h>
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <chrono>
+#include <cstdint>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define BVH_SSE 1
+#endif
+
+const unsigned int BVH_BINS = 16; // SAH candidate splits per axis are the bin boundaries
+const unsigned int BVH_MAX_LEAF_SIZE = 4; // leaves are split even when SAH would keep them
+const size_t BVH_PARALLEL_NODE = 16384; // nodes with more primitives bin in parallel and build their children in parallel
+
+// node of the binary tree the SAH build produces
+struct BVHBuildNode
+{
+    glm::vec3 min;
+    uint32_t first; // first primitive of the subtree (subtrees own a contiguous range of `primitives`)
+    glm::vec3 max;
+    uint32_t count; // primitives of the subtree
+    uint32_t left; // first child (the second is left + 1), 0 for leaves (the root is never a child)
+};
+
+// node of the 4-wide tree used for culling: 4 children boxes as center / half extent in SoA, so one SSE test
+// covers all of them. A lane holds a single primitive (count 1), a subtree (count > 1, child node) or nothing (count 0,
+// negative extent so it is always outside).
+struct alignas(16) BVHNode4
+{
+    float centerX[4], centerY[4], centerZ[4];
+    float extentX[4], extentY[4], extentZ[4];
+    uint32_t child[4];
+    uint32_t first[4]; // primitive range of the lane
+    uint32_t count[4];
+};
+
+// Bounding volume hierarchy over boxes (the scene instances), for frustum culling:
+// - build: binned SAH, the large nodes bin and recurse on the thread pool; the binary tree is then collapsed
+//   into a 4-wide tree whose last level holds one primitive per lane
+// - refit: new boxes with the same tree (moving instances), children always come after their parent
+// - cull: boxes intersecting the frustum; a lane completely inside emits its whole primitive range without further
+//   tests, the 4 lanes of a node are tested against each plane at once with SSE
+class InstanceBVH
+{
+    public:
+        std::vector<BVHNode4> nodes;
+        std::vector<uint32_t> primitives; // box indices, in tree order
+        double buildMilliseconds = 0.0;
+        double refitMilliseconds = 0.0;
+
+        void build(const std::vector<BoundingBox>& boxes, ThreadPool& pool)
+        {
+            auto start = std::chrono::steady_clock::now();
+            this->boxes = boxes;
+            size_t count = boxes.size();
+            primitives.resize(count);
+            std::iota(primitives.begin(), primitives.end(), 0u);
+            centroids.resize(count);
+            for (size_t i = 0; i < count; i++)
+                centroids[i] = (boxes[i].min + boxes[i].max) * 0.5f;
+            binary.assign(std::max<size_t>(1, 2 * count - 1), BVHBuildNode());
+            binary[0].first = 0;
+            binary[0].count = (uint32_t)count;
+            binary[0].left = 0;
+            binaryCount = 1;
+            nodes.clear();
+            if (count > 0)
+            {
+                buildNode(0, pool);
+                binary.resize(binaryCount);
+                nodes.reserve(binary.size());
+                collapse(0);
+            }
+            binary.clear();
+            binary.shrink_to_fit();
+            centroids.clear();
+            centroids.shrink_to_fit();
+            buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // updates the boxes (same count as the build) and the lane bounds, the tree is kept
+        void refit(const std::vector<BoundingBox>& newBoxes, ThreadPool& pool)
+        {
+            auto start = std::chrono::steady_clock::now();
+            boxes = newBoxes;
+            // single primitive lanes first (in parallel), then the subtree lanes from the last node back to the root
+            pool.parallelFor(0, nodes.size(), [this](size_t begin, size_t end) {
+                for (size_t n = begin; n < end; n++)
+                    for (int lane = 0; lane < 4; lane++)
+                        if (nodes[n].count[lane] == 1)
+                            setLane(nodes[n], lane, boxes[primitives[nodes[n].first[lane]]].min, boxes[primitives[nodes[n].first[lane]]].max);
+            }, 4096);
+            for (size_t n = nodes.size(); n-- > 0;)
+                for (int lane = 0; lane < 4; lane++)
+                    if (nodes[n].count[lane] > 1)
+                    {
+                        glm::vec3 min, max;
+                        nodeBounds(nodes[nodes[n].child[lane]], min, max);
+                        setLane(nodes[n], lane, min, max);
+                    }
+            refitMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // appends the indices of the boxes that intersect the frustum to visible (cleared first);
+        // simd = false tests the lanes one by one (same tree, same result)
+        void cull(const Frustum& frustum, std::vector<uint32_t>& visible, bool simd = true)
+        {
+            visible.clear();
+            if (nodes.empty())
+                return;
+            FrustumPlanes planes(frustum);
+            stack.clear();
+            stack.push_back(0);
+            while (!stack.empty())
+            {
+                const BVHNode4& node = nodes[stack.back()];
+                stack.pop_back();
+                int outside, inside;
+                if (simd)
+                    planes.classify(node, outside, inside);
+                else
+                    planes.classifyScalar(node, outside, inside);
+                for (int lane = 0; lane < 4; lane++)
+                {
+                    if (outside & (1 << lane))
+                        continue;
+                    if (node.count[lane] == 1 || (inside & (1 << lane)))
+                        visible.insert(visible.end(), primitives.begin() + node.first[lane], primitives.begin() + node.first[lane] + node.count[lane]);
+                    else
+                        stack.push_back(node.child[lane]);
+                }
+            }
+        }
+
+    private:
+        // the 6 frustum planes, each with its absolute normal for the projected half extent of a box
+        struct FrustumPlanes
+        {
+            glm::vec4 planes[6];
+            glm::vec3 absNormals[6];
+#ifdef BVH_SSE
+            __m128 x[6], y[6], z[6], w[6], absX[6], absY[6], absZ[6]; // broadcast
+#endif
+
+            explicit FrustumPlanes(const Frustum& frustum)
+            {
+                for (int p = 0; p < 6; p++)
+                {
+                    planes[p] = frustum.planes[p];
+                    absNormals[p] = glm::abs(glm::vec3(planes[p]));
+#ifdef BVH_SSE
+                    x[p] = _mm_set1_ps(planes[p].x); y[p] = _mm_set1_ps(planes[p].y); z[p] = _mm_set1_ps(planes[p].z); w[p] = _mm_set1_ps(planes[p].w);
+                    absX[p] = _mm_set1_ps(absNormals[p].x); absY[p] = _mm_set1_ps(absNormals[p].y); absZ[p] = _mm_set1_ps(absNormals[p].z);
+#endif
+                }
+            }
+
+            // box center distance d and projected half extent r: a lane is outside when d < -r for a plane,
+            // inside when d >= r for all of them (bit masks of the lanes)
+            void classifyScalar(const BVHNode4& node, int& outside, int& inside) const
+            {
+                outside = 0;
+                inside = 0;
+                for (int lane = 0; lane < 4; lane++)
+                {
+                    bool laneInside = true;
+                    for (int p = 0; p < 6; p++)
+                    {
+                        float d = planes[p].x * node.centerX[lane] + planes[p].y * node.centerY[lane] + planes[p].z * node.centerZ[lane] + planes[p].w;
+                        float r = absNormals[p].x * node.extentX[lane] + absNormals[p].y * node.extentY[lane] + absNormals[p].z * node.extentZ[lane];
+                        if (d < -r)
+                        {
+                            outside |= 1 << lane;
+                            break;
+                        }
+                        laneInside = laneInside && d >= r;
+                    }
+                    if (laneInside && !(outside & (1 << lane)))
+                        inside |= 1 << lane;
+                }
+            }
+
+            void classify(const BVHNode4& node, int& outside, int& inside) const
+            {
+#ifdef BVH_SSE
+                __m128 cx = _mm_load_ps(node.centerX), cy = _mm_load_ps(node.centerY), cz = _mm_load_ps(node.centerZ);
+                __m128 ex = _mm_load_ps(node.extentX), ey = _mm_load_ps(node.extentY), ez = _mm_load_ps(node.extentZ);
+                __m128 outsideMask = _mm_setzero_ps(), insideMask = _mm_castsi128_ps(_mm_set1_epi32(-1));
+                for (int p = 0; p < 6; p++)
+                {
+                    __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x[p], cx), _mm_mul_ps(y[p], cy)), _mm_add_ps(_mm_mul_ps(z[p], cz), w[p]));
+                    __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absX[p], ex), _mm_mul_ps(absY[p], ey)), _mm_mul_ps(absZ[p], ez));
+                    outsideMask = _mm_or_ps(outsideMask, _mm_cmplt_ps(d, _mm_sub_ps(_mm_setzero_ps(), r)));
+                    insideMask = _mm_and_ps(insideMask, _mm_cmpge_ps(d, r));
+                    if (_mm_movemask_ps(outsideMask) == 0xF)
+                        break;
+                }
+                outside = _mm_movemask_ps(outsideMask);
+                inside = _mm_movemask_ps(insideMask) & ~outside;
+#else
+                classifyScalar(node, outside, inside);
+#endif
+            }
+        };
+
+        struct Bins
+        {
+            glm::vec3 min[3][BVH_BINS];
+            glm::vec3 max[3][BVH_BINS];
+            uint32_t count[3][BVH_BINS];
+
+            Bins()
+            {
+                for (int axis = 0; axis < 3; axis++)
+                    for (unsigned int b = 0; b < BVH_BINS; b++)
+                    {
+                        min[axis][b] = glm::vec3(1e30f);
+                        max[axis][b] = glm::vec3(-1e30f);
+                        count[axis][b] = 0;
+                    }
+            }
+
+            void merge(const Bins& other)
+            {
+                for (int axis = 0; axis < 3; axis++)
+                    for (unsigned int b = 0; b < BVH_BINS; b++)
+                    {
+                        min[axis][b] = glm::min(min[axis][b], other.min[axis][b]);
+                        max[axis][b] = glm::max(max[axis][b], other.max[axis][b]);
+                        count[axis][b] += other.count[axis][b];
+                    }
+            }
+        };
+
+        std::vector<BoundingBox> boxes;
+        std::vector<glm::vec3> centroids;
+        std::vector<BVHBuildNode> binary;
+        std::atomic<uint32_t> binaryCount{0};
+        std::vector<uint32_t> stack;
+
+        static float halfArea(const glm::vec3& min, const glm::vec3& max)
+        {
+            glm::vec3 size = glm::max(max - min, glm::vec3(0.0f));
+            return size.x * size.y + size.y * size.z + size.z * size.x;
+        }
+
+        static void setLane(BVHNode4& node, int lane, const glm::vec3& min, const glm::vec3& max)
+        {
+            glm::vec3 center = (min + max) * 0.5f, extent = (max - min) * 0.5f;
+            node.centerX[lane] = center.x; node.centerY[lane] = center.y; node.centerZ[lane] = center.z;
+            node.extentX[lane] = extent.x; node.extentY[lane] = extent.y; node.extentZ[lane] = extent.z;
+        }
+
+        // empty lanes get a negative extent: every plane test classifies them outside
+        static void emptyLane(BVHNode4& node, int lane)
+        {
+            node.centerX[lane] = node.centerY[lane] = node.centerZ[lane] = 0.0f;
+            node.extentX[lane] = node.extentY[lane] = node.extentZ[lane] = -1e30f;
+            node.child[lane] = node.first[lane] = node.count[lane] = 0;
+        }
+
+        static void nodeBounds(const BVHNode4& node, glm::vec3& min, glm::vec3& max)
+        {
+            min = glm::vec3(1e30f);
+            max = glm::vec3(-1e30f);
+            for (int lane = 0; lane < 4; lane++)
+                if (node.count[lane] > 0)
+                {
+                    glm::vec3 center(node.centerX[lane], node.centerY[lane], node.centerZ[lane]);
+                    glm::vec3 extent(node.extentX[lane], node.extentY[lane], node.extentZ[lane]);
+                    min = glm::min(min, center - extent);
+                    max = glm::max(max, center + extent);
+                }
+        }
+
+        // 4-wide node of a binary subtree: the largest binary children are opened until there are 4 lanes,
+        // binary leaves become nodes with one primitive per lane (returns the node index)
+        uint32_t collapse(uint32_t binaryIndex)
+        {
+            uint32_t index = (uint32_t)nodes.size();
+            nodes.push_back(BVHNode4());
+            for (int lane = 0; lane < 4; lane++)
+                emptyLane(nodes[index], lane);
+            const BVHBuildNode& source = binary[binaryIndex];
+            struct Lane { uint32_t binaryNode; uint32_t primitive; bool single; };
+            Lane lanes[4];
+            int laneCount = 0;
+            if (source.left == 0)
+                for (uint32_t i = source.first; i < source.first + source.count; i++)
+                    lanes[laneCount++] = { 0, i, true };
+            else
+            {
+                lanes[laneCount++] = { source.left, 0, false };
+                lanes[laneCount++] = { source.left + 1, 0, false };
+                // open the largest lane: an internal node becomes its 2 children, a leaf its primitives if they fit
+                while (laneCount < 4)
+                {
+                    int open = -1;
+                    float largest = -1.0f;
+                    for (int lane = 0; lane < laneCount; lane++)
+                    {
+                        const BVHBuildNode& node = binary[lanes[lane].binaryNode];
+                        bool fits = node.left != 0 || laneCount - 1 + (int)node.count <= 4;
+                        if (!lanes[lane].single && fits && halfArea(node.min, node.max) > largest)
+                        {
+                            largest = halfArea(node.min, node.max);
+                            open = lane;
+                        }
+                    }
+                    if (open < 0)
+                        break;
+                    const BVHBuildNode& node = binary[lanes[open].binaryNode];
+                    if (node.left != 0)
+                    {
+                        uint32_t left = node.left;
+                        lanes[open].binaryNode = left;
+                        lanes[laneCount++] = { left + 1, 0, false };
+                    }
+                    else
+                    {
+                        uint32_t first = node.first, count = node.count;
+                        lanes[open] = { 0, first, true };
+                        for (uint32_t i = first + 1; i < first + count; i++)
+                            lanes[laneCount++] = { 0, i, true };
+                    }
+                }
+            }
+            for (int lane = 0; lane < laneCount; lane++)
+            {
+                uint32_t first, count, child = 0;
+                glm::vec3 min, max;
+                if (lanes[lane].single)
+                {
+                    first = lanes[lane].primitive;
+                    count = 1;
+                    min = boxes[primitives[first]].min;
+                    max = boxes[primitives[first]].max;
+                }
+                else
+                {
+                    const BVHBuildNode& node = binary[lanes[lane].binaryNode];
+                    first = node.first;
+                    count = node.count;
+                    min = node.min;
+                    max = node.max;
+                    if (count > 1)
+                        child = collapse(lanes[lane].binaryNode); // may reallocate nodes: write the lane afterwards
+                }
+                BVHNode4& node = nodes[index];
+                node.first[lane] = first;
+                node.count[lane] = count;
+                node.child[lane] = child;
+                setLane(node, lane, min, max);
+            }
+            return index;
+        }
+
+        int binOf(const glm::vec3& centroid, int axis, const glm::vec3& centroidMin, const glm::vec3& binScale) const
+        {
+            return std::min((int)BVH_BINS - 1, (int)((centroid[axis] - centroidMin[axis]) * binScale[axis]));
+        }
+
+        void buildNode(uint32_t index, ThreadPool& pool)
+        {
+            BVHBuildNode& node = binary[index];
+            size_t first = node.first, count = node.count;
+            bool parallel = count > BVH_PARALLEL_NODE;
+
+            // node and centroid bounds
+            struct Extent { glm::vec3 min = glm::vec3(1e30f), max = glm::vec3(-1e30f), centroidMin = glm::vec3(1e30f), centroidMax = glm::vec3(-1e30f); };
+            auto extentOf = [this](size_t begin, size_t end) {
+                Extent extent;
+                for (size_t i = begin; i < end; i++)
+                {
+                    uint32_t primitive = primitives[i];
+                    extent.min = glm::min(extent.min, boxes[primitive].min);
+                    extent.max = glm::max(extent.max, boxes[primitive].max);
+                    extent.centroidMin = glm::min(extent.centroidMin, centroids[primitive]);
+                    extent.centroidMax = glm::max(extent.centroidMax, centroids[primitive]);
+                }
+                return extent;
+            };
+            Extent extent;
+            if (parallel)
+            {
+                std::mutex mergeMutex;
+                pool.parallelFor(first, first + count, [&](size_t begin, size_t end) {
+                    Extent part = extentOf(begin, end);
+                    std::lock_guard<std::mutex> lock(mergeMutex);
+                    extent.min = glm::min(extent.min, part.min);
+                    extent.max = glm::max(extent.max, part.max);
+                    extent.centroidMin = glm::min(extent.centroidMin, part.centroidMin);
+                    extent.centroidMax = glm::max(extent.centroidMax, part.centroidMax);
+                }, BVH_PARALLEL_NODE / 4);
+            }
+            else
+                extent = extentOf(first, first + count);
+            node.min = extent.min;
+            node.max = extent.max;
+            if (count <= 2)
+                return;
+
+            // binned SAH over the centroids
+            glm::vec3 centroidSize = extent.centroidMax - extent.centroidMin;
+            glm::vec3 binScale;
+            for (int axis = 0; axis < 3; axis++)
+                binScale[axis] = centroidSize[axis] > 0.0f ? BVH_BINS / centroidSize[axis] : 0.0f;
+            auto binRange = [&](size_t begin, size_t end, Bins& bins) {
+                for (size_t i = begin; i < end; i++)
+                {
+                    uint32_t primitive = primitives[i];
+                    for (int axis = 0; axis < 3; axis++)
+                    {
+                        int bin = binOf(centroids[primitive], axis, extent.centroidMin, binScale);
+                        bins.min[axis][bin] = glm::min(bins.min[axis][bin], boxes[primitive].min);
+                        bins.max[axis][bin] = glm::max(bins.max[axis][bin], boxes[primitive].max);
+                        bins.count[axis][bin]++;
+                    }
+                }
+            };
+            Bins bins;
+            if (parallel)
+            {
+                std::mutex mergeMutex;
+                pool.parallelFor(first, first + count, [&](size_t begin, size_t end) {
+                    Bins part;
+                    binRange(begin, end, part);
+                    std::lock_guard<std::mutex> lock(mergeMutex);
+                    bins.merge(part);
+                }, BVH_PARALLEL_NODE / 4);
+            }
+            else
+                binRange(first, first + count, bins);
+
+            float bestCost = 1e30f;
+            int bestAxis = -1, bestSplit = 0;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                if (centroidSize[axis] <= 0.0f)
+                    continue;
+                // sweep from the right keeping the area times count of the right side of every split
+                float rightCost[BVH_BINS];
+                glm::vec3 rightMin(1e30f), rightMax(-1e30f);
+                uint32_t rightCount = 0;
+                for (unsigned int b = BVH_BINS - 1; b > 0; b--)
+                {
+                    rightMin = glm::min(rightMin, bins.min[axis][b]);
+                    rightMax = glm::max(rightMax, bins.max[axis][b]);
+                    rightCount += bins.count[axis][b];
+                    rightCost[b] = rightCount ? halfArea(rightMin, rightMax) * rightCount : 0.0f;
+                }
+                glm::vec3 leftMin(1e30f), leftMax(-1e30f);
+                uint32_t leftCount = 0;
+                for (unsigned int b = 0; b < BVH_BINS - 1; b++)
+                {
+                    leftMin = glm::min(leftMin, bins.min[axis][b]);
+                    leftMax = glm::max(leftMax, bins.max[axis][b]);
+                    leftCount += bins.count[axis][b];
+                    if (leftCount == 0 || leftCount == count)
+                        continue;
+                    float cost = halfArea(leftMin, leftMax) * leftCount + rightCost[b + 1];
+                    if (cost < bestCost)
+                    {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestSplit = (int)b + 1; // bins [0, split) go left
+                    }
+                }
+            }
+
+            float leafCost = halfArea(node.min, node.max) * count;
+            if (bestAxis < 0)
+            {
+                if (count <= BVH_MAX_LEAF_SIZE)
+                    return;
+                bestSplit = -1; // all the centroids coincide: split the range in half
+            }
+            else if (bestCost >= leafCost && count <= BVH_MAX_LEAF_SIZE)
+                return;
+
+            size_t middle;
+            if (bestSplit < 0)
+                middle = first + count / 2;
+            else
+            {
+                auto isLeft = [&](uint32_t primitive) { return binOf(centroids[primitive], bestAxis, extent.centroidMin, binScale) < bestSplit; };
+                middle = std::partition(primitives.begin() + first, primitives.begin() + first + count, isLeft) - primitives.begin();
+            }
+
+            uint32_t left = binaryCount.fetch_add(2);
+            binary[left].first = (uint32_t)first;
+            binary[left].count = (uint32_t)(middle - first);
+            binary[left].left = 0;
+            binary[left + 1].first = (uint32_t)middle;
+            binary[left + 1].count = (uint32_t)(first + count - middle);
+            binary[left + 1].left = 0;
+            binary[index].left = left;
+            if (parallel)
+                pool.parallelFor(0, 2, [&](size_t begin, size_t end) {
+                    for (size_t child = begin; child < end; child++)
+                        buildNode(left + (uint32_t)child, pool);
+                });
+            else
+            {
+                buildNode(left, pool);
+                buildNode(left + 1, pool);
+            }
+        }
+};
+
+// Culling benchmark: count random boxes in a 1000 units cube, the camera sits in the middle and turns around;
+// prints build, refit and average cull time, with SIMD and scalar tests and against testing every box
+// ------------------------------------------------------------------------
+inline void benchmarkCulling(unsigned int count, unsigned int frames, ThreadPool& pool)
+{
+    std::mt19937 random(count);
+    std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> size(0.5f, 2.0f);
+    std::vector<BoundingBox> boxes(count);
+    for (BoundingBox& box : boxes)
+    {
+        glm::vec3 center(position(random), position(random), position(random));
+        glm::vec3 half(size(random), size(random), size(random));
+        box = BoundingBox(center - half, center + half);
+    }
+
+    InstanceBVH bvh;
+    bvh.build(boxes, pool);
+    for (BoundingBox& box : boxes)
+    {
+        glm::vec3 offset(0.1f, -0.1f, 0.05f); // every box moves a little
+        box.min += offset;
+        box.max += offset;
+    }
+    bvh.refit(boxes, pool);
+
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 300.0f);
+    std::vector<uint32_t> visible;
+    double milliseconds[3] = { 0.0, 0.0, 0.0 }; // simd, scalar, every box
+    size_t visibleCount = 0;
+    bool matching = true;
+    for (unsigned int frame = 0; frame < frames; frame++)
+    {
+        float angle = 6.2831853f * frame / frames;
+        glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(std::cos(angle), 0.3f * std::sin(2.0f * angle), std::sin(angle)), glm::vec3(0.0f, 1.0f, 0.0f));
+        Frustum frustum(projection * view);
+        for (int simd = 1; simd >= 0; simd--)
+        {
+            auto start = std::chrono::steady_clock::now();
+            bvh.cull(frustum, visible, simd == 1);
+            milliseconds[simd == 1 ? 0 : 1] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+        visibleCount += visible.size();
+        auto start = std::chrono::steady_clock::now();
+        size_t bruteForce = 0;
+        for (const BoundingBox& box : boxes)
+            bruteForce += frustum.intersectsBox(box) ? 1 : 0;
+        milliseconds[2] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        matching = matching && bruteForce == visible.size();
+    }
+    std::streamsize precision = std::cout.precision();
+    std::cout << std::fixed << std::setprecision(3) << "culling benchmark: " << count << " instances, " << bvh.nodes.size() << " nodes, " << pool.size()
+              << " threads | build: " << bvh.buildMilliseconds << " ms | refit: " << bvh.refitMilliseconds << " ms | cull: " << milliseconds[0] / frames
+              << " ms simd, " << milliseconds[1] / frames << " ms scalar, " << milliseconds[2] / frames << " ms testing every box | visible: "
+              << visibleCount / std::max(1u, frames) << (matching ? "" : " (MISMATCH with testing every box)") << std::defaultfloat << std::setprecision(precision) << std::endl;
+}
+#endif
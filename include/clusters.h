@@ -0,0 +1,245 @@
+#ifndef CLUSTERS_H
+#define CLUSTERS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <lights.h>
+#include <shader.h>
+#include <thread_pool.h>
+#include <generation.h>
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+
+// clusters grid: screen tiles x screen tiles x depth slices
+const int CLUSTER_TILES_X = 16;
+const int CLUSTER_TILES_Y = 9;
+const int CLUSTER_SLICES = 24;
+
+// texture units used by the cluster buffers in the lighting shader
+const unsigned int CLUSTER_GRID_UNIT = 2;
+const unsigned int CLUSTER_LIGHTS_UNIT = 3;
+
+// Clustered light culling: the view frustum is divided in tiles on screen and in exponential slices in depth,
+// and every cluster receives the list of lights whose influence sphere touches it. The lists are built on the CPU
+// (one job per depth slice) and read by the lighting shader through two buffer textures:
+// - clusterGrid (RG32UI): first index and number of lights of every cluster
+// - clusterLights (R32UI): light indices of all the clusters, one list after the other
+class LightClusters
+{
+    public:
+        float nearPlane;
+        float farPlane;
+        unsigned int lightIndices = 0; // size of the light index list of the last build
+        double buildMilliseconds = 0.0; // cpu time of the last build
+        unsigned long long builds = 0;
+
+        LightClusters(float nearPlane, float farPlane) : nearPlane(nearPlane), farPlane(farPlane)
+        {
+            glGenBuffers(1, &gridBuffer);
+            glGenBuffers(1, &indexBuffer);
+            glGenTextures(1, &gridTexture);
+            glGenTextures(1, &indexTexture);
+            grid.resize(CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES * 2, 0);
+            indices.push_back(0);
+            upload();
+            glBindTexture(GL_TEXTURE_BUFFER, gridTexture);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, gridBuffer);
+            glBindTexture(GL_TEXTURE_BUFFER, indexTexture);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, indexBuffer);
+            glBindTexture(GL_TEXTURE_BUFFER, 0);
+        }
+
+        ~LightClusters()
+        {
+            glDeleteTextures(1, &gridTexture);
+            glDeleteTextures(1, &indexTexture);
+            glDeleteBuffers(1, &gridBuffer);
+            glDeleteBuffers(1, &indexBuffer);
+        }
+
+        // sets the uniforms that describe the grid (the shader must have been linked with the clusters code)
+        void setUniforms(Shader& shader, unsigned int width, unsigned int height) const
+        {
+            shader.setInt("clusterGrid", CLUSTER_GRID_UNIT);
+            shader.setInt("clusterLights", CLUSTER_LIGHTS_UNIT);
+            shader.setIVec3("clusterCount", CLUSTER_TILES_X, CLUSTER_TILES_Y, CLUSTER_SLICES);
+            shader.setVec2("clusterTileSize", glm::vec2((float)width / CLUSTER_TILES_X, (float)height / CLUSTER_TILES_Y));
+            shader.setFloat("clusterNear", nearPlane);
+            shader.setFloat("clusterSliceScale", CLUSTER_SLICES / std::log(farPlane / nearPlane));
+        }
+
+        void bind() const
+        {
+            glActiveTexture(GL_TEXTURE0 + CLUSTER_GRID_UNIT);
+            glBindTexture(GL_TEXTURE_BUFFER, gridTexture);
+            glActiveTexture(GL_TEXTURE0 + CLUSTER_LIGHTS_UNIT);
+            glBindTexture(GL_TEXTURE_BUFFER, indexTexture);
+            glActiveTexture(GL_TEXTURE0);
+        }
+
+        // assigns the lights to the clusters of the given camera; nothing is done if camera and lights didn't change.
+        // returns true when the clusters were rebuilt
+        bool build(const std::vector<GPULight>& lights, const glm::mat4& view, const glm::mat4& projection, ThreadPool& pool)
+        {
+            inputs.begin();
+            inputs.add(view);
+            inputs.add(projection);
+            inputs.add(lights);
+            unsigned long long generation = inputs.end();
+            if (builds > 0 && generation == builtGeneration)
+                return false;
+            auto start = std::chrono::steady_clock::now();
+
+            // lights in view space
+            viewLights.resize(lights.size());
+            pool.parallelFor(0, lights.size(), [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++)
+                    viewLights[i] = glm::vec4(glm::vec3(view * glm::vec4(glm::vec3(lights[i].position), 1.0f)), lights[i].position.w);
+            }, 256);
+
+            // every depth slice is filled independently, then the slices are concatenated
+            float xScale = projection[0][0];
+            float yScale = projection[1][1];
+            pool.parallelFor(0, CLUSTER_SLICES, [&](size_t begin, size_t end) {
+                for (size_t slice = begin; slice < end; slice++)
+                    buildSlice((int)slice, xScale, yScale);
+            });
+            unsigned int offset = 0;
+            for (int slice = 0; slice < CLUSTER_SLICES; slice++)
+            {
+                SliceLists& lists = slices[slice];
+                for (int tile = 0; tile < CLUSTER_TILES_X * CLUSTER_TILES_Y; tile++)
+                {
+                    int cluster = slice * CLUSTER_TILES_X * CLUSTER_TILES_Y + tile;
+                    grid[cluster * 2] = offset + lists.offsets[tile];
+                    grid[cluster * 2 + 1] = lists.offsets[tile + 1] - lists.offsets[tile];
+                }
+                offset += (unsigned int)lists.indices.size();
+            }
+            indices.resize(std::max(offset, 1u));
+            offset = 0;
+            for (int slice = 0; slice < CLUSTER_SLICES; slice++)
+            {
+                std::copy(slices[slice].indices.begin(), slices[slice].indices.end(), indices.begin() + offset);
+                offset += (unsigned int)slices[slice].indices.size();
+            }
+            lightIndices = offset;
+            upload();
+
+            buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            builtGeneration = generation;
+            builds++;
+            return true;
+        }
+
+    private:
+        GLuint gridBuffer = 0;
+        GLuint indexBuffer = 0;
+        GLuint gridTexture = 0;
+        GLuint indexTexture = 0;
+        std::vector<uint32_t> grid; // (first index, count) of every cluster
+        std::vector<uint32_t> indices;
+        std::vector<glm::vec4> viewLights; // xyz: view space position, w: radius
+        GenerationCounter inputs;
+        unsigned long long builtGeneration = 0;
+
+        // lights of the clusters of one depth slice, sorted by tile (counting sort of the (tile, light) pairs)
+        struct SliceLists
+        {
+            std::vector<uint32_t> pairs; // tile, light
+            std::vector<uint32_t> offsets; // first index of every tile, plus the end
+            std::vector<uint32_t> indices;
+        };
+        SliceLists slices[CLUSTER_SLICES];
+
+        // view space depth of the boundary between slice - 1 and slice
+        float sliceDepth(int slice) const
+        {
+            return nearPlane * std::pow(farPlane / nearPlane, (float)slice / CLUSTER_SLICES);
+        }
+
+        // tile range [first, last] covered on one axis by the interval [low, high] (view space) between depths near and far
+        static bool tileRange(float low, float high, float nearDepth, float farDepth, float scale, int tiles, int& first, int& last)
+        {
+            // x / depth is extreme at the corners of the interval: nearest depth for the far side from the axis
+            float ndcLow = scale * low / (low < 0.0f ? nearDepth : farDepth);
+            float ndcHigh = scale * high / (high > 0.0f ? nearDepth : farDepth);
+            if (ndcHigh < -1.0f || ndcLow > 1.0f)
+                return false;
+            first = std::clamp((int)std::floor((ndcLow * 0.5f + 0.5f) * tiles), 0, tiles - 1);
+            last = std::clamp((int)std::floor((ndcHigh * 0.5f + 0.5f) * tiles), 0, tiles - 1);
+            return true;
+        }
+
+        void buildSlice(int slice, float xScale, float yScale)
+        {
+            SliceLists& lists = slices[slice];
+            lists.pairs.clear();
+            float zNear = sliceDepth(slice);
+            float zFar = sliceDepth(slice + 1);
+            for (uint32_t light = 0; light < (uint32_t)viewLights.size(); light++)
+            {
+                glm::vec3 center = glm::vec3(viewLights[light]);
+                float radius = viewLights[light].w;
+                float depth = -center.z;
+                if (depth + radius < zNear || depth - radius > zFar)
+                    continue;
+                float nearDepth = std::max(zNear, depth - radius);
+                float farDepth = std::min(zFar, depth + radius);
+                int x0, x1, y0, y1;
+                if (!tileRange(center.x - radius, center.x + radius, nearDepth, farDepth, xScale, CLUSTER_TILES_X, x0, x1) ||
+                    !tileRange(center.y - radius, center.y + radius, nearDepth, farDepth, yScale, CLUSTER_TILES_Y, y0, y1))
+                    continue;
+                for (int y = y0; y <= y1; y++)
+                {
+                    // view space bounds of the tile row / column at both ends of the slice
+                    float ndcY0 = -1.0f + 2.0f * y / CLUSTER_TILES_Y;
+                    float ndcY1 = -1.0f + 2.0f * (y + 1) / CLUSTER_TILES_Y;
+                    float minY = std::min(ndcY0 * zNear, ndcY0 * zFar) / yScale;
+                    float maxY = std::max(ndcY1 * zNear, ndcY1 * zFar) / yScale;
+                    float dy = std::max(0.0f, std::max(minY - center.y, center.y - maxY));
+                    for (int x = x0; x <= x1; x++)
+                    {
+                        float ndcX0 = -1.0f + 2.0f * x / CLUSTER_TILES_X;
+                        float ndcX1 = -1.0f + 2.0f * (x + 1) / CLUSTER_TILES_X;
+                        float minX = std::min(ndcX0 * zNear, ndcX0 * zFar) / xScale;
+                        float maxX = std::max(ndcX1 * zNear, ndcX1 * zFar) / xScale;
+                        float dx = std::max(0.0f, std::max(minX - center.x, center.x - maxX));
+                        float dz = std::max(0.0f, std::max(zNear - depth, depth - zFar));
+                        // sphere - cluster bounding box test
+                        if (dx * dx + dy * dy + dz * dz <= radius * radius)
+                        {
+                            lists.pairs.push_back((uint32_t)(y * CLUSTER_TILES_X + x));
+                            lists.pairs.push_back(light);
+                        }
+                    }
+                }
+            }
+
+            const int tiles = CLUSTER_TILES_X * CLUSTER_TILES_Y;
+            lists.offsets.assign(tiles + 1, 0);
+            for (size_t i = 0; i < lists.pairs.size(); i += 2)
+                lists.offsets[lists.pairs[i] + 1]++;
+            for (int tile = 0; tile < tiles; tile++)
+                lists.offsets[tile + 1] += lists.offsets[tile];
+            lists.indices.resize(lists.pairs.size() / 2);
+            std::vector<uint32_t> cursor(lists.offsets.begin(), lists.offsets.end() - 1);
+            for (size_t i = 0; i < lists.pairs.size(); i += 2)
+                lists.indices[cursor[lists.pairs[i]]++] = lists.pairs[i + 1];
+        }
+
+        void upload()
+        {
+            glBindBuffer(GL_TEXTURE_BUFFER, gridBuffer);
+            glBufferData(GL_TEXTURE_BUFFER, grid.size() * sizeof(uint32_t), grid.data(), GL_STREAM_DRAW);
+            glBindBuffer(GL_TEXTURE_BUFFER, indexBuffer);
+            glBufferData(GL_TEXTURE_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STREAM_DRAW);
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        }
+};
+#endif
@@ -0,0 +1,300 @@
+#ifndef CPU_BLUR_H
+#define CPU_BLUR_H
+
+#include <bloom.h>
+#include <thread_pool.h>
+
+#include <glm/gtc/packing.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define CPU_BLUR_SSE 1
+// half conversions in hardware (F16C): compiled for that target only, used after a CPUID check
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define CPU_BLUR_F16C 1
+#define CPU_BLUR_F16C_TARGET
+#elif defined(__GNUC__) || defined(__clang__)
+#include <cpuid.h>
+#define CPU_BLUR_F16C 1
+#define CPU_BLUR_F16C_TARGET __attribute__((target("avx,f16c")))
+#endif
+#endif
+
+// CPU separable blur for RGBA images, used for headless reference rendering and offline jobs.
+// It reproduces the GPU bloom blur (blurFS.txt): same normalized gaussian weights, clamp-to-edge borders,
+// a horizontal pass followed by a vertical one, repeated passes times.
+
+// RGBA image with 32 bit float channels
+struct ImageRGBA32F
+{
+    int width = 0;
+    int height = 0;
+    std::vector<float> pixels; // width * height * 4 values, row by row
+
+    ImageRGBA32F() {}
+    ImageRGBA32F(int w, int h) : width(w), height(h), pixels((size_t)w * h * 4, 0.0f) {}
+};
+
+// RGBA image with 16 bit half float channels (same layout as a GL_RGBA16F texture)
+struct ImageRGBA16F
+{
+    int width = 0;
+    int height = 0;
+    std::vector<uint16_t> pixels; // width * height * 4 values, row by row
+
+    ImageRGBA16F() {}
+    ImageRGBA16F(int w, int h) : width(w), height(h), pixels((size_t)w * h * 4, 0) {}
+};
+
+namespace cpublur
+{
+    // side of the square tiles used by the transposes (32x32 RGBA32F pixels = 16 KB, fits in L1 with its destination)
+    const int TRANSPOSE_TILE = 32;
+
+#if defined(CPU_BLUR_F16C)
+    // true if the CPU has F16C and the OS saves the AVX registers it uses (checked once)
+    // ------------------------------------------------------------------------
+    inline bool hasF16C()
+    {
+        static const bool supported = []() {
+            unsigned int ecx = 0;
+            unsigned long long xcr0 = 0;
+#if defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 1);
+            ecx = (unsigned int)info[2];
+            if (ecx & (1u << 27))
+                xcr0 = _xgetbv(0);
+#else
+            unsigned int eax, ebx, edx;
+            if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+                return false;
+            if (ecx & bit_OSXSAVE)
+            {
+                unsigned int low, high;
+                __asm__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+                xcr0 = ((unsigned long long)high << 32) | low;
+            }
+#endif
+            bool avx = (ecx & (1u << 28)) && (ecx & (1u << 27)) && (xcr0 & 6) == 6;
+            return avx && (ecx & (1u << 29));
+        }();
+        return supported;
+    }
+
+    // pairs of RGBA pixels converted 8 channels at a time
+    CPU_BLUR_F16C_TARGET inline void loadHalvesF16C(const uint16_t* src, float* dst, int pairs)
+    {
+        for (int i = 0; i < pairs * 8; i += 8)
+            _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + i))));
+    }
+    CPU_BLUR_F16C_TARGET inline void storeHalvesF16C(const float* src, uint16_t* dst, int pairs)
+    {
+        for (int i = 0; i < pairs * 8; i += 8)
+            _mm_storeu_si128((__m128i*)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+    }
+#endif
+
+    // conversion of n RGBA pixels between the storage type and float
+    // ------------------------------------------------------------------------
+    inline void loadPixels(const float* src, float* dst, int n)
+    {
+        std::memcpy(dst, src, (size_t)n * 4 * sizeof(float));
+    }
+    inline void loadPixels(const uint16_t* src, float* dst, int n)
+    {
+        int i = 0;
+#if defined(CPU_BLUR_F16C)
+        if (hasF16C())
+        {
+            loadHalvesF16C(src, dst, n / 2);
+            i = (n / 2) * 8;
+        }
+#endif
+        for (; i < n * 4; i++)
+            dst[i] = glm::unpackHalf1x16(src[i]);
+    }
+    inline void storePixels(const float* src, float* dst, int n)
+    {
+        std::memcpy(dst, src, (size_t)n * 4 * sizeof(float));
+    }
+    inline void storePixels(const float* src, uint16_t* dst, int n)
+    {
+        int i = 0;
+#if defined(CPU_BLUR_F16C)
+        if (hasF16C())
+        {
+            storeHalvesF16C(src, dst, n / 2);
+            i = (n / 2) * 8;
+        }
+#endif
+        for (; i < n * 4; i++)
+            dst[i] = glm::packHalf1x16(src[i]);
+    }
+
+    // 1D convolution of a padded row: src holds n + 2 * radius pixels (borders replicated), dst receives n pixels.
+    // weights[0] is the center weight, weights[i] the weight of the two pixels at distance i.
+    // ------------------------------------------------------------------------
+    inline void convolveRow(const float* src, float* dst, int n, const float* weights, int radius)
+    {
+        const float* center = src + radius * 4;
+#ifdef CPU_BLUR_SSE
+        // one RGBA pixel is exactly one SSE register
+        for (int x = 0; x < n; x++)
+        {
+            const float* p = center + x * 4;
+            __m128 acc = _mm_mul_ps(_mm_loadu_ps(p), _mm_set1_ps(weights[0]));
+            for (int i = 1; i <= radius; i++)
+            {
+                __m128 pair = _mm_add_ps(_mm_loadu_ps(p + i * 4), _mm_loadu_ps(p - i * 4));
+                acc = _mm_add_ps(acc, _mm_mul_ps(pair, _mm_set1_ps(weights[i])));
+            }
+            _mm_storeu_ps(dst + x * 4, acc);
+        }
+#else
+        for (int x = 0; x < n; x++)
+        {
+            const float* p = center + x * 4;
+            for (int c = 0; c < 4; c++)
+            {
+                float acc = p[c] * weights[0];
+                for (int i = 1; i <= radius; i++)
+                    acc += (p[i * 4 + c] + p[-i * 4 + c]) * weights[i];
+                dst[x * 4 + c] = acc;
+            }
+        }
+#endif
+    }
+
+    // box filter of a padded row with a running sum (cost independent of the radius)
+    // ------------------------------------------------------------------------
+    inline void boxRow(const float* src, float* dst, int n, int radius)
+    {
+        const float scale = 1.0f / (2 * radius + 1);
+        float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i <= 2 * radius; i++)
+            for (int c = 0; c < 4; c++)
+                sum[c] += src[i * 4 + c];
+        for (int x = 0; x < n; x++)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                dst[x * 4 + c] = sum[c] * scale;
+                sum[c] += src[(x + 2 * radius + 1) * 4 + c] - src[x * 4 + c];
+            }
+        }
+    }
+
+    // runs rowFilter(paddedRow, outRow, width) on every row of the image, in parallel.
+    // every chunk of rows uses its own padded float buffers, so half images are converted row by row
+    // ------------------------------------------------------------------------
+    template <typename T, typename RowFilter>
+    void filterRows(T* pixels, int width, int height, int radius, ThreadPool& pool, RowFilter rowFilter)
+    {
+        pool.parallelFor(0, (size_t)height, [&](size_t rowBegin, size_t rowEnd) {
+            std::vector<float> padded((size_t)(width + 2 * radius + 1) * 4);
+            std::vector<float> filtered((size_t)width * 4);
+            for (size_t y = rowBegin; y < rowEnd; y++)
+            {
+                T* row = pixels + y * width * 4;
+                loadPixels(row, padded.data() + radius * 4, width);
+                for (int i = 0; i < radius; i++)
+                {
+                    std::memcpy(&padded[i * 4], &padded[radius * 4], 4 * sizeof(float));
+                    std::memcpy(&padded[(radius + width + i) * 4], &padded[(radius + width - 1) * 4], 4 * sizeof(float));
+                }
+                std::memcpy(&padded[(2 * radius + width) * 4], &padded[(radius + width - 1) * 4], 4 * sizeof(float));
+                rowFilter(padded.data(), filtered.data(), width);
+                storePixels(filtered.data(), row, width);
+            }
+        }, 4);
+    }
+
+    // cache-blocked transpose of a width x height RGBA image into a height x width one
+    // ------------------------------------------------------------------------
+    template <typename T>
+    void transpose(const T* src, T* dst, int width, int height, ThreadPool& pool)
+    {
+        int tilesY = (height + TRANSPOSE_TILE - 1) / TRANSPOSE_TILE;
+        pool.parallelFor(0, (size_t)tilesY, [&](size_t tileBegin, size_t tileEnd) {
+            for (size_t tile = tileBegin; tile < tileEnd; tile++)
+            {
+                int y0 = (int)tile * TRANSPOSE_TILE;
+                int y1 = std::min(height, y0 + TRANSPOSE_TILE);
+                for (int x0 = 0; x0 < width; x0 += TRANSPOSE_TILE)
+                {
+                    int x1 = std::min(width, x0 + TRANSPOSE_TILE);
+                    for (int y = y0; y < y1; y++)
+                        for (int x = x0; x < x1; x++)
+                            std::memcpy(dst + ((size_t)x * height + y) * 4, src + ((size_t)y * width + x) * 4, 4 * sizeof(T));
+                }
+            }
+        });
+    }
+
+    // horizontal filter, then vertical filter done as transpose + horizontal filter + transpose
+    // ------------------------------------------------------------------------
+    template <typename T, typename RowFilter>
+    void separable(std::vector<T>& pixels, int width, int height, int radius, unsigned int passes, ThreadPool& pool, RowFilter rowFilter)
+    {
+        if (width <= 0 || height <= 0)
+            return;
+        std::vector<T> transposed(pixels.size());
+        for (unsigned int pass = 0; pass < passes; pass++)
+        {
+            filterRows(pixels.data(), width, height, radius, pool, rowFilter);
+            transpose(pixels.data(), transposed.data(), width, height, pool);
+            filterRows(transposed.data(), height, width, radius, pool, rowFilter);
+            transpose(transposed.data(), pixels.data(), height, width, pool);
+        }
+    }
+
+    template <typename T>
+    void gaussian(std::vector<T>& pixels, int width, int height, float stdDev, int kernelSize, unsigned int passes, ThreadPool& pool)
+    {
+        BlurKernel kernel = computeBlurKernel(stdDev, kernelSize);
+        const float* weights = kernel.weights.data();
+        int radius = (int)kernel.weights.size() - 1;
+        separable(pixels, width, height, radius, passes, pool, [weights, radius](const float* src, float* dst, int n) {
+            convolveRow(src, dst, n, weights, radius);
+        });
+    }
+
+    template <typename T>
+    void box(std::vector<T>& pixels, int width, int height, int radius, unsigned int passes, ThreadPool& pool)
+    {
+        radius = std::max(radius, 0);
+        separable(pixels, width, height, radius, passes, pool, [radius](const float* src, float* dst, int n) {
+            boxRow(src, dst, n, radius);
+        });
+    }
+}
+
+// Gaussian blur with the same parameters and result as the GPU bloom blur (passes = two_dim_blur_pass)
+// ------------------------------------------------------------------------------------------------------
+inline void blurGaussian(ImageRGBA32F& image, float stdDev, int kernelSize, unsigned int passes, ThreadPool& pool)
+{
+    cpublur::gaussian(image.pixels, image.width, image.height, stdDev, kernelSize, passes, pool);
+}
+inline void blurGaussian(ImageRGBA16F& image, float stdDev, int kernelSize, unsigned int passes, ThreadPool& pool)
+{
+    cpublur::gaussian(image.pixels, image.width, image.height, stdDev, kernelSize, passes, pool);
+}
+
+// Box blur of (2 * radius + 1) pixels per side, repeated passes times (3 passes approximate a gaussian)
+// ------------------------------------------------------------------------------------------------------
+inline void blurBox(ImageRGBA32F& image, int radius, unsigned int passes, ThreadPool& pool)
+{
+    cpublur::box(image.pixels, image.width, image.height, radius, passes, pool);
+}
+inline void blurBox(ImageRGBA16F& image, int radius, unsigned int passes, ThreadPool& pool)
+{
+    cpublur::box(image.pixels, image.width, image.height, radius, passes, pool);
+}
+#endif
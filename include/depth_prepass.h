@@ -0,0 +1,154 @@
+#ifndef DEPTH_PREPASS_H
+#define DEPTH_PREPASS_H
+
+#include <glad/glad.h>
+
+#include <gl_ext.h>
+
+#include <string>
+
+// Depth pre-pass of the forward lighting pass: the scene is first drawn depth only, then lit with GL_EQUAL depth
+// testing, so the lighting shader runs once per pixel instead of once per fragment that passes the depth test.
+// In automatic mode the overdraw is measured every MEASURE_INTERVAL frames on a frame drawn with the pre-pass
+// (samples passing the depth pass over samples passing the lighting pass) and the pre-pass stays on while the
+// overdraw is above the threshold. Queries are read back only once available, so measuring never stalls.
+class DepthPrepass
+{
+    public:
+        enum Mode { OFF, ON, AUTO };
+        static const unsigned int MEASURE_INTERVAL = 60;
+
+        Mode mode;
+        float threshold; // overdraw above which the automatic mode turns the pre-pass on
+        float overdraw = 0.0f; // last measured (0 until the first measure)
+        unsigned long long fragmentInvocations = 0; // lighting shader invocations of the last measured frame (pipeline statistics)
+        bool active = false; // pre-pass used by the current frame
+
+        DepthPrepass(Mode mode, float threshold) : mode(mode), threshold(threshold)
+        {
+            glGenQueries(1, &depthSamplesQuery);
+            glGenQueries(1, &lightingSamplesQuery);
+            glGenQueries(1, &invocationsQuery);
+        }
+
+        ~DepthPrepass()
+        {
+            glDeleteQueries(1, &depthSamplesQuery);
+            glDeleteQueries(1, &lightingSamplesQuery);
+            glDeleteQueries(1, &invocationsQuery);
+        }
+
+        // "off", "on" or "auto"
+        static Mode parseMode(const std::string& name)
+        {
+            return name == "on" ? ON : (name == "auto" ? AUTO : OFF);
+        }
+
+        // collects the finished measures and decides whether the frame uses the pre-pass
+        bool beginFrame()
+        {
+            collect();
+            measuring = mode != OFF && !samplesPending && frame % MEASURE_INTERVAL == 0;
+            active = mode == ON || (mode == AUTO && (measuring || overdraw > threshold));
+            frame++;
+            return active;
+        }
+
+        // depth only: the color writes are masked, the shader is the caller's (any program with the same vertex stage)
+        void beginDepth()
+        {
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            if (measuring)
+                glBeginQuery(GL_SAMPLES_PASSED, depthSamplesQuery);
+        }
+
+        void endDepth()
+        {
+            if (measuring)
+                glEndQuery(GL_SAMPLES_PASSED);
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        }
+
+        // after the pre-pass only the closest fragments pass, and the depth buffer is already complete
+        void beginLighting()
+        {
+            if (active)
+            {
+                glDepthFunc(GL_EQUAL);
+                glDepthMask(GL_FALSE);
+            }
+            if (measuring)
+                glBeginQuery(GL_SAMPLES_PASSED, lightingSamplesQuery);
+            countingInvocations = glExt.pipelineStatistics && !invocationsPending;
+            if (countingInvocations)
+                glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS, invocationsQuery);
+        }
+
+        void endLighting()
+        {
+            if (countingInvocations)
+            {
+                glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS);
+                invocationsPending = true;
+            }
+            if (measuring)
+            {
+                glEndQuery(GL_SAMPLES_PASSED);
+                samplesPending = true;
+            }
+            if (active)
+            {
+                glDepthFunc(GL_LESS);
+                glDepthMask(GL_TRUE);
+            }
+        }
+
+        std::string status() const
+        {
+            std::string state = active ? "on" : "off";
+            if (mode == AUTO)
+                state += " (auto)";
+            if (overdraw > 0.0f)
+                state += ", overdraw " + std::to_string(overdraw).substr(0, 4);
+            if (fragmentInvocations > 0)
+                state += ", " + std::to_string(fragmentInvocations) + " lighting invocations";
+            return state;
+        }
+
+    private:
+        GLuint depthSamplesQuery = 0;
+        GLuint lightingSamplesQuery = 0;
+        GLuint invocationsQuery = 0;
+        bool measuring = false; // the current frame measures the overdraw
+        bool countingInvocations = false;
+        bool samplesPending = false; // overdraw queries issued, results not read yet
+        bool invocationsPending = false;
+        unsigned long long frame = 0;
+
+        static bool available(GLuint query)
+        {
+            GLuint ready = GL_FALSE;
+            glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &ready);
+            return ready == GL_TRUE;
+        }
+
+        void collect()
+        {
+            if (samplesPending && available(depthSamplesQuery) && available(lightingSamplesQuery))
+            {
+                GLuint64 depthSamples = 0, lightingSamples = 0;
+                glGetQueryObjectui64v(depthSamplesQuery, GL_QUERY_RESULT, &depthSamples);
+                glGetQueryObjectui64v(lightingSamplesQuery, GL_QUERY_RESULT, &lightingSamples);
+                overdraw = lightingSamples > 0 ? (float)depthSamples / (float)lightingSamples : 1.0f;
+                samplesPending = false;
+            }
+            if (invocationsPending && available(invocationsQuery))
+            {
+                GLuint64 invocations = 0;
+                glGetQueryObjectui64v(invocationsQuery, GL_QUERY_RESULT, &invocations);
+                fragmentInvocations = invocations;
+                invocationsPending = false;
+            }
+        }
+};
+#endif
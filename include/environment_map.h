@@ -0,0 +1,154 @@
+#ifndef ENVIRONMENT_MAP_H
+#define ENVIRONMENT_MAP_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/constants.hpp>
+#include <stb/stb_image.h>
+
+#include <exr_loader.h>
+#include <thread_pool.h>
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <cctype>
+#include <algorithm>
+
+// HDR environment maps: an equirectangular (latitude / longitude) image in linear radiance, from a Radiance .hdr
+// (stb_image) or an OpenEXR file, resampled on the CPU into the 6 faces of a cubemap stored as shared exponent
+// GL_RGB9_E5 (4 bytes per texel) or GL_RGB16F (6 bytes per texel).
+
+struct EquirectangularImage
+{
+    int width = 0;
+    int height = 0;
+    std::vector<float> pixels; // RGB, rows from the top (north pole)
+};
+
+// .exr through the OpenEXR reader, any other format through stb_image (8-bit images are linearized by it)
+inline bool loadEquirectangular(const std::string& path, EquirectangularImage& image, std::string& error)
+{
+    std::string extension = path.size() >= 4 ? path.substr(path.size() - 4) : "";
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    if (extension == ".exr")
+    {
+        EXRReader reader;
+        if (!reader.load(path))
+        {
+            error = reader.error;
+            return false;
+        }
+        image.width = reader.width;
+        image.height = reader.height;
+        image.pixels = std::move(reader.pixels);
+        return true;
+    }
+    int components;
+    float* data = stbi_loadf(path.c_str(), &image.width, &image.height, &components, 3);
+    if (data == nullptr)
+    {
+        error = stbi_failure_reason() ? stbi_failure_reason() : "cannot read the file";
+        return false;
+    }
+    image.pixels.assign(data, data + (size_t)image.width * image.height * 3);
+    stbi_image_free(data);
+    return true;
+}
+
+// direction through the texel at (u, v) in [-1, 1] of a cubemap face (+x, -x, +y, -y, +z, -z), v down the rows,
+// as the GL cubemap lookup defines the faces
+inline glm::vec3 cubemapDirection(int face, float u, float v)
+{
+    switch (face)
+    {
+        case 0: return glm::vec3(1.0f, -v, -u);
+        case 1: return glm::vec3(-1.0f, -v, u);
+        case 2: return glm::vec3(u, 1.0f, v);
+        case 3: return glm::vec3(u, -1.0f, -v);
+        case 4: return glm::vec3(u, -v, 1.0f);
+        default: return glm::vec3(-u, -v, -1.0f);
+    }
+}
+
+// inverse of cubemapDirection: face of the direction and (u, v) in [-1, 1] on it
+inline int cubemapFace(const glm::vec3& direction, float& u, float& v)
+{
+    glm::vec3 a = glm::abs(direction);
+    if (a.x >= a.y && a.x >= a.z)
+    {
+        u = (direction.x > 0.0f ? -direction.z : direction.z) / a.x;
+        v = -direction.y / a.x;
+        return direction.x > 0.0f ? 0 : 1;
+    }
+    if (a.y >= a.z)
+    {
+        u = direction.x / a.y;
+        v = (direction.y > 0.0f ? direction.z : -direction.z) / a.y;
+        return direction.y > 0.0f ? 2 : 3;
+    }
+    u = (direction.z > 0.0f ? direction.x : -direction.x) / a.z;
+    v = -direction.y / a.z;
+    return direction.z > 0.0f ? 4 : 5;
+}
+
+// bilinear lookup, wrapping around the longitude and clamped at the poles
+inline glm::vec3 sampleEquirectangular(const EquirectangularImage& image, const glm::vec3& direction)
+{
+    glm::vec3 d = glm::normalize(direction);
+    float longitude = std::atan2(d.z, d.x);
+    float latitude = std::acos(glm::clamp(d.y, -1.0f, 1.0f));
+    float x = (longitude / (2.0f * glm::pi<float>()) + 0.5f) * image.width - 0.5f;
+    float y = latitude / glm::pi<float>() * image.height - 0.5f;
+    int x0 = (int)std::floor(x), y0 = (int)std::floor(y);
+    float fx = x - x0, fy = y - y0;
+    auto texel = [&image](int tx, int ty) {
+        tx = ((tx % image.width) + image.width) % image.width;
+        ty = glm::clamp(ty, 0, image.height - 1);
+        const float* p = &image.pixels[((size_t)ty * image.width + tx) * 3];
+        return glm::vec3(p[0], p[1], p[2]);
+    };
+    return glm::mix(glm::mix(texel(x0, y0), texel(x0 + 1, y0), fx), glm::mix(texel(x0, y0 + 1), texel(x0 + 1, y0 + 1), fx), fy);
+}
+
+// Writes the 6 faces of faceSize x faceSize texels one after the other into destination, every texel the average of
+// 2x2 lookups when the source is denser than the faces (a face covers a quarter of the longitude), else one lookup;
+// rows of all the faces are converted in parallel.
+// halfFloat selects GL_RGB16F / GL_HALF_FLOAT texels, otherwise GL_RGB9_E5 / GL_UNSIGNED_INT_5_9_9_9_REV.
+inline void equirectangularToCubemap(const EquirectangularImage& image, int faceSize, bool halfFloat, float intensity, void* destination, ThreadPool& pool)
+{
+    size_t texelBytes = halfFloat ? 6 : 4;
+    int samples = image.width / 4 > faceSize ? 2 : 1;
+    pool.parallelFor(0, (size_t)faceSize * 6, [&](size_t begin, size_t end) {
+        for (size_t row = begin; row < end; row++)
+        {
+            int face = (int)(row / faceSize), y = (int)(row % faceSize);
+            unsigned char* out = (unsigned char*)destination + row * faceSize * texelBytes;
+            for (int x = 0; x < faceSize; x++)
+            {
+                glm::vec3 radiance(0.0f);
+                for (int sy = 0; sy < samples; sy++)
+                    for (int sx = 0; sx < samples; sx++)
+                    {
+                        float u = 2.0f * (x + (sx + 0.5f) / samples) / faceSize - 1.0f;
+                        float v = 2.0f * (y + (sy + 0.5f) / samples) / faceSize - 1.0f;
+                        radiance += sampleEquirectangular(image, cubemapDirection(face, u, v));
+                    }
+                radiance = glm::clamp(radiance * (intensity / (samples * samples)), 0.0f, 65000.0f); // RGB9_E5 tops at 65408
+                if (halfFloat)
+                {
+                    uint16_t half[3] = { glm::packHalf1x16(radiance.r), glm::packHalf1x16(radiance.g), glm::packHalf1x16(radiance.b) };
+                    std::memcpy(out + x * texelBytes, half, sizeof(half));
+                }
+                else
+                {
+                    uint32_t shared = glm::packF3x9_E1x5(radiance);
+                    std::memcpy(out + x * texelBytes, &shared, sizeof(shared));
+                }
+            }
+        }
+    }, 8);
+}
+#endif
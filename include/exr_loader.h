@@ -0,0 +1,260 @@
+#ifndef EXR_LOADER_H
+#define EXR_LOADER_H
+
+#include <glm/gtc/packing.hpp>
+#include <stb/stb_image.h>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iterator>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+// Reader of single part, scanline OpenEXR images (the usual layout of environment maps) without compression or with
+// RLE / ZIPS / ZIP compression (zlib streams are inflated by stb_image). Half, float and uint channels are read;
+// R, G and B become an RGB float image, a single Y channel is replicated. Tiled, multi-part, deep and the
+// wavelet / lossy compressions (PIZ, PXR24, B44, DWA) are reported as unsupported.
+
+class EXRReader
+{
+    public:
+        int width = 0;
+        int height = 0;
+        std::vector<float> pixels; // RGB, rows from the top
+        std::string error;
+
+        bool load(const std::string& path)
+        {
+            std::ifstream file(path, std::ios::binary);
+            data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            bool loaded = parse();
+            data.clear();
+            data.shrink_to_fit();
+            if (!loaded)
+                pixels.clear();
+            return loaded;
+        }
+
+    private:
+        enum Compression { NONE = 0, RLE = 1, ZIPS = 2, ZIP = 3 };
+        enum PixelType { UINT = 0, HALF = 1, FLOAT = 2 };
+
+        struct Channel
+        {
+            std::string name;
+            int type;
+            int target; // 0..2 for R, G, B, 3 for Y, -1 if not read
+        };
+
+        std::vector<unsigned char> data;
+        size_t position = 0;
+
+        bool fail(const std::string& message)
+        {
+            error = message;
+            return false;
+        }
+
+        bool readString(std::string& value)
+        {
+            value.clear();
+            while (position < data.size() && data[position] != 0)
+                value += (char)data[position++];
+            return position++ < data.size();
+        }
+
+        template <typename T>
+        bool read(T& value)
+        {
+            if (position + sizeof(T) > data.size())
+                return false;
+            std::memcpy(&value, &data[position], sizeof(T));
+            position += sizeof(T);
+            return true;
+        }
+
+        static int typeSize(int type)
+        {
+            return type == HALF ? 2 : 4;
+        }
+
+        static int linesPerChunk(int compression)
+        {
+            return compression == ZIP ? 16 : 1;
+        }
+
+        bool parse()
+        {
+            uint32_t magic = 0, version = 0;
+            if (!read(magic) || magic != 20000630)
+                return fail("not an OpenEXR file");
+            if (!read(version) || (version & 0xFF) != 2)
+                return fail("unsupported OpenEXR version");
+            if (version & (0x200 | 0x800 | 0x1000))
+                return fail("tiled, deep and multi-part OpenEXR images are not supported");
+
+            std::vector<Channel> channels;
+            int compression = -1;
+            int32_t window[4] = { 0, 0, -1, -1 };
+            while (true)
+            {
+                std::string name, type;
+                int32_t size = 0;
+                if (!readString(name))
+                    return fail("truncated header");
+                if (name.empty())
+                    break;
+                if (!readString(type) || !read(size) || size < 0 || position + size > data.size())
+                    return fail("truncated header");
+                size_t end = position + size;
+                if (name == "channels" && type == "chlist")
+                {
+                    std::string channelName;
+                    while (readString(channelName) && !channelName.empty())
+                    {
+                        int32_t pixelType, sampling[2];
+                        uint8_t linear[4];
+                        if (!read(pixelType) || !read(linear) || !read(sampling[0]) || !read(sampling[1]))
+                            return fail("truncated channel list");
+                        if (sampling[0] != 1 || sampling[1] != 1)
+                            return fail("subsampled channels are not supported");
+                        int target = channelName == "R" ? 0 : channelName == "G" ? 1 : channelName == "B" ? 2 : channelName == "Y" ? 3 : -1;
+                        channels.push_back({ channelName, pixelType, target });
+                    }
+                }
+                else if (name == "compression" && size >= 1)
+                    compression = data[position];
+                else if (name == "dataWindow" && size >= 16)
+                    std::memcpy(window, &data[position], 16);
+                position = end;
+            }
+            if (channels.empty())
+                return fail("no channels");
+            if (compression < NONE || compression > ZIP)
+                return fail("unsupported compression (only none, RLE, ZIPS and ZIP)");
+            width = window[2] - window[0] + 1;
+            height = window[3] - window[1] + 1;
+            if (width <= 0 || height <= 0)
+                return fail("empty data window");
+
+            size_t lineBytes = 0;
+            for (const Channel& channel : channels)
+                lineBytes += (size_t)width * typeSize(channel.type);
+            int lines = linesPerChunk(compression);
+            size_t chunks = (height + lines - 1) / lines;
+            std::vector<uint64_t> offsets(chunks);
+            for (uint64_t& offset : offsets)
+                if (!read(offset))
+                    return fail("truncated offset table");
+
+            pixels.assign((size_t)width * height * 3, 0.0f);
+            std::vector<unsigned char> block(lineBytes * lines), scratch(lineBytes * lines);
+            for (uint64_t offset : offsets)
+            {
+                position = (size_t)offset;
+                int32_t y = 0, size = 0;
+                if (!read(y) || !read(size) || size < 0 || position + size > data.size())
+                    return fail("truncated chunk");
+                int first = y - window[1];
+                int count = std::min(lines, height - first);
+                if (first < 0 || count <= 0)
+                    return fail("chunk outside the data window");
+                size_t expected = lineBytes * count;
+                if (!decompress(compression, &data[position], size, block.data(), expected, scratch))
+                    return fail("corrupt chunk");
+                convert(channels, block.data(), first, count);
+            }
+            return true;
+        }
+
+        // chunks that do not shrink are stored as they are
+        static bool decompress(int compression, const unsigned char* source, size_t size, unsigned char* destination, size_t expected,
+                               std::vector<unsigned char>& scratch)
+        {
+            if (compression == NONE || size == expected)
+            {
+                if (size != expected)
+                    return false;
+                std::memcpy(destination, source, expected);
+                return true;
+            }
+            size_t produced = 0;
+            if (compression == RLE)
+            {
+                for (size_t i = 0; i < size;)
+                {
+                    int count = (signed char)source[i++];
+                    if (count < 0)
+                    {
+                        if (i + (size_t)-count > size || produced + (size_t)-count > expected)
+                            return false;
+                        std::memcpy(&scratch[produced], &source[i], (size_t)-count);
+                        produced += (size_t)-count;
+                        i += (size_t)-count;
+                    }
+                    else
+                    {
+                        if (i >= size || produced + count + 1 > expected)
+                            return false;
+                        std::memset(&scratch[produced], source[i++], (size_t)count + 1);
+                        produced += (size_t)count + 1;
+                    }
+                }
+            }
+            else
+            {
+                int inflated = stbi_zlib_decode_buffer((char*)scratch.data(), (int)expected, (const char*)source, (int)size);
+                if (inflated < 0)
+                    return false;
+                produced = (size_t)inflated;
+            }
+            if (produced != expected)
+                return false;
+            // undo the byte delta predictor, then interleave the two halves
+            for (size_t i = 1; i < expected; i++)
+                scratch[i] = (unsigned char)(scratch[i - 1] + scratch[i] - 128);
+            const unsigned char* low = scratch.data();
+            const unsigned char* high = scratch.data() + (expected + 1) / 2;
+            for (size_t i = 0; i < expected; i++)
+                destination[i] = (i & 1) ? *high++ : *low++;
+            return true;
+        }
+
+        // every line of the chunk holds the channels one after the other, in the order of the channel list
+        void convert(const std::vector<Channel>& channels, const unsigned char* block, int first, int count)
+        {
+            for (int line = 0; line < count; line++)
+            {
+                float* row = &pixels[(size_t)(first + line) * width * 3];
+                for (const Channel& channel : channels)
+                {
+                    for (int x = 0; x < width; x++)
+                    {
+                        float value;
+                        if (channel.type == HALF)
+                        {
+                            uint16_t half;
+                            std::memcpy(&half, block + (size_t)x * 2, 2);
+                            value = glm::unpackHalf1x16(half);
+                        }
+                        else if (channel.type == FLOAT)
+                            std::memcpy(&value, block + (size_t)x * 4, 4);
+                        else
+                        {
+                            uint32_t integer;
+                            std::memcpy(&integer, block + (size_t)x * 4, 4);
+                            value = (float)integer;
+                        }
+                        if (channel.target == 3)
+                            row[x * 3] = row[x * 3 + 1] = row[x * 3 + 2] = value;
+                        else if (channel.target >= 0)
+                            row[x * 3 + channel.target] = value;
+                    }
+                    block += (size_t)width * typeSize(channel.type);
+                }
+            }
+        }
+};
+#endif
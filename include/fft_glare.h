@@ -0,0 +1,360 @@
+#ifndef FFT_GLARE_H
+#define FFT_GLARE_H
+
+#include <cpu_blur.h>
+#include <thread_pool.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <complex>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+// Glare (bloom with wide, non-separable kernels such as star/diffraction patterns) on the CPU.
+// Small kernels are convolved directly, big ones through FFT with the kernel spectrum cached until the PSF changes.
+
+typedef std::complex<float> Complex;
+
+// Point spread function of the glare: (2 * radius + 1)^2 rgb weights centered on the middle texel
+struct GlareKernel
+{
+    int radius = 0;
+    std::vector<glm::vec3> weights;
+    unsigned long long generation = 0; // different for every kernel built (tells the convolver its spectra are stale)
+
+    int size() const
+    {
+        return 2 * radius + 1;
+    }
+    const glm::vec3& at(int x, int y) const // x, y in [-radius, radius]
+    {
+        return weights[(size_t)(y + radius) * size() + (x + radius)];
+    }
+};
+
+// Way a glare convolution is computed
+enum GlareConvolutionPath {
+    GLARE_SPATIAL = 0,
+    GLARE_FFT = 1
+};
+
+// Builds a star shaped PSF: a gaussian core plus "spikes" streaks decaying exponentially, slightly longer
+// for red than for blue as diffraction spikes are. Every channel is normalized to sum intensity.
+// ------------------------------------------------------------------------------------------------------
+inline GlareKernel makeStarGlareKernel(int radius, int spikes, float coreStdDev, float spikeFalloff, float intensity)
+{
+    static unsigned long long kernelsBuilt = 0;
+    GlareKernel kernel;
+    kernel.generation = ++kernelsBuilt;
+    kernel.radius = std::max(radius, 0);
+    kernel.weights.assign((size_t)kernel.size() * kernel.size(), glm::vec3(0.0f));
+    const glm::vec3 wavelengthScale(1.0f, 0.85f, 0.7f);
+    const float sigma = std::max(coreStdDev, 1e-3f);
+    glm::vec3 sum(0.0f);
+    for (int y = -kernel.radius; y <= kernel.radius; y++)
+    {
+        for (int x = -kernel.radius; x <= kernel.radius; x++)
+        {
+            float distance = std::sqrt((float)(x * x + y * y));
+            glm::vec3 weight(std::exp(-distance * distance / (2.0f * sigma * sigma)));
+            if (spikes > 0 && distance > 0.0f)
+            {
+                // angular distance from the nearest spike direction, turned into a thin streak
+                float angle = std::atan2((float)y, (float)x);
+                float sector = 3.14159265f / spikes;
+                float fromSpike = std::abs(std::remainder(angle, sector)) * distance;
+                float streak = std::exp(-fromSpike * fromSpike * 2.0f);
+                for (int c = 0; c < 3; c++)
+                    weight[c] += 0.2f * streak * std::exp(-distance / (spikeFalloff * wavelengthScale[c]));
+            }
+            kernel.weights[(size_t)(y + kernel.radius) * kernel.size() + (x + kernel.radius)] = weight;
+            sum += weight;
+        }
+    }
+    for (glm::vec3& weight : kernel.weights)
+        weight *= intensity / sum;
+    return kernel;
+}
+
+namespace fftglare
+{
+    // radix-2 FFT of a fixed power of two size, with bit reversal table and twiddles computed once
+    struct FftPlan
+    {
+        int n = 0;
+        std::vector<int> bitReverse;
+        std::vector<Complex> twiddles; // e^(-2 pi i k / n), k < n / 2
+
+        FftPlan() {}
+        FftPlan(int size) : n(size), bitReverse(size), twiddles(size / 2)
+        {
+            int bits = 0;
+            while ((1 << bits) < n)
+                bits++;
+            for (int i = 0; i < n; i++)
+            {
+                int reversed = 0;
+                for (int b = 0; b < bits; b++)
+                    reversed |= ((i >> b) & 1) << (bits - 1 - b);
+                bitReverse[i] = reversed;
+            }
+            for (int k = 0; k < n / 2; k++)
+                twiddles[k] = std::polar(1.0f, -2.0f * 3.14159265358979f * k / n);
+        }
+
+        // in place, unnormalized (the inverse does not divide by n)
+        void transform(Complex* data, bool inverse) const
+        {
+            for (int i = 0; i < n; i++)
+                if (i < bitReverse[i])
+                    std::swap(data[i], data[bitReverse[i]]);
+            for (int length = 2; length <= n; length <<= 1)
+            {
+                int half = length / 2;
+                int step = n / length;
+                for (int start = 0; start < n; start += length)
+                {
+                    for (int k = 0; k < half; k++)
+                    {
+                        Complex w = inverse ? std::conj(twiddles[k * step]) : twiddles[k * step];
+                        Complex even = data[start + k];
+                        Complex odd = data[start + k + half] * w;
+                        data[start + k] = even + odd;
+                        data[start + k + half] = even - odd;
+                    }
+                }
+            }
+        }
+    };
+
+    inline int nextPowerOfTwo(int value)
+    {
+        int power = 1;
+        while (power < value)
+            power <<= 1;
+        return power;
+    }
+
+    // 2D real-to-complex FFT of a width x height real plane (both powers of two, height even).
+    // Two real rows are transformed at once as the real and imaginary part of one complex row, the result keeps
+    // only the (width / 2 + 1) non redundant columns: spectrum[y * (width / 2 + 1) + k]
+    // ------------------------------------------------------------------------
+    inline void forwardReal2D(const float* plane, std::vector<Complex>& spectrum, const FftPlan& rowPlan, const FftPlan& columnPlan, ThreadPool& pool)
+    {
+        int width = rowPlan.n, height = columnPlan.n, halfWidth = width / 2 + 1;
+        spectrum.resize((size_t)height * halfWidth);
+        pool.parallelFor(0, (size_t)height / 2, [&](size_t pairBegin, size_t pairEnd) {
+            std::vector<Complex> row(width);
+            for (size_t pair = pairBegin; pair < pairEnd; pair++)
+            {
+                const float* a = plane + (2 * pair) * width;
+                const float* b = a + width;
+                for (int x = 0; x < width; x++)
+                    row[x] = Complex(a[x], b[x]);
+                rowPlan.transform(row.data(), false);
+                Complex* spectrumA = &spectrum[(2 * pair) * halfWidth];
+                Complex* spectrumB = spectrumA + halfWidth;
+                for (int k = 0; k < halfWidth; k++)
+                {
+                    Complex z = row[k], zMirror = std::conj(row[(width - k) % width]);
+                    spectrumA[k] = (z + zMirror) * 0.5f;
+                    spectrumB[k] = (z - zMirror) * Complex(0.0f, -0.5f);
+                }
+            }
+        });
+        pool.parallelFor(0, (size_t)halfWidth, [&](size_t columnBegin, size_t columnEnd) {
+            std::vector<Complex> column(height);
+            for (size_t k = columnBegin; k < columnEnd; k++)
+            {
+                for (int y = 0; y < height; y++)
+                    column[y] = spectrum[(size_t)y * halfWidth + k];
+                columnPlan.transform(column.data(), false);
+                for (int y = 0; y < height; y++)
+                    spectrum[(size_t)y * halfWidth + k] = column[y];
+            }
+        });
+    }
+
+    // inverse of forwardReal2D (destroys the spectrum), normalized
+    // ------------------------------------------------------------------------
+    inline void inverseReal2D(std::vector<Complex>& spectrum, float* plane, const FftPlan& rowPlan, const FftPlan& columnPlan, ThreadPool& pool)
+    {
+        int width = rowPlan.n, height = columnPlan.n, halfWidth = width / 2 + 1;
+        pool.parallelFor(0, (size_t)halfWidth, [&](size_t columnBegin, size_t columnEnd) {
+            std::vector<Complex> column(height);
+            for (size_t k = columnBegin; k < columnEnd; k++)
+            {
+                for (int y = 0; y < height; y++)
+                    column[y] = spectrum[(size_t)y * halfWidth + k];
+                columnPlan.transform(column.data(), true);
+                for (int y = 0; y < height; y++)
+                    spectrum[(size_t)y * halfWidth + k] = column[y];
+            }
+        });
+        const float scale = 1.0f / ((float)width * height);
+        pool.parallelFor(0, (size_t)height / 2, [&](size_t pairBegin, size_t pairEnd) {
+            std::vector<Complex> row(width);
+            for (size_t pair = pairBegin; pair < pairEnd; pair++)
+            {
+                const Complex* spectrumA = &spectrum[(2 * pair) * halfWidth];
+                const Complex* spectrumB = spectrumA + halfWidth;
+                // rebuild the full spectrum of a + i b from the hermitian halves
+                for (int k = 0; k < halfWidth; k++)
+                    row[k] = spectrumA[k] + Complex(0.0f, 1.0f) * spectrumB[k];
+                for (int k = halfWidth; k < width; k++)
+                    row[k] = std::conj(spectrumA[width - k]) + Complex(0.0f, 1.0f) * std::conj(spectrumB[width - k]);
+                rowPlan.transform(row.data(), true);
+                float* a = plane + (2 * pair) * width;
+                float* b = a + width;
+                for (int x = 0; x < width; x++)
+                {
+                    a[x] = row[x].real() * scale;
+                    b[x] = row[x].imag() * scale;
+                }
+            }
+        });
+    }
+
+}
+
+// Convolves RGBA float images with a GlareKernel, choosing between the direct and the FFT path.
+// The kernel spectra of the FFT path are kept until the kernel or the padded size changes.
+class GlareConvolver
+{
+    public:
+        // last path taken and number of kernel spectra computations (to check the cache is effective)
+        GlareConvolutionPath lastPath = GLARE_SPATIAL;
+        unsigned int spectrumComputations = 0;
+
+        // estimated cost of each path (multiply-adds), the FFT one counts 3 channels x (forward + inverse)
+        // transforms of the padded plane and the spectrum products; butterflies are complex, hence the factor 4
+        static double spatialCost(int width, int height, const GlareKernel& kernel)
+        {
+            return 3.0 * width * height * (double)kernel.size() * kernel.size();
+        }
+        static double fftCost(int width, int height, const GlareKernel& kernel)
+        {
+            double paddedWidth = fftglare::nextPowerOfTwo(width + 2 * kernel.radius);
+            double paddedHeight = std::max(2, fftglare::nextPowerOfTwo(height + 2 * kernel.radius));
+            double points = paddedWidth * paddedHeight;
+            return 3.0 * 4.0 * (points * std::log2(points) + points);
+        }
+        static GlareConvolutionPath selectPath(int width, int height, const GlareKernel& kernel)
+        {
+            return fftCost(width, height, kernel) < spatialCost(width, height, kernel) ? GLARE_FFT : GLARE_SPATIAL;
+        }
+
+        // convolves the rgb channels of image (clamp-to-edge borders), alpha is left untouched
+        void convolve(ImageRGBA32F& image, const GlareKernel& kernel, ThreadPool& pool)
+        {
+            lastPath = selectPath(image.width, image.height, kernel);
+            if (lastPath == GLARE_FFT)
+                convolveFFT(image, kernel, pool);
+            else
+                convolveSpatial(image, kernel, pool);
+        }
+
+        void convolveSpatial(ImageRGBA32F& image, const GlareKernel& kernel, ThreadPool& pool)
+        {
+            const ImageRGBA32F source = image;
+            int width = image.width, height = image.height, radius = kernel.radius;
+            pool.parallelFor(0, (size_t)height, [&](size_t rowBegin, size_t rowEnd) {
+                for (size_t y = rowBegin; y < rowEnd; y++)
+                {
+                    for (int x = 0; x < width; x++)
+                    {
+                        glm::vec3 sum(0.0f);
+                        for (int ky = -radius; ky <= radius; ky++)
+                        {
+                            const float* row = &source.pixels[(size_t)std::clamp((int)y - ky, 0, height - 1) * width * 4];
+                            for (int kx = -radius; kx <= radius; kx++)
+                            {
+                                const float* pixel = row + std::clamp(x - kx, 0, width - 1) * 4;
+                                sum += kernel.at(kx, ky) * glm::vec3(pixel[0], pixel[1], pixel[2]);
+                            }
+                        }
+                        float* out = &image.pixels[((size_t)y * width + x) * 4];
+                        out[0] = sum.r;
+                        out[1] = sum.g;
+                        out[2] = sum.b;
+                    }
+                }
+            }, 4);
+        }
+
+        void convolveFFT(ImageRGBA32F& image, const GlareKernel& kernel, ThreadPool& pool)
+        {
+            int width = image.width, height = image.height, radius = kernel.radius;
+            int paddedWidth = fftglare::nextPowerOfTwo(width + 2 * radius);
+            int paddedHeight = std::max(2, fftglare::nextPowerOfTwo(height + 2 * radius));
+            if (rowPlan.n != paddedWidth)
+                rowPlan = fftglare::FftPlan(paddedWidth);
+            if (columnPlan.n != paddedHeight)
+                columnPlan = fftglare::FftPlan(paddedHeight);
+            updateKernelSpectra(kernel, pool);
+
+            std::vector<float> plane((size_t)paddedWidth * paddedHeight);
+            std::vector<Complex> spectrum;
+            for (int c = 0; c < 3; c++)
+            {
+                // image at the origin, the padding is filled with the clamped borders: columns and rows
+                // [size, size + radius) repeat the last texel and the wrapped ones [padded - radius, padded) the first
+                pool.parallelFor(0, (size_t)paddedHeight, [&](size_t rowBegin, size_t rowEnd) {
+                    for (size_t py = rowBegin; py < rowEnd; py++)
+                    {
+                        int y = (int)py < height + radius ? std::min((int)py, height - 1) : 0;
+                        const float* row = &image.pixels[(size_t)y * width * 4];
+                        float* out = &plane[py * paddedWidth];
+                        for (int px = 0; px < paddedWidth; px++)
+                        {
+                            int x = px < width + radius ? std::min(px, width - 1) : 0;
+                            out[px] = row[x * 4 + c];
+                        }
+                    }
+                });
+                fftglare::forwardReal2D(plane.data(), spectrum, rowPlan, columnPlan, pool);
+                const std::vector<Complex>& kernelSpectrum = kernelSpectra[c];
+                pool.parallelFor(0, spectrum.size(), [&](size_t begin, size_t end) {
+                    for (size_t i = begin; i < end; i++)
+                        spectrum[i] *= kernelSpectrum[i];
+                }, 1024);
+                fftglare::inverseReal2D(spectrum, plane.data(), rowPlan, columnPlan, pool);
+                pool.parallelFor(0, (size_t)height, [&](size_t rowBegin, size_t rowEnd) {
+                    for (size_t y = rowBegin; y < rowEnd; y++)
+                        for (int x = 0; x < width; x++)
+                            image.pixels[(y * width + x) * 4 + c] = plane[y * paddedWidth + x];
+                });
+            }
+        }
+
+    private:
+        fftglare::FftPlan rowPlan;
+        fftglare::FftPlan columnPlan;
+        std::vector<Complex> kernelSpectra[3];
+        unsigned long long kernelGeneration = ~0ull; // of the kernel the spectra were computed from
+        int spectraWidth = 0;
+        int spectraHeight = 0;
+
+        // kernel spectra for the current padded size: the PSF is wrapped around the origin
+        void updateKernelSpectra(const GlareKernel& kernel, ThreadPool& pool)
+        {
+            if (kernel.generation == kernelGeneration && spectraWidth == rowPlan.n && spectraHeight == columnPlan.n)
+                return;
+            kernelGeneration = kernel.generation;
+            spectraWidth = rowPlan.n;
+            spectraHeight = columnPlan.n;
+            spectrumComputations++;
+            std::vector<float> plane((size_t)spectraWidth * spectraHeight);
+            for (int c = 0; c < 3; c++)
+            {
+                std::fill(plane.begin(), plane.end(), 0.0f);
+                for (int y = -kernel.radius; y <= kernel.radius; y++)
+                    for (int x = -kernel.radius; x <= kernel.radius; x++)
+                        plane[(size_t)((y + spectraHeight) % spectraHeight) * spectraWidth + (x + spectraWidth) % spectraWidth] = kernel.at(x, y)[c];
+                fftglare::forwardReal2D(plane.data(), kernelSpectra[c], rowPlan, columnPlan, pool);
+            }
+        }
+};
+#endif
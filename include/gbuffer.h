@@ -0,0 +1,138 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include <glad/glad.h>
+
+#include <iostream>
+#include <iomanip>
+
+// G-buffer of the deferred renderer, 12 bytes per pixel:
+// - albedo : GL_SRGB8_ALPHA8 (the diffuse texture is sRGB, storing it encoded keeps 8 bits enough)
+// - normal : GL_RGB10_A2 (world space normal remapped to [0, 1])
+// - depth : the depth texture of the hdr framebuffer, shared so the skybox is depth tested against the scene
+// Positions are not stored: the lighting pass rebuilds them from depth.
+class GBuffer
+{
+    public:
+        static const unsigned int ALBEDO_BYTES = 4;
+        static const unsigned int NORMAL_BYTES = 4;
+        static const unsigned int DEPTH_BYTES = 4;
+        static const unsigned int HDR_BYTES = 8; // RGBA16F target written by the lighting pass
+
+        GLuint fbo = 0;
+        GLuint albedo = 0;
+        GLuint normal = 0;
+        GLuint depth = 0;
+        unsigned int width;
+        unsigned int height;
+
+        GBuffer(unsigned int width, unsigned int height, GLuint depthTexture) : depth(depthTexture), width(width), height(height)
+        {
+            glGenFramebuffers(1, &fbo);
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+            albedo = createTarget(GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_COLOR_ATTACHMENT0);
+            normal = createTarget(GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV, GL_COLOR_ATTACHMENT1);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+            unsigned int attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+            glDrawBuffers(2, attachments);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cout << "G-buffer not complete!" << std::endl;
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glGenQueries(1, &samplesQuery);
+        }
+
+        ~GBuffer()
+        {
+            glDeleteQueries(1, &samplesQuery);
+            glDeleteTextures(1, &albedo);
+            glDeleteTextures(1, &normal);
+            glDeleteFramebuffers(1, &fbo);
+        }
+
+        // bytes of video memory of the G-buffer (the shared depth included)
+        unsigned long long footprintBytes() const
+        {
+            return (unsigned long long)width * height * (ALBEDO_BYTES + NORMAL_BYTES + DEPTH_BYTES);
+        }
+
+        // starts the geometry pass: binds and clears the G-buffer, counting the fragments written
+        void beginGeometry()
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glEnable(GL_FRAMEBUFFER_SRGB); // albedo is encoded on write
+            collectSamples();
+            if (!queryPending)
+                glBeginQuery(GL_SAMPLES_PASSED, samplesQuery);
+        }
+
+        void endGeometry()
+        {
+            if (!queryPending)
+            {
+                glEndQuery(GL_SAMPLES_PASSED);
+                queryPending = true;
+            }
+            glDisable(GL_FRAMEBUFFER_SRGB);
+        }
+
+        // binds the targets for the lighting pass (albedo, normal and depth on the units first, first + 1, first + 2)
+        void bindTextures(unsigned int firstUnit) const
+        {
+            glActiveTexture(GL_TEXTURE0 + firstUnit);
+            glBindTexture(GL_TEXTURE_2D, albedo);
+            glActiveTexture(GL_TEXTURE0 + firstUnit + 1);
+            glBindTexture(GL_TEXTURE_2D, normal);
+            glActiveTexture(GL_TEXTURE0 + firstUnit + 2);
+            glBindTexture(GL_TEXTURE_2D, depth);
+            glActiveTexture(GL_TEXTURE0);
+        }
+
+        // prints footprint and memory traffic of a frame: the geometry pass writes every fragment that passes the
+        // depth test (overdraw included, last measured value), the lighting pass reads every pixel once and writes the hdr target
+        void report() const
+        {
+            double megabyte = 1024.0 * 1024.0;
+            double written = (double)samplesPassed * (ALBEDO_BYTES + NORMAL_BYTES + DEPTH_BYTES);
+            double read = (double)width * height * (ALBEDO_BYTES + NORMAL_BYTES + DEPTH_BYTES);
+            double lit = (double)width * height * HDR_BYTES;
+            std::cout << std::fixed << std::setprecision(2) << "g-buffer: " << footprintBytes() / megabyte << " MB | traffic per frame: "
+                      << written / megabyte << " MB written (" << samplesPassed << " fragments), " << read / megabyte << " MB read, "
+                      << lit / megabyte << " MB lit" << std::defaultfloat << std::endl;
+        }
+
+    private:
+        GLuint samplesQuery = 0;
+        bool queryPending = false;
+        unsigned long long samplesPassed = 0;
+
+        GLuint createTarget(GLint internalFormat, GLenum format, GLenum type, GLenum attachment)
+        {
+            GLuint texture;
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, texture, 0);
+            return texture;
+        }
+
+        // reads the fragment count of the last geometry pass once the GPU has it (never waits)
+        void collectSamples()
+        {
+            if (!queryPending)
+                return;
+            GLuint available = 0;
+            glGetQueryObjectuiv(samplesQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                return;
+            GLuint64 samples = 0;
+            glGetQueryObjectui64v(samplesQuery, GL_QUERY_RESULT, &samples);
+            samplesPassed = samples;
+            queryPending = false;
+        }
+};
+#endif
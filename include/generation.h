@@ -0,0 +1,61 @@
+#ifndef GENERATION_H
+#define GENERATION_H
+
+#include <vector>
+#include <cstdint>
+#include <type_traits>
+
+// Generation counter of a set of inputs: every frame the inputs are fed between begin() and end(), the generation
+// increases only when their content differs from the previous frame. Work that depends on the inputs can be skipped
+// while the generation it was computed for is still the current one.
+class GenerationCounter
+{
+    public:
+        unsigned long long generation = 0;
+
+        void begin()
+        {
+            hash = 1469598103934665603ull;
+        }
+
+        template <typename T>
+        void add(const T& value)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "inputs are hashed byte by byte");
+            addBytes(&value, sizeof(T));
+        }
+
+        template <typename T>
+        void add(const std::vector<T>& values)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "inputs are hashed byte by byte");
+            size_t count = values.size();
+            addBytes(&count, sizeof(count));
+            if (count > 0)
+                addBytes(values.data(), count * sizeof(T));
+        }
+
+        // closes the frame's inputs and returns the current generation
+        unsigned long long end()
+        {
+            if (hash != lastHash)
+            {
+                generation++;
+                lastHash = hash;
+            }
+            return generation;
+        }
+
+    private:
+        uint64_t hash = 0;
+        uint64_t lastHash = 0;
+
+        // FNV-1a
+        void addBytes(const void* data, size_t length)
+        {
+            const unsigned char* bytes = (const unsigned char*)data;
+            for (size_t i = 0; i < length; i++)
+                hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+};
+#endif
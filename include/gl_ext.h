@@ -0,0 +1,131 @@
+#ifndef GL_EXT_H
+#define GL_EXT_H
+
+#include <glad/glad.h>
+
+#include <iostream>
+#include <string>
+
+// glad is generated for the OpenGL 3.3 core profile: the few newer entry points and constants used by the
+// optional 4.x paths are declared and loaded here, after checking the version of the context we got.
+
+#ifndef APIENTRYP
+#define APIENTRYP APIENTRY *
+#endif
+
+// OpenGL 4.1 / ARB_get_program_binary constants
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+
+// OpenGL 4.2 / 4.3 constants
+#define GL_COMPUTE_SHADER 0x91B9
+#define GL_SHADER_IMAGE_ACCESS_BARRIER_BIT 0x00000020
+#define GL_TEXTURE_FETCH_BARRIER_BIT 0x00000008
+#define GL_FRAMEBUFFER_BARRIER_BIT 0x00000400
+#define GL_MAX_COMPUTE_SHARED_MEMORY_SIZE 0x8262
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#define GL_SHADER_STORAGE_BLOCK 0x92E6
+#define GL_MAX_SHADER_STORAGE_BLOCK_SIZE 0x90DE
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#define GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM 0x8E8D
+#define GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT 0x8E8F
+
+// OpenGL 4.6 / ARB_pipeline_statistics_query constants
+#define GL_VERTEX_SHADER_INVOCATIONS 0x82F0
+#define GL_FRAGMENT_SHADER_INVOCATIONS 0x82F4
+
+typedef void (APIENTRYP PFNGLGETPROGRAMBINARYPROC_EXT)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+typedef void (APIENTRYP PFNGLPROGRAMBINARYPROC_EXT)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+typedef void (APIENTRYP PFNGLPROGRAMPARAMETERIPROC_EXT)(GLuint program, GLenum pname, GLint value);
+typedef void (APIENTRYP PFNGLDISPATCHCOMPUTEPROC_EXT)(GLuint num_groups_x, GLuint num_groups_y, GLuint num_groups_z);
+typedef void (APIENTRYP PFNGLBINDIMAGETEXTUREPROC_EXT)(GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format);
+typedef void (APIENTRYP PFNGLMEMORYBARRIERPROC_EXT)(GLbitfield barriers);
+typedef GLuint (APIENTRYP PFNGLGETPROGRAMRESOURCEINDEXPROC_EXT)(GLuint program, GLenum programInterface, const GLchar* name);
+typedef void (APIENTRYP PFNGLSHADERSTORAGEBLOCKBINDINGPROC_EXT)(GLuint program, GLuint storageBlockIndex, GLuint storageBlockBinding);
+typedef void (APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTPROC_EXT)(GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride);
+
+struct GLExtensions
+{
+    int majorVersion = 3;
+    int minorVersion = 3;
+    bool computeShaders = false; // OpenGL 4.3: compute shaders, image load/store
+    bool shaderStorageBuffers = false; // OpenGL 4.3: shader storage buffer objects
+    bool pipelineStatistics = false; // OpenGL 4.6 or ARB_pipeline_statistics_query: pipeline statistics queries
+    bool multiDrawIndirect = false; // OpenGL 4.3: glMultiDrawElementsIndirect (with base instance)
+    bool textureCompressionBPTC = false; // OpenGL 4.2 or ARB_texture_compression_bptc: BC6H / BC7 textures
+    bool programBinaries = false; // OpenGL 4.1 or ARB_get_program_binary, with at least one binary format
+
+    PFNGLGETPROGRAMBINARYPROC_EXT GetProgramBinary = nullptr;
+    PFNGLPROGRAMBINARYPROC_EXT ProgramBinary = nullptr;
+    PFNGLPROGRAMPARAMETERIPROC_EXT ProgramParameteri = nullptr;
+
+    PFNGLDISPATCHCOMPUTEPROC_EXT DispatchCompute = nullptr;
+    PFNGLBINDIMAGETEXTUREPROC_EXT BindImageTexture = nullptr;
+    PFNGLMEMORYBARRIERPROC_EXT MemoryBarrier = nullptr;
+    PFNGLGETPROGRAMRESOURCEINDEXPROC_EXT GetProgramResourceIndex = nullptr;
+    PFNGLSHADERSTORAGEBLOCKBINDINGPROC_EXT ShaderStorageBlockBinding = nullptr;
+    PFNGLMULTIDRAWELEMENTSINDIRECTPROC_EXT MultiDrawElementsIndirect = nullptr;
+
+    bool atLeast(int major, int minor) const
+    {
+        return majorVersion > major || (majorVersion == major && minorVersion >= minor);
+    }
+};
+
+inline GLExtensions glExt;
+
+// true if the context exposes the extension
+// ------------------------------------------------------------------------------------
+inline bool hasGLExtension(const char* name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++)
+        if (std::string((const char*)glGetStringi(GL_EXTENSIONS, i)) == name)
+            return true;
+    return false;
+}
+
+// Reads the context version and loads the entry points of the features it supports
+// (must be called after gladLoadGLLoader, with the same loader)
+// ------------------------------------------------------------------------------------
+inline void loadGLExtensions(GLADloadproc load)
+{
+    glGetIntegerv(GL_MAJOR_VERSION, &glExt.majorVersion);
+    glGetIntegerv(GL_MINOR_VERSION, &glExt.minorVersion);
+
+    if (glExt.atLeast(4, 1) || hasGLExtension("GL_ARB_get_program_binary"))
+    {
+        glExt.GetProgramBinary = (PFNGLGETPROGRAMBINARYPROC_EXT)load("glGetProgramBinary");
+        glExt.ProgramBinary = (PFNGLPROGRAMBINARYPROC_EXT)load("glProgramBinary");
+        glExt.ProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC_EXT)load("glProgramParameteri");
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        glExt.programBinaries = glExt.GetProgramBinary && glExt.ProgramBinary && glExt.ProgramParameteri && formats > 0;
+    }
+    if (glExt.atLeast(4, 3))
+    {
+        glExt.DispatchCompute = (PFNGLDISPATCHCOMPUTEPROC_EXT)load("glDispatchCompute");
+        glExt.BindImageTexture = (PFNGLBINDIMAGETEXTUREPROC_EXT)load("glBindImageTexture");
+        glExt.MemoryBarrier = (PFNGLMEMORYBARRIERPROC_EXT)load("glMemoryBarrier");
+        glExt.computeShaders = glExt.DispatchCompute && glExt.BindImageTexture && glExt.MemoryBarrier;
+        glExt.GetProgramResourceIndex = (PFNGLGETPROGRAMRESOURCEINDEXPROC_EXT)load("glGetProgramResourceIndex");
+        glExt.ShaderStorageBlockBinding = (PFNGLSHADERSTORAGEBLOCKBINDINGPROC_EXT)load("glShaderStorageBlockBinding");
+        glExt.shaderStorageBuffers = glExt.GetProgramResourceIndex && glExt.ShaderStorageBlockBinding;
+        glExt.MultiDrawElementsIndirect = (PFNGLMULTIDRAWELEMENTSINDIRECTPROC_EXT)load("glMultiDrawElementsIndirect");
+        glExt.multiDrawIndirect = glExt.MultiDrawElementsIndirect != nullptr;
+    }
+    glExt.pipelineStatistics = glExt.atLeast(4, 6) || hasGLExtension("GL_ARB_pipeline_statistics_query");
+    glExt.textureCompressionBPTC = glExt.atLeast(4, 2) || hasGLExtension("GL_ARB_texture_compression_bptc");
+
+    std::cout << "OpenGL " << glExt.majorVersion << "." << glExt.minorVersion << " (" << glGetString(GL_RENDERER) << ")"
+              << " | compute shaders: " << (glExt.computeShaders ? "yes" : "no")
+              << " | storage buffers: " << (glExt.shaderStorageBuffers ? "yes" : "no")
+              << " | pipeline statistics: " << (glExt.pipelineStatistics ? "yes" : "no")
+              << " | multi draw indirect: " << (glExt.multiDrawIndirect ? "yes" : "no")
+              << " | BPTC textures: " << (glExt.textureCompressionBPTC ? "yes" : "no")
+              << " | program binaries: " << (glExt.programBinaries ? "yes" : "no") << std::endl;
+}
+#endif
@@ -0,0 +1,147 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+// Measures GPU time of named passes with GL_TIME_ELAPSED queries. Every pass owns a ring of QUERY_LATENCY frames,
+// each with as many queries as the pass ran in that frame: the results of a frame are read QUERY_LATENCY frames later
+// (nextFrame() ends a frame), when they are available, and summed into one sample, so measuring never stalls the
+// pipeline and a pass that runs several times per frame (the blur passes) is measured as its cost per frame.
+class GpuTimers
+{
+    public:
+        static const int QUERY_LATENCY = 4;
+
+        ~GpuTimers()
+        {
+            clear();
+        }
+
+        // starts measuring a pass (timers can't be nested)
+        void begin(const std::string& name)
+        {
+            Timer& timer = find(name);
+            unsigned int slot = frame % QUERY_LATENCY;
+            Slot& frameQueries = timer.slots[slot];
+            if (frameQueries.frame != frame)
+            {
+                collect(timer, frameQueries);
+                frameQueries.frame = frame;
+                frameQueries.used = 0;
+            }
+            if (frameQueries.used == frameQueries.queries.size())
+            {
+                GLuint query = 0;
+                glGenQueries(1, &query);
+                frameQueries.queries.push_back(query);
+            }
+            glBeginQuery(GL_TIME_ELAPSED, frameQueries.queries[frameQueries.used++]);
+        }
+
+        void end()
+        {
+            glEndQuery(GL_TIME_ELAPSED);
+        }
+
+        // ends the frame: the passes begun from now on belong to the next one
+        void nextFrame()
+        {
+            frame++;
+        }
+
+        // prints the average time per frame of every pass measured since the last report, then resets the averages
+        void report(const std::string& title)
+        {
+            std::cout << "gpu timings (" << title << "):" << std::fixed << std::setprecision(3);
+            for (Timer& timer : timers)
+            {
+                if (timer.samples > 0)
+                    std::cout << " | " << timer.name << ": " << (timer.totalNanoseconds / timer.samples) / 1e6 << " ms";
+                timer.totalNanoseconds = 0.0;
+                timer.samples = 0;
+            }
+            std::cout << std::defaultfloat << std::endl;
+        }
+
+        // average time per frame in milliseconds of a pass since the last report or reset (0 if not measured yet)
+        double averageMilliseconds(const std::string& name)
+        {
+            Timer& timer = find(name);
+            return timer.samples > 0 ? (timer.totalNanoseconds / timer.samples) / 1e6 : 0.0;
+        }
+
+        // drops the samples collected so far, keeping the passes
+        void reset()
+        {
+            for (Timer& timer : timers)
+            {
+                timer.totalNanoseconds = 0.0;
+                timer.samples = 0;
+            }
+        }
+
+        // forgets every pass (when the set of passes changes, e.g. switching bloom implementation)
+        void clear()
+        {
+            for (Timer& timer : timers)
+                for (Slot& slot : timer.slots)
+                    if (!slot.queries.empty())
+                        glDeleteQueries((GLsizei)slot.queries.size(), slot.queries.data());
+            timers.clear();
+        }
+
+    private:
+        struct Slot
+        {
+            std::vector<GLuint> queries;
+            unsigned int used = 0; // queries begun in the frame
+            unsigned long long frame = ~0ull; // frame the queries belong to
+        };
+
+        struct Timer
+        {
+            std::string name;
+            Slot slots[QUERY_LATENCY];
+            double totalNanoseconds = 0.0;
+            unsigned int samples = 0;
+        };
+        std::vector<Timer> timers;
+        unsigned long long frame = 0;
+
+        Timer& find(const std::string& name)
+        {
+            for (Timer& timer : timers)
+                if (timer.name == name)
+                    return timer;
+            timers.push_back(Timer());
+            timers.back().name = name;
+            return timers.back();
+        }
+
+        // one sample with the time of every query of the frame (dropped if they are not available yet; queries of the same
+        // target complete in order, so the last one tells for all)
+        void collect(Timer& timer, const Slot& slot)
+        {
+            if (slot.used == 0)
+                return;
+            GLuint available = 0;
+            glGetQueryObjectuiv(slot.queries[slot.used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                return;
+            double total = 0.0;
+            for (unsigned int q = 0; q < slot.used; q++)
+            {
+                GLuint64 elapsed = 0;
+                glGetQueryObjectui64v(slot.queries[q], GL_QUERY_RESULT, &elapsed);
+                total += (double)elapsed;
+            }
+            timer.totalNanoseconds += total;
+            timer.samples++;
+        }
+};
+#endif
@@ -0,0 +1,506 @@
+#ifndef IBL_H
+#define IBL_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/constants.hpp>
+#include <stb/stb_image.h>
+
+#include <environment_map.h>
+#include <mapped_file.h>
+#include <thread_pool.h>
+#include <shader.h>
+
+#include <vector>
+#include <string>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <filesystem>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+// Image based lighting baked from the skybox on the CPU (rows of the cubemaps in parallel on the thread pool):
+// - diffuse: irradiance projected on 9 spherical harmonics (order 2), evaluated per pixel by the lighting shaders
+// - specular: cubemap prefiltered with the GGX distribution, one mip level per roughness (0 at the top level),
+//   importance sampled with the sample footprint read from the matching mip of the source (filtered importance sampling)
+// The result is stored in the cache directory under the hash of the skybox files and of the bake settings, so later
+// startups map it and upload it without baking.
+
+const uint32_t IBL_CACHE_MAGIC = 0x314C4249; // "IBL1"
+const uint32_t IBL_CACHE_VERSION = 1;
+
+struct IBLSettings
+{
+    int specularSize = 128; // top level of the prefiltered cubemap (roughness 0)
+    int specularLevels = 6; // roughness 0 to 1 in equal steps, one level each
+    int samples = 64; // GGX samples per texel
+    std::string cacheDirectory = "cache/ibl";
+};
+
+// cubemap of linear radiance on the CPU, the 6 faces one after the other
+struct CubeImage
+{
+    int size = 0;
+    std::vector<glm::vec3> texels;
+
+    CubeImage(int size = 0) : size(size), texels((size_t)size * size * 6) {}
+
+    glm::vec3& at(int face, int x, int y)
+    {
+        return texels[((size_t)face * size + y) * size + x];
+    }
+
+    const glm::vec3& at(int face, int x, int y) const
+    {
+        return texels[((size_t)face * size + y) * size + x];
+    }
+
+    // bilinear inside the face of the direction (edges clamped)
+    glm::vec3 sample(const glm::vec3& direction) const
+    {
+        float u, v;
+        int face = cubemapFace(direction, u, v);
+        float x = (u + 1.0f) * 0.5f * size - 0.5f, y = (v + 1.0f) * 0.5f * size - 0.5f;
+        int x0 = (int)std::floor(x), y0 = (int)std::floor(y);
+        float fx = x - x0, fy = y - y0;
+        int x1 = glm::clamp(x0 + 1, 0, size - 1), y1 = glm::clamp(y0 + 1, 0, size - 1);
+        x0 = glm::clamp(x0, 0, size - 1);
+        y0 = glm::clamp(y0, 0, size - 1);
+        return glm::mix(glm::mix(at(face, x0, y0), at(face, x1, y0), fx), glm::mix(at(face, x0, y1), at(face, x1, y1), fx), fy);
+    }
+
+    CubeImage downsample() const
+    {
+        CubeImage next(std::max(1, size / 2));
+        for (int face = 0; face < 6; face++)
+            for (int y = 0; y < next.size; y++)
+                for (int x = 0; x < next.size; x++)
+                    next.at(face, x, y) = 0.25f * (at(face, x * 2, y * 2) + at(face, x * 2 + 1, y * 2) + at(face, x * 2, y * 2 + 1) + at(face, x * 2 + 1, y * 2 + 1));
+        return next;
+    }
+};
+
+// irradiance of the 9 spherical harmonics, already convolved with the cosine lobe and divided by pi:
+// albedo * sum(coefficient * basis(normal)) is the diffuse radiance
+struct SHIrradiance
+{
+    glm::vec3 coefficients[9];
+};
+
+// solid angle of the texel centered at (u, v) on a face of the given size
+inline float cubeTexelSolidAngle(float u, float v, int size)
+{
+    float texel = 2.0f / size;
+    return texel * texel / std::pow(1.0f + u * u + v * v, 1.5f);
+}
+
+inline SHIrradiance projectIrradiance(const CubeImage& cube, ThreadPool& pool)
+{
+    const float band[3] = { 1.0f, 2.0f / 3.0f, 0.25f }; // cosine lobe convolution over pi
+    glm::vec3 sums[9] = {};
+    std::mutex sumsMutex;
+    pool.parallelFor(0, (size_t)cube.size * 6, [&](size_t begin, size_t end) {
+        glm::vec3 part[9] = {};
+        for (size_t row = begin; row < end; row++)
+        {
+            int face = (int)(row / cube.size), y = (int)(row % cube.size);
+            float v = 2.0f * (y + 0.5f) / cube.size - 1.0f;
+            for (int x = 0; x < cube.size; x++)
+            {
+                float u = 2.0f * (x + 0.5f) / cube.size - 1.0f;
+                glm::vec3 n = glm::normalize(cubemapDirection(face, u, v));
+                glm::vec3 radiance = cube.at(face, x, y) * cubeTexelSolidAngle(u, v, cube.size);
+                part[0] += radiance * 0.282095f;
+                part[1] += radiance * (0.488603f * n.y);
+                part[2] += radiance * (0.488603f * n.z);
+                part[3] += radiance * (0.488603f * n.x);
+                part[4] += radiance * (1.092548f * n.x * n.y);
+                part[5] += radiance * (1.092548f * n.y * n.z);
+                part[6] += radiance * (0.315392f * (3.0f * n.z * n.z - 1.0f));
+                part[7] += radiance * (1.092548f * n.x * n.z);
+                part[8] += radiance * (0.546274f * (n.x * n.x - n.y * n.y));
+            }
+        }
+        std::lock_guard<std::mutex> lock(sumsMutex);
+        for (int i = 0; i < 9; i++)
+            sums[i] += part[i];
+    }, 8);
+    SHIrradiance irradiance;
+    for (int i = 0; i < 9; i++)
+        irradiance.coefficients[i] = sums[i] * band[i == 0 ? 0 : (i < 4 ? 1 : 2)];
+    return irradiance;
+}
+
+// GGX prefiltered level: every texel integrates the source around its direction (normal = view = reflection)
+inline CubeImage prefilterSpecular(const std::vector<CubeImage>& sourceMips, int size, float roughness, int samples, ThreadPool& pool)
+{
+    // the sample set is the same for every texel: tangent space half vectors, their weight and source level
+    struct Sample
+    {
+        glm::vec3 light; // tangent space, z along the normal
+        float weight; // N.L
+        float level;
+    };
+    std::vector<Sample> set;
+    float alpha = roughness * roughness;
+    float texelSolidAngle = 4.0f * glm::pi<float>() / (6.0f * sourceMips[0].size * sourceMips[0].size);
+    for (int i = 0; i < samples; i++)
+    {
+        // Hammersley point, then the GGX half vector distribution
+        uint32_t bits = (uint32_t)i;
+        bits = (bits << 16u) | (bits >> 16u);
+        bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+        bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+        bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+        bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+        float xi1 = (float)i / samples, xi2 = bits * 2.3283064365386963e-10f;
+        float phi = 2.0f * glm::pi<float>() * xi1;
+        float cosTheta = std::sqrt((1.0f - xi2) / (1.0f + (alpha * alpha - 1.0f) * xi2));
+        float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+        glm::vec3 half(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+        glm::vec3 light = 2.0f * cosTheta * half - glm::vec3(0.0f, 0.0f, 1.0f);
+        if (light.z <= 0.0f)
+            continue;
+        // pdf of the light direction is D * N.H / (4 V.H) = D / 4 with V = N
+        float denominator = cosTheta * cosTheta * (alpha * alpha - 1.0f) + 1.0f;
+        float distribution = alpha * alpha / (glm::pi<float>() * denominator * denominator);
+        float sampleSolidAngle = 1.0f / (samples * distribution * 0.25f + 1e-6f);
+        float level = roughness == 0.0f ? 0.0f : glm::clamp(0.5f * std::log2(sampleSolidAngle / texelSolidAngle) + 1.0f, 0.0f, (float)sourceMips.size() - 1.0f);
+        set.push_back({ light, light.z, level });
+    }
+
+    CubeImage result(size);
+    pool.parallelFor(0, (size_t)size * 6, [&](size_t begin, size_t end) {
+        for (size_t row = begin; row < end; row++)
+        {
+            int face = (int)(row / size), y = (int)(row % size);
+            float v = 2.0f * (y + 0.5f) / size - 1.0f;
+            for (int x = 0; x < size; x++)
+            {
+                float u = 2.0f * (x + 0.5f) / size - 1.0f;
+                glm::vec3 n = glm::normalize(cubemapDirection(face, u, v));
+                glm::vec3 up = std::fabs(n.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+                glm::vec3 tangent = glm::normalize(glm::cross(up, n));
+                glm::vec3 bitangent = glm::cross(n, tangent);
+                glm::vec3 sum(0.0f);
+                float weight = 0.0f;
+                for (const Sample& s : set)
+                {
+                    glm::vec3 l = tangent * s.light.x + bitangent * s.light.y + n * s.light.z;
+                    int low = (int)s.level;
+                    int high = std::min(low + 1, (int)sourceMips.size() - 1);
+                    glm::vec3 radiance = glm::mix(sourceMips[low].sample(l), sourceMips[high].sample(l), s.level - low);
+                    sum += radiance * s.weight;
+                    weight += s.weight;
+                }
+                result.at(face, x, y) = weight > 0.0f ? sum / weight : sourceMips[0].sample(n);
+            }
+        }
+    }, 4);
+    return result;
+}
+
+// Bakes the lighting of the skybox on the pool, caches it and uploads it (prefiltered cubemap and SH coefficients)
+class ImageBasedLighting
+{
+    public:
+        static const unsigned int SPECULAR_UNIT = 7; // texture unit of the prefiltered cubemap in the lighting shaders
+
+        unsigned long long generation = 0; // increases when the baked lighting is uploaded
+        bool ready = false;
+        SHIrradiance irradiance = {};
+
+        ImageBasedLighting(ThreadPool& pool, const IBLSettings& settings) : pool(pool), settings(settings)
+        {
+            this->settings.specularSize = std::max(4, settings.specularSize);
+            this->settings.specularLevels = glm::clamp(settings.specularLevels, 1, (int)std::log2(this->settings.specularSize) - 1); // smallest level 4x4
+            std::error_code error;
+            std::filesystem::create_directories(settings.cacheDirectory, error);
+            glGenTextures(1, &specularTexture);
+        }
+
+        ~ImageBasedLighting()
+        {
+            if (result.valid())
+                result.wait();
+            glDeleteTextures(1, &specularTexture);
+        }
+
+        ImageBasedLighting(const ImageBasedLighting&) = delete;
+        ImageBasedLighting& operator=(const ImageBasedLighting&) = delete;
+
+        // from the 8-bit skybox faces (+x, -x, +y, -y, +z, -z), texel values as displayed
+        void bakeFaces(const std::vector<std::string>& faces)
+        {
+            launch(faces, [faces](int size, CubeImage& cube, std::string& error) {
+                for (int face = 0; face < 6; face++)
+                {
+                    int width, height, components;
+                    unsigned char* data = stbi_load(faces[face].c_str(), &width, &height, &components, 3);
+                    if (data == nullptr || width != height)
+                    {
+                        stbi_image_free(data);
+                        error = "cannot read " + faces[face];
+                        return false;
+                    }
+                    // box filter down to the cube size (nearest texel if the face is smaller)
+                    int step = std::max(1, width / size);
+                    for (int y = 0; y < size; y++)
+                        for (int x = 0; x < size; x++)
+                        {
+                            glm::vec3 sum(0.0f);
+                            int sx0 = x * width / size, sy0 = y * width / size;
+                            for (int sy = sy0; sy < sy0 + step; sy++)
+                                for (int sx = sx0; sx < sx0 + step; sx++)
+                                {
+                                    const unsigned char* texel = data + ((size_t)sy * width + sx) * 3;
+                                    sum += glm::vec3(texel[0], texel[1], texel[2]);
+                                }
+                            cube.at(face, x, y) = sum / (255.0f * step * step);
+                        }
+                    stbi_image_free(data);
+                }
+                return true;
+            }, 1.0f);
+        }
+
+        // from an equirectangular HDR environment map, scaled by intensity as the skybox
+        void bakeEnvironment(const std::string& path, float intensity)
+        {
+            launch({ path }, [path, intensity](int size, CubeImage& cube, std::string& error) {
+                EquirectangularImage image;
+                if (!loadEquirectangular(path, image, error))
+                    return false;
+                int samples = glm::clamp(image.width / (4 * size), 1, 4);
+                for (int face = 0; face < 6; face++)
+                    for (int y = 0; y < size; y++)
+                        for (int x = 0; x < size; x++)
+                        {
+                            glm::vec3 sum(0.0f);
+                            for (int sy = 0; sy < samples; sy++)
+                                for (int sx = 0; sx < samples; sx++)
+                                    sum += sampleEquirectangular(image, cubemapDirection(face, 2.0f * (x + (sx + 0.5f) / samples) / size - 1.0f,
+                                                                                         2.0f * (y + (sy + 0.5f) / samples) / size - 1.0f));
+                            cube.at(face, x, y) = sum * (intensity / (samples * samples));
+                        }
+                return true;
+            }, intensity);
+        }
+
+        // uploads the baked lighting once the job is done; true when it becomes available
+        bool update()
+        {
+            if (!result.valid() || result.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                return false;
+            std::shared_ptr<Baked> baked = result.get();
+            if (!baked)
+                return false;
+            glBindTexture(GL_TEXTURE_CUBE_MAP, specularTexture);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            const unsigned char* data = baked->levels;
+            for (int level = 0; level < settings.specularLevels; level++)
+            {
+                int size = settings.specularSize >> level;
+                for (int face = 0; face < 6; face++)
+                {
+                    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGB16F, size, size, 0, GL_RGB, GL_HALF_FLOAT, data);
+                    data += (size_t)size * size * 6;
+                }
+            }
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, settings.specularLevels - 1);
+            glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS); // the rough levels filter across the face edges
+            irradiance = baked->irradiance;
+            std::cout << baked->report << std::endl;
+            ready = true;
+            generation++;
+            return true;
+        }
+
+        // sampler unit of a lighting shader (its program in use), the lighting stays off until setUniforms
+        void attach(Shader& shader) const
+        {
+            shader.setInt("iblSpecular", SPECULAR_UNIT);
+            shader.setBool("ibl", false);
+        }
+
+        void setUniforms(Shader& shader, float intensity, float roughness) const
+        {
+            shader.setBool("ibl", ready);
+            shader.setVec3Array("shIrradiance", irradiance.coefficients, 9);
+            shader.setFloat("iblMaxLevel", (float)(settings.specularLevels - 1));
+            shader.setFloat("iblIntensity", intensity);
+            shader.setFloat("iblRoughness", roughness);
+        }
+
+        void bind() const
+        {
+            glActiveTexture(GL_TEXTURE0 + SPECULAR_UNIT);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, specularTexture);
+            glActiveTexture(GL_TEXTURE0);
+        }
+
+    private:
+        #pragma pack(push, 1)
+        struct CacheHeader
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint64_t key;
+            uint32_t size;
+            uint32_t levels;
+            float irradiance[27];
+        };
+        #pragma pack(pop)
+
+        // baked lighting: the specular levels (largest first, faces in order, RGB half texels) in the mapped cache
+        // file, or in memory if it cannot be written
+        struct Baked
+        {
+            SHIrradiance irradiance;
+            MappedFile file;
+            std::vector<uint16_t> memory;
+            const unsigned char* levels = nullptr;
+            std::string report;
+        };
+
+        ThreadPool& pool;
+        IBLSettings settings;
+        GLuint specularTexture = 0;
+        std::future<std::shared_ptr<Baked>> result;
+
+        size_t levelsBytes() const
+        {
+            size_t bytes = 0;
+            for (int level = 0; level < settings.specularLevels; level++)
+                bytes += (size_t)(settings.specularSize >> level) * (settings.specularSize >> level) * 6 * 3 * sizeof(uint16_t);
+            return bytes;
+        }
+
+        // FNV-1a of the source files and of the bake settings
+        uint64_t cacheKey(const std::vector<std::string>& sources, float intensity) const
+        {
+            uint64_t hash = 14695981039346656037ull;
+            auto add = [&hash](const void* data, size_t size) {
+                for (size_t i = 0; i < size; i++)
+                    hash = (hash ^ ((const unsigned char*)data)[i]) * 1099511628211ull;
+            };
+            for (const std::string& source : sources)
+            {
+                std::ifstream file(source, std::ios::binary);
+                std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+                add(bytes.data(), bytes.size());
+            }
+            const uint32_t parameters[4] = { IBL_CACHE_VERSION, (uint32_t)settings.specularSize, (uint32_t)settings.specularLevels, (uint32_t)settings.samples };
+            add(parameters, sizeof(parameters));
+            add(&intensity, sizeof(intensity));
+            return hash;
+        }
+
+        bool mapCache(const std::string& path, uint64_t key, Baked& baked) const
+        {
+            if (!baked.file.open(path) || baked.file.size() != sizeof(CacheHeader) + levelsBytes())
+                return false;
+            CacheHeader header;
+            std::memcpy(&header, baked.file.data(), sizeof(header));
+            if (header.magic != IBL_CACHE_MAGIC || header.version != IBL_CACHE_VERSION || header.key != key
+                || header.size != (uint32_t)settings.specularSize || header.levels != (uint32_t)settings.specularLevels)
+                return false;
+            std::memcpy(baked.irradiance.coefficients, header.irradiance, sizeof(header.irradiance));
+            baked.levels = baked.file.data() + sizeof(CacheHeader);
+            return true;
+        }
+
+        // the job loads the source into a cube of the top level size (only on a cache miss), then bakes and caches
+        template <typename Loader>
+        void launch(const std::vector<std::string>& sources, Loader load, float intensity)
+        {
+            result = pool.submit([this, sources, load, intensity]() -> std::shared_ptr<Baked> {
+                std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+                auto elapsed = [](std::chrono::steady_clock::time_point from) {
+                    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - from).count();
+                };
+                std::shared_ptr<Baked> baked = std::make_shared<Baked>();
+                uint64_t key = cacheKey(sources, intensity);
+                char name[32];
+                std::snprintf(name, sizeof(name), "%016llx.ibl", (unsigned long long)key);
+                std::string cachePath = (std::filesystem::path(settings.cacheDirectory) / name).string();
+                std::ostringstream report;
+                report << std::fixed << std::setprecision(1) << "IBL " << sources[0] << (sources.size() > 1 ? " (+" + std::to_string(sources.size() - 1) + " faces)" : "") << ": ";
+                if (mapCache(cachePath, key, *baked))
+                {
+                    report << "cache hit, loaded in " << elapsed(begin) << " ms";
+                    baked->report = report.str();
+                    return baked;
+                }
+
+                CubeImage source(settings.specularSize);
+                std::string error;
+                if (!load(settings.specularSize, source, error))
+                {
+                    std::cout << "IBL: bake failed (" << error << ")" << std::endl;
+                    return nullptr;
+                }
+                report << "source " << elapsed(begin) << " ms";
+                std::chrono::steady_clock::time_point stage = std::chrono::steady_clock::now();
+                std::vector<CubeImage> sourceMips{ source };
+                while (sourceMips.back().size > 1)
+                    sourceMips.push_back(sourceMips.back().downsample());
+                baked->irradiance = projectIrradiance(source, pool);
+                report << ", SH irradiance " << elapsed(stage) << " ms, specular";
+
+                std::vector<uint16_t>& texels = baked->memory;
+                texels.reserve(levelsBytes() / sizeof(uint16_t));
+                for (int level = 0; level < settings.specularLevels; level++)
+                {
+                    stage = std::chrono::steady_clock::now();
+                    int size = settings.specularSize >> level;
+                    float roughness = settings.specularLevels > 1 ? (float)level / (settings.specularLevels - 1) : 0.0f;
+                    CubeImage prefiltered = level == 0 ? source : prefilterSpecular(sourceMips, size, roughness, settings.samples, pool);
+                    for (const glm::vec3& texel : prefiltered.texels)
+                        for (int c = 0; c < 3; c++)
+                            texels.push_back(glm::packHalf1x16(std::min(texel[c], 65000.0f)));
+                    report << " " << size << ":" << elapsed(stage) << "ms";
+                }
+                report << ", total " << elapsed(begin) << " ms (" << settings.samples << " samples, " << pool.size() << " threads)";
+
+                // written to a temporary file renamed at the end, then mapped like a cache hit
+                CacheHeader header = { IBL_CACHE_MAGIC, IBL_CACHE_VERSION, key, (uint32_t)settings.specularSize, (uint32_t)settings.specularLevels, {} };
+                std::memcpy(header.irradiance, baked->irradiance.coefficients, sizeof(header.irradiance));
+                std::string temporary = cachePath + ".tmp";
+                bool written;
+                {
+                    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+                    file.write((const char*)&header, sizeof(header));
+                    file.write((const char*)texels.data(), texels.size() * sizeof(uint16_t));
+                    written = (bool)file;
+                }
+                std::remove(cachePath.c_str());
+                if (written && std::rename(temporary.c_str(), cachePath.c_str()) == 0 && mapCache(cachePath, key, *baked))
+                    std::vector<uint16_t>().swap(texels);
+                else
+                {
+                    baked->levels = (const unsigned char*)texels.data();
+                    report << ", not cached";
+                }
+                baked->report = report.str();
+                return baked;
+            });
+        }
+};
+#endif
@@ -0,0 +1,176 @@
+#ifndef KTX2_H
+#define KTX2_H
+
+#include <mapped_file.h>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+// Minimal KTX2 container for block compressed 2D images: one face, one layer, no supercompression,
+// a basic data format descriptor and no key/value data. The levels are stored from the smallest to the largest,
+// as the format requires, and read in place from a memory mapping.
+
+const uint8_t KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+const uint32_t VK_FORMAT_BC6H_UFLOAT_BLOCK = 143;
+const uint32_t VK_FORMAT_BC7_UNORM_BLOCK = 145;
+const uint32_t VK_FORMAT_BC7_SRGB_BLOCK = 146;
+
+#pragma pack(push, 1)
+struct KTX2Header
+{
+    uint8_t identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+};
+
+struct KTX2LevelIndex
+{
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+};
+#pragma pack(pop)
+
+// data format descriptor of a 4x4 block format of 16 bytes (one sample covering the block)
+inline std::vector<uint32_t> ktx2BlockDescriptor(uint32_t vkFormat)
+{
+    uint32_t colorModel = vkFormat == VK_FORMAT_BC6H_UFLOAT_BLOCK ? 133 : 134; // KHR_DF_MODEL_BC6H / BC7
+    uint32_t transfer = vkFormat == VK_FORMAT_BC7_SRGB_BLOCK ? 2 : 1; // sRGB / linear
+    uint32_t channelType = vkFormat == VK_FORMAT_BC6H_UFLOAT_BLOCK ? 0x80 : 0x00; // float qualifier
+    uint32_t upper = vkFormat == VK_FORMAT_BC6H_UFLOAT_BLOCK ? 0x477FE000u : 0xFFFFFFFFu; // 65504.0 or the full range
+    std::vector<uint32_t> words;
+    words.push_back(4 + 24 + 16); // total size
+    words.push_back(0); // vendor 0 (Khronos), descriptor type 0 (basic)
+    words.push_back(2 | ((24 + 16) << 16)); // version 2, block size
+    words.push_back(colorModel | (1 << 8) | (transfer << 16)); // BT.709 primaries, straight alpha
+    words.push_back(3 | (3 << 8)); // 4x4x1x1 texels per block
+    words.push_back(16); // bytes of plane 0
+    words.push_back(0);
+    words.push_back(0 | (127 << 16) | (channelType << 24)); // sample: bit offset 0, 128 bits
+    words.push_back(0); // sample position
+    words.push_back(0); // lower
+    words.push_back(upper);
+    return words;
+}
+
+// writes the levels (largest first) through a temporary file renamed at the end, so a broken write is never read
+inline bool writeKTX2(const std::string& path, uint32_t vkFormat, uint32_t width, uint32_t height, const std::vector<std::vector<uint8_t>>& levels)
+{
+    std::vector<uint32_t> descriptor = ktx2BlockDescriptor(vkFormat);
+    KTX2Header header = {};
+    std::memcpy(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+    header.vkFormat = vkFormat;
+    header.typeSize = 1;
+    header.pixelWidth = width;
+    header.pixelHeight = height;
+    header.faceCount = 1;
+    header.levelCount = (uint32_t)levels.size();
+    header.dfdByteOffset = (uint32_t)(sizeof(KTX2Header) + levels.size() * sizeof(KTX2LevelIndex));
+    header.dfdByteLength = (uint32_t)(descriptor.size() * sizeof(uint32_t));
+
+    // level data aligned to 16 bytes (the block size), smallest level first
+    std::vector<KTX2LevelIndex> index(levels.size());
+    uint64_t offset = header.dfdByteOffset + header.dfdByteLength;
+    for (size_t level = levels.size(); level-- > 0;)
+    {
+        offset = (offset + 15) & ~(uint64_t)15;
+        index[level] = { offset, levels[level].size(), levels[level].size() };
+        offset += levels[level].size();
+    }
+
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file)
+            return false;
+        file.write((const char*)&header, sizeof(header));
+        file.write((const char*)index.data(), index.size() * sizeof(KTX2LevelIndex));
+        file.write((const char*)descriptor.data(), descriptor.size() * sizeof(uint32_t));
+        uint64_t position = header.dfdByteOffset + header.dfdByteLength;
+        const char padding[16] = {};
+        for (size_t level = levels.size(); level-- > 0;)
+        {
+            file.write(padding, index[level].byteOffset - position);
+            file.write((const char*)levels[level].data(), levels[level].size());
+            position = index[level].byteOffset + levels[level].size();
+        }
+        if (!file)
+            return false;
+    }
+    std::remove(path.c_str());
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+// memory mapped KTX2 file written by writeKTX2 (levels are pointers into the mapping)
+class KTX2File
+{
+    public:
+        struct Level
+        {
+            uint32_t width;
+            uint32_t height;
+            const uint8_t* data;
+            size_t size;
+        };
+
+        std::vector<Level> levels; // largest first
+
+        // false if the file is missing, truncated or not a single face 2D block compressed image
+        bool map(const std::string& path)
+        {
+            levels.clear();
+            if (!file.open(path) || file.size() < sizeof(KTX2Header))
+                return false;
+            const KTX2Header& header = *(const KTX2Header*)file.data();
+            if (std::memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0 || header.faceCount != 1 || header.layerCount > 1
+                || header.pixelDepth > 1 || header.supercompressionScheme != 0 || header.levelCount == 0
+                || sizeof(KTX2Header) + header.levelCount * sizeof(KTX2LevelIndex) > file.size())
+                return false;
+            const KTX2LevelIndex* index = (const KTX2LevelIndex*)(file.data() + sizeof(KTX2Header));
+            for (uint32_t level = 0; level < header.levelCount; level++)
+            {
+                if (index[level].byteOffset + index[level].byteLength > file.size())
+                {
+                    levels.clear();
+                    return false;
+                }
+                uint32_t width = std::max(1u, header.pixelWidth >> level), height = std::max(1u, header.pixelHeight >> level);
+                levels.push_back({ width, height, file.data() + index[level].byteOffset, (size_t)index[level].byteLength });
+            }
+            vkFormat = header.vkFormat;
+            return true;
+        }
+
+        uint32_t format() const
+        {
+            return vkFormat;
+        }
+
+        size_t fileBytes() const
+        {
+            return file.size();
+        }
+
+    private:
+        MappedFile file;
+        uint32_t vkFormat = 0;
+};
+#endif
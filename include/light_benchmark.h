@@ -0,0 +1,131 @@
+#ifndef LIGHT_BENCHMARK_H
+#define LIGHT_BENCHMARK_H
+
+#include <glm/glm.hpp>
+
+#include <gpu_timer.h>
+#include <clusters.h>
+
+#include <vector>
+#include <random>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+// Light scaling benchmark: the scene lights are replaced by random lights inside the tunnel, from minLights to
+// maxLights doubling at every step. Every step is measured with clustered shading and then with plain forward
+// shading (up to forwardMaxLights, over that it is too slow to be worth waiting), printing the GPU time of the
+// lighting pass read from the "lighting" timer of the shading timers. The scene lights are restored at the end.
+class LightBenchmark
+{
+    public:
+        static const unsigned int WARMUP_FRAMES = GpuTimers::QUERY_LATENCY + 4;
+
+        bool active = false;
+
+        LightBenchmark(GpuTimers& timers, unsigned int minLights, unsigned int maxLights, unsigned int framesPerStep, unsigned int forwardMaxLights, float intensity)
+            : timers(timers), minLights(std::max(1u, minLights)), maxLights(std::max(minLights, maxLights)), framesPerStep(std::max(1u, framesPerStep)),
+              forwardMaxLights(forwardMaxLights), intensity(intensity) {}
+
+        // saves the scene lights and starts from the first step (capacity: lights the light buffer can hold)
+        void start(std::vector<glm::vec3>& positions, std::vector<glm::vec3>& colors, unsigned int capacity)
+        {
+            savedPositions = positions;
+            savedColors = colors;
+            active = true;
+            runMaxLights = std::max(1u, std::min(maxLights, capacity));
+            lightCount = std::min(minLights, runMaxLights);
+            startStep(true, positions, colors);
+            std::cout << "light benchmark: " << lightCount << " to " << runMaxLights << " lights, " << framesPerStep << " frames per step";
+            if (runMaxLights < maxLights)
+                std::cout << " (" << maxLights << " do not fit in the light buffer)";
+            std::cout << std::endl;
+        }
+
+        // shading mode the current frame has to use
+        bool clustered() const
+        {
+            return clusteredStep;
+        }
+
+        // advances the benchmark after a frame has been rendered (clusters: the clusters used by the frame)
+        void frameRendered(const LightClusters& clusters, std::vector<glm::vec3>& positions, std::vector<glm::vec3>& colors)
+        {
+            if (!active)
+                return;
+            frame++;
+            if (frame == WARMUP_FRAMES)
+                timers.reset();
+            if (frame < WARMUP_FRAMES + framesPerStep)
+                return;
+
+            if (clusteredStep)
+            {
+                clusteredMilliseconds = timers.averageMilliseconds("lighting");
+                buildMilliseconds = clusters.buildMilliseconds;
+                lightsPerCluster = (double)clusters.lightIndices / (CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES);
+                if (lightCount <= forwardMaxLights)
+                {
+                    startStep(false, positions, colors);
+                    return;
+                }
+            }
+            std::cout << std::fixed << std::setprecision(3) << "light benchmark: " << lightCount << " lights | clustered: " << clusteredMilliseconds
+                      << " ms (build " << buildMilliseconds << " ms, " << lightsPerCluster << " lights per cluster) | forward: ";
+            if (clusteredStep)
+                std::cout << "skipped";
+            else
+                std::cout << timers.averageMilliseconds("lighting") << " ms";
+            std::cout << std::defaultfloat << std::endl;
+
+            if (lightCount >= runMaxLights)
+            {
+                positions = savedPositions;
+                colors = savedColors;
+                active = false;
+                clusteredStep = true;
+                std::cout << "light benchmark: done" << std::endl;
+                return;
+            }
+            lightCount = std::min(lightCount * 2, runMaxLights);
+            startStep(true, positions, colors);
+        }
+
+    private:
+        GpuTimers& timers; // the frame measures its lighting pass as "lighting"
+        unsigned int minLights;
+        unsigned int maxLights;
+        unsigned int framesPerStep;
+        unsigned int forwardMaxLights;
+        float intensity;
+
+        std::vector<glm::vec3> savedPositions;
+        std::vector<glm::vec3> savedColors;
+        unsigned int runMaxLights = 0; // maxLights, clamped to the capacity of the light buffer
+        unsigned int lightCount = 0;
+        bool clusteredStep = true;
+        unsigned int frame = 0;
+        double clusteredMilliseconds = 0.0;
+        double buildMilliseconds = 0.0;
+        double lightsPerCluster = 0.0;
+
+        void startStep(bool clusteredShading, std::vector<glm::vec3>& positions, std::vector<glm::vec3>& colors)
+        {
+            clusteredStep = clusteredShading;
+            frame = 0;
+            // same lights for both modes of a step
+            std::mt19937 random(lightCount);
+            std::uniform_real_distribution<float> across(-2.5f, 2.5f);
+            std::uniform_real_distribution<float> along(-42.0f, 12.0f);
+            std::uniform_real_distribution<float> channel(0.0f, 1.0f);
+            positions.resize(lightCount);
+            colors.resize(lightCount);
+            for (unsigned int i = 0; i < lightCount; i++)
+            {
+                positions[i] = glm::vec3(across(random), across(random), along(random));
+                glm::vec3 color(channel(random), channel(random), channel(random));
+                colors[i] = color * (intensity / std::max(0.001f, std::max(color.r, std::max(color.g, color.b))));
+            }
+        }
+};
+#endif
@@ -0,0 +1,326 @@
+#ifndef LIGHT_SET_H
+#define LIGHT_SET_H
+
+#include <glm/glm.hpp>
+#include <nlohmann/json.hpp>
+
+#include <thread_pool.h>
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define LIGHT_SET_SSE 1
+#endif
+
+// Lights of a scene with their animations, stored as structure of arrays: every animation kind keeps its own
+// arrays (parameters of the lights it animates, contiguous), so a frame update is a few tight SIMD loops.
+// The animated values are written to positions / colors, which is what culling and upload read.
+// Animations:
+// - flicker : color scaled by 1 + amplitude * noise, noise being a sum of three sines (in [-1, 1])
+// - orbit : position rotating around an axis through center, speed in radians per second
+// - keyframes : position interpolated linearly between keys, looping
+class LightSet
+{
+    public:
+        std::vector<glm::vec3> positions; // current positions
+        std::vector<glm::vec3> colors; // current colors
+
+        size_t size() const
+        {
+            return positions.size();
+        }
+
+        bool animated() const
+        {
+            return !flicker.index.empty() || !orbit.index.empty() || !keyframes.empty();
+        }
+
+        uint32_t addLight(const glm::vec3& position, const glm::vec3& color)
+        {
+            positions.push_back(position);
+            colors.push_back(color);
+            baseColors.push_back(color);
+            return (uint32_t)(positions.size() - 1);
+        }
+
+        void addFlicker(uint32_t light, float amplitude, float frequency, float phase)
+        {
+            flicker.index.push_back(light);
+            flicker.amplitude.push_back(amplitude);
+            flicker.frequency.push_back(2.0f * PI * frequency);
+            flicker.phase.push_back(phase);
+            for (int c = 0; c < 3; c++)
+                flicker.color[c].push_back(baseColors[light][c]);
+        }
+
+        // the orbit passes through the light position; its radius is the distance of the light from the axis
+        void addOrbit(uint32_t light, const glm::vec3& center, const glm::vec3& axis, float speed, float phase)
+        {
+            glm::vec3 w = glm::normalize(axis);
+            glm::vec3 offset = positions[light] - center;
+            glm::vec3 onAxis = center + w * glm::dot(offset, w);
+            glm::vec3 u = positions[light] - onAxis;
+            glm::vec3 v = glm::cross(w, u);
+            orbit.index.push_back(light);
+            for (int c = 0; c < 3; c++)
+            {
+                orbit.center[c].push_back(onAxis[c]);
+                orbit.u[c].push_back(u[c]);
+                orbit.v[c].push_back(v[c]);
+            }
+            orbit.speed.push_back(speed);
+            orbit.phase.push_back(phase);
+        }
+
+        void addKeyframes(uint32_t light, const std::vector<float>& times, const std::vector<glm::vec3>& keyPositions)
+        {
+            if (times.empty() || times.size() != keyPositions.size())
+                return;
+            keyframes.push_back({ light, times, keyPositions });
+        }
+
+        // evaluates every animation at time (seconds); simd = false uses the scalar reference implementation
+        void update(float time, ThreadPool& pool, bool simd = true)
+        {
+            const size_t chunk = 1024;
+            pool.parallelFor(0, flicker.index.size(), [&](size_t begin, size_t end) {
+                updateFlicker(time, begin, end, simd);
+            }, chunk);
+            pool.parallelFor(0, orbit.index.size(), [&](size_t begin, size_t end) {
+                updateOrbit(time, begin, end, simd);
+            }, chunk);
+            for (Keyframes& track : keyframes)
+                updateKeyframes(track, time);
+        }
+
+    private:
+        static constexpr float PI = 3.14159265358979f;
+
+        std::vector<glm::vec3> baseColors;
+
+        struct Flicker
+        {
+            std::vector<uint32_t> index;
+            std::vector<float> amplitude, frequency, phase; // frequency in radians per second
+            std::vector<float> color[3]; // base color
+        } flicker;
+
+        struct Orbit
+        {
+            std::vector<uint32_t> index;
+            std::vector<float> center[3], u[3], v[3]; // position = center + u * cos(angle) + v * sin(angle)
+            std::vector<float> speed, phase;
+        } orbit;
+
+        struct Keyframes
+        {
+            uint32_t light;
+            std::vector<float> times;
+            std::vector<glm::vec3> positions;
+        };
+        std::vector<Keyframes> keyframes;
+
+        static float noise(float angle, float phase)
+        {
+            return 0.5f * std::sin(angle + phase) + 0.3f * std::sin(2.3f * angle + 1.7f * phase) + 0.2f * std::sin(5.1f * angle + 0.6f * phase);
+        }
+
+#ifdef LIGHT_SET_SSE
+        // sine of 4 angles: reduction to [-pi, pi], folding to [-pi/2, pi/2] and a degree 9 polynomial (error < 4e-6)
+        static __m128 sin4(__m128 x)
+        {
+            const __m128 twoPi = _mm_set1_ps(2.0f * PI);
+            const __m128 signMask = _mm_set1_ps(-0.0f);
+            __m128 turns = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.0f / (2.0f * PI)))));
+            x = _mm_sub_ps(x, _mm_mul_ps(turns, twoPi));
+            // sin(x) = sin(pi - x) : fold |x| > pi/2 back
+            __m128 sign = _mm_and_ps(x, signMask);
+            __m128 absX = _mm_andnot_ps(signMask, x);
+            __m128 folded = _mm_min_ps(absX, _mm_sub_ps(_mm_set1_ps(PI), absX));
+            x = _mm_or_ps(folded, sign);
+            __m128 x2 = _mm_mul_ps(x, x);
+            __m128 p = _mm_set1_ps(2.7557319e-6f);
+            p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(-1.9841270e-4f));
+            p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(8.3333333e-3f));
+            p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(-1.6666667e-1f));
+            p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(1.0f));
+            return _mm_mul_ps(p, x);
+        }
+#endif
+
+        void updateFlicker(float time, size_t begin, size_t end, bool simd)
+        {
+            size_t i = begin;
+#ifdef LIGHT_SET_SSE
+            if (simd)
+            {
+                const __m128 t = _mm_set1_ps(time);
+                const __m128 zero = _mm_setzero_ps();
+                const __m128 one = _mm_set1_ps(1.0f);
+                for (; i + 4 <= end; i += 4)
+                {
+                    __m128 angle = _mm_mul_ps(_mm_loadu_ps(&flicker.frequency[i]), t);
+                    __m128 phase = _mm_loadu_ps(&flicker.phase[i]);
+                    __m128 n = _mm_mul_ps(_mm_set1_ps(0.5f), sin4(_mm_add_ps(angle, phase)));
+                    n = _mm_add_ps(n, _mm_mul_ps(_mm_set1_ps(0.3f), sin4(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.3f), angle), _mm_mul_ps(_mm_set1_ps(1.7f), phase)))));
+                    n = _mm_add_ps(n, _mm_mul_ps(_mm_set1_ps(0.2f), sin4(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(5.1f), angle), _mm_mul_ps(_mm_set1_ps(0.6f), phase)))));
+                    __m128 scale = _mm_max_ps(zero, _mm_add_ps(one, _mm_mul_ps(_mm_loadu_ps(&flicker.amplitude[i]), n)));
+                    alignas(16) float r[4], g[4], b[4];
+                    _mm_store_ps(r, _mm_mul_ps(_mm_loadu_ps(&flicker.color[0][i]), scale));
+                    _mm_store_ps(g, _mm_mul_ps(_mm_loadu_ps(&flicker.color[1][i]), scale));
+                    _mm_store_ps(b, _mm_mul_ps(_mm_loadu_ps(&flicker.color[2][i]), scale));
+                    for (int lane = 0; lane < 4; lane++)
+                        colors[flicker.index[i + lane]] = glm::vec3(r[lane], g[lane], b[lane]);
+                }
+            }
+#endif
+            for (; i < end; i++)
+            {
+                float scale = std::max(0.0f, 1.0f + flicker.amplitude[i] * noise(flicker.frequency[i] * time, flicker.phase[i]));
+                colors[flicker.index[i]] = glm::vec3(flicker.color[0][i], flicker.color[1][i], flicker.color[2][i]) * scale;
+            }
+        }
+
+        void updateOrbit(float time, size_t begin, size_t end, bool simd)
+        {
+            size_t i = begin;
+#ifdef LIGHT_SET_SSE
+            if (simd)
+            {
+                const __m128 t = _mm_set1_ps(time);
+                const __m128 quarterTurn = _mm_set1_ps(0.5f * PI);
+                for (; i + 4 <= end; i += 4)
+                {
+                    __m128 angle = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&orbit.speed[i]), t), _mm_loadu_ps(&orbit.phase[i]));
+                    __m128 s = sin4(angle);
+                    __m128 c = sin4(_mm_add_ps(angle, quarterTurn));
+                    alignas(16) float p[3][4];
+                    for (int axis = 0; axis < 3; axis++)
+                    {
+                        __m128 value = _mm_add_ps(_mm_loadu_ps(&orbit.center[axis][i]), _mm_mul_ps(_mm_loadu_ps(&orbit.u[axis][i]), c));
+                        _mm_store_ps(p[axis], _mm_add_ps(value, _mm_mul_ps(_mm_loadu_ps(&orbit.v[axis][i]), s)));
+                    }
+                    for (int lane = 0; lane < 4; lane++)
+                        positions[orbit.index[i + lane]] = glm::vec3(p[0][lane], p[1][lane], p[2][lane]);
+                }
+            }
+#endif
+            for (; i < end; i++)
+            {
+                float angle = orbit.speed[i] * time + orbit.phase[i];
+                float c = std::cos(angle);
+                float s = std::sin(angle);
+                glm::vec3 position;
+                for (int axis = 0; axis < 3; axis++)
+                    position[axis] = orbit.center[axis][i] + orbit.u[axis][i] * c + orbit.v[axis][i] * s;
+                positions[orbit.index[i]] = position;
+            }
+        }
+
+        void updateKeyframes(const Keyframes& track, float time)
+        {
+            float duration = track.times.back();
+            float t = duration > 0.0f ? std::fmod(time, duration) : 0.0f;
+            size_t key = std::upper_bound(track.times.begin(), track.times.end(), t) - track.times.begin();
+            if (key == 0)
+                positions[track.light] = track.positions.front();
+            else if (key >= track.times.size())
+                positions[track.light] = track.positions.back();
+            else
+            {
+                float span = track.times[key] - track.times[key - 1];
+                float f = span > 0.0f ? (t - track.times[key - 1]) / span : 0.0f;
+                positions[track.light] = glm::mix(track.positions[key - 1], track.positions[key], f);
+            }
+        }
+};
+
+// Reads the lights of a scene file: an array of objects with "position", "color" and optionally "animation"
+// ({"type": "flicker", "amplitude", "frequency", "phase"}, {"type": "orbit", "center", "axis", "speed", "phase"}
+// or {"type": "keyframes", "times", "positions"}); static lights come first, so animated ones are contiguous
+// ------------------------------------------------------------------------------------------------------
+inline LightSet loadLightSet(const nlohmann::json& lights)
+{
+    auto vec3 = [](const nlohmann::json& value) { return glm::vec3(value[0], value[1], value[2]); };
+    LightSet set;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (const nlohmann::json& light : lights)
+        {
+            bool animated = light.contains("animation");
+            if (animated != (pass == 1))
+                continue;
+            uint32_t index = set.addLight(vec3(light["position"]), vec3(light["color"]));
+            if (!animated)
+                continue;
+            const nlohmann::json& animation = light["animation"];
+            std::string type = animation["type"];
+            if (type == "flicker")
+                set.addFlicker(index, animation.value("amplitude", 0.3f), animation.value("frequency", 4.0f), animation.value("phase", 0.0f));
+            else if (type == "orbit")
+                set.addOrbit(index, vec3(animation["center"]), vec3(animation["axis"]), animation.value("speed", 1.0f), animation.value("phase", 0.0f));
+            else if (type == "keyframes")
+            {
+                std::vector<float> times = animation["times"];
+                std::vector<glm::vec3> keyPositions;
+                for (const nlohmann::json& position : animation["positions"])
+                    keyPositions.push_back(vec3(position));
+                set.addKeyframes(index, times, keyPositions);
+            }
+            else
+                std::cout << "unknown light animation: " << type << std::endl;
+        }
+    }
+    return set;
+}
+
+// Stress test of the animation update: count lights inside the tunnel, half flickering and half orbiting,
+// updated frames times with the SIMD and with the scalar implementation (average time and largest difference printed)
+// ------------------------------------------------------------------------------------------------------
+inline void benchmarkLightAnimation(unsigned int count, unsigned int frames, ThreadPool& pool)
+{
+    LightSet simdSet;
+    std::mt19937 random(count);
+    std::uniform_real_distribution<float> across(-2.5f, 2.5f);
+    std::uniform_real_distribution<float> along(-42.0f, 12.0f);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        uint32_t light = simdSet.addLight(glm::vec3(across(random), across(random), along(random)), glm::vec3(unit(random), unit(random), unit(random)));
+        if (i % 2 == 0)
+            simdSet.addFlicker(light, 0.5f * unit(random), 1.0f + 8.0f * unit(random), 6.28f * unit(random));
+        else
+            simdSet.addOrbit(light, glm::vec3(0.0f, 0.0f, simdSet.positions[light].z), glm::vec3(0.0f, 0.0f, 1.0f), 2.0f * unit(random) - 1.0f, 6.28f * unit(random));
+    }
+    LightSet scalarSet = simdSet;
+
+    double milliseconds[2] = { 0.0, 0.0 };
+    float maxDifference = 0.0f;
+    for (unsigned int frame = 0; frame < frames; frame++)
+    {
+        float time = frame / 60.0f;
+        for (int simd = 1; simd >= 0; simd--)
+        {
+            auto start = std::chrono::steady_clock::now();
+            (simd ? simdSet : scalarSet).update(time, pool, simd == 1);
+            milliseconds[simd] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+        for (unsigned int i = 0; i < count; i++)
+        {
+            maxDifference = std::max(maxDifference, glm::length(simdSet.positions[i] - scalarSet.positions[i]));
+            maxDifference = std::max(maxDifference, glm::length(simdSet.colors[i] - scalarSet.colors[i]));
+        }
+    }
+    std::cout << std::fixed << std::setprecision(3) << "light animation benchmark: " << count << " lights, " << pool.size() << " threads | simd: "
+              << milliseconds[1] / frames << " ms | scalar: " << milliseconds[0] / frames << " ms | max difference: "
+              << std::scientific << maxDifference << std::defaultfloat << std::endl;
+}
+#endif
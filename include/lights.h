@@ -0,0 +1,227 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <gl_ext.h>
+#include <shader.h>
+#include <bounds.h>
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// binding point of the light block (uniform buffer or shader storage buffer)
+const unsigned int LIGHTS_BINDING = 0;
+
+// default radiance under which a light is considered to have no effect (gives every light a finite influence radius)
+const float LIGHT_CUTOFF_RADIANCE = 0.01f;
+
+// One light as laid out in the light block (std140 and std430 agree on two vec4)
+struct GPULight
+{
+    glm::vec4 position; // xyz: world position, w: influence radius
+    glm::vec4 color;    // rgb: radiance
+};
+
+// distance at which the inverse-square falloff of a light drops under the cutoff radiance
+// (the shaders fade the falloff to zero at this distance)
+// ------------------------------------------------------------------------
+inline float lightRadius(const glm::vec3& color, float cutoff = LIGHT_CUTOFF_RADIANCE)
+{
+    float intensity = std::max(color.r, std::max(color.g, color.b));
+    return std::sqrt(std::max(intensity, 0.0f) / cutoff);
+}
+
+// CPU light culling: keeps the lights whose influence sphere is inside the view frustum and touches the bounds
+// of at least one visible draw. visible receives the indices of the surviving lights
+// ------------------------------------------------------------------------
+inline void cullLights(const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& colors, float cutoff,
+    const Frustum& frustum, const std::vector<BoundingBox>& drawBounds, std::vector<uint32_t>& visible)
+{
+    visible.clear();
+    size_t n = std::min(positions.size(), colors.size());
+    for (size_t i = 0; i < n; i++)
+    {
+        float radius = lightRadius(colors[i], cutoff);
+        if (!frustum.intersectsSphere(positions[i], radius))
+            continue;
+        for (const BoundingBox& bounds : drawBounds)
+        {
+            if (bounds.intersectsSphere(positions[i], radius) && frustum.intersectsBox(bounds))
+            {
+                visible.push_back((uint32_t)i);
+                break;
+            }
+        }
+    }
+}
+
+// Lights of the scene stored in a GPU buffer: a shader storage buffer with OpenGL 4.3 (unbounded number of lights),
+// otherwise a std140 uniform buffer sized by GL_MAX_UNIFORM_BLOCK_SIZE. The buffer is rewritten only when the
+// lights differ from the last upload, so a static scene costs no upload at all.
+class LightBuffer
+{
+    public:
+        GLuint buffer = 0;
+        bool storageBuffer = false;
+        unsigned int capacity = 0; // lights the shaders can address (MAX_LIGHTS of the uniform block)
+        unsigned int count = 0; // lights currently in the buffer
+        float cutoff = LIGHT_CUTOFF_RADIANCE; // radiance that defines the influence radius of the lights
+        unsigned long long uploads = 0;
+        unsigned long long uploadedBytes = 0; // bytes sent to the buffer since creation
+
+        LightBuffer()
+        {
+            storageBuffer = glExt.shaderStorageBuffers;
+            GLint maxBlockSize = 0;
+            glGetIntegerv(storageBuffer ? GL_MAX_SHADER_STORAGE_BLOCK_SIZE : GL_MAX_UNIFORM_BLOCK_SIZE, &maxBlockSize);
+            capacity = (unsigned int)std::max(maxBlockSize, 0) / sizeof(GPULight);
+            // a uniform block array has a fixed size, compiled into the shaders
+            if (!storageBuffer)
+                capacity = std::min(capacity, 4096u);
+
+            glGenBuffers(1, &buffer);
+            glBindBuffer(target(), buffer);
+            glBufferData(target(), sizeof(GPULight), nullptr, GL_DYNAMIC_DRAW);
+            allocated = 1;
+            glBindBuffer(target(), 0);
+            glBindBufferBase(target(), LIGHTS_BINDING, buffer);
+        }
+
+        ~LightBuffer()
+        {
+            glDeleteBuffers(1, &buffer);
+        }
+
+        // defines to pass as preamble to the shaders that read the lights
+        std::string shaderPreamble() const
+        {
+            if (storageBuffer)
+                return "#extension GL_ARB_shader_storage_buffer_object : require\n#define LIGHTS_STORAGE_BUFFER";
+            return "#define MAX_LIGHTS " + std::to_string(capacity);
+        }
+
+        // connects the light block of a shader to the buffer
+        void attach(Shader& shader) const
+        {
+            if (storageBuffer)
+            {
+                GLuint index = glExt.GetProgramResourceIndex(shader.ID, GL_SHADER_STORAGE_BLOCK, "LightBlock");
+                if (index != GL_INVALID_INDEX)
+                    glExt.ShaderStorageBlockBinding(shader.ID, index, LIGHTS_BINDING);
+            }
+            else
+            {
+                GLuint index = glGetUniformBlockIndex(shader.ID, "LightBlock");
+                if (index != GL_INVALID_INDEX)
+                    glUniformBlockBinding(shader.ID, index, LIGHTS_BINDING);
+            }
+        }
+
+        // packs the lights and uploads them if they changed; returns true when an upload happened
+        bool update(const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& colors)
+        {
+            size_t n = std::min(positions.size(), colors.size());
+            return pack(n, positions, colors, [](size_t i) { return i; });
+        }
+
+        // same as update, only for the lights listed in visible (e.g. the output of cullLights)
+        bool update(const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& colors, const std::vector<uint32_t>& visible)
+        {
+            return pack(visible.size(), positions, colors, [&visible](size_t i) { return (size_t)visible[i]; });
+        }
+
+        // lights as they are in the buffer
+        const std::vector<GPULight>& lights() const
+        {
+            return uploaded;
+        }
+
+    private:
+        std::vector<GPULight> packed;
+        std::vector<GPULight> uploaded;
+        size_t allocated = 0;
+        bool truncationReported = false; // the warning is printed once, when the lights start exceeding the capacity
+
+        template <typename Index>
+        bool pack(size_t n, const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& colors, Index index)
+        {
+            if (n > capacity)
+            {
+                if (!truncationReported)
+                    std::cout << "too many lights (" << n << "), only the first " << capacity << " are used" << std::endl;
+                truncationReported = true;
+                n = capacity;
+            }
+            else
+                truncationReported = false;
+            packed.resize(n);
+            for (size_t i = 0; i < n; i++)
+            {
+                size_t light = index(i);
+                packed[i].position = glm::vec4(positions[light], lightRadius(colors[light], cutoff));
+                packed[i].color = glm::vec4(colors[light], 1.0f);
+            }
+            return upload();
+        }
+
+        // uploads the packed lights that differ from the uploaded ones: unchanged lights are skipped, changed ones are
+        // sent as ranges (ranges separated by less than DIRTY_RANGE_GAP unchanged lights are merged)
+        bool upload()
+        {
+            const size_t DIRTY_RANGE_GAP = 16;
+            if (uploads > 0 && packed.size() == uploaded.size() &&
+                (packed.empty() || std::memcmp(packed.data(), uploaded.data(), packed.size() * sizeof(GPULight)) == 0))
+                return false;
+
+            glBindBuffer(target(), buffer);
+            // a uniform block is always backed by capacity lights, a storage block by at least the used ones
+            size_t needed = storageBuffer ? std::max<size_t>(packed.size(), 1) : capacity;
+            bool reallocated = needed > allocated;
+            if (reallocated)
+            {
+                allocated = storageBuffer ? std::max(needed, allocated * 2) : needed;
+                glBufferData(target(), allocated * sizeof(GPULight), nullptr, GL_DYNAMIC_DRAW);
+                glBindBufferBase(target(), LIGHTS_BINDING, buffer);
+            }
+            size_t comparable = reallocated ? 0 : std::min(packed.size(), uploaded.size());
+            size_t i = 0;
+            while (i < packed.size())
+            {
+                if (i < comparable && std::memcmp(&packed[i], &uploaded[i], sizeof(GPULight)) == 0)
+                {
+                    i++;
+                    continue;
+                }
+                size_t begin = i;
+                size_t end = ++i;
+                while (i < packed.size() && i - end < DIRTY_RANGE_GAP)
+                {
+                    if (i >= comparable || std::memcmp(&packed[i], &uploaded[i], sizeof(GPULight)) != 0)
+                        end = i + 1;
+                    i++;
+                }
+                glBufferSubData(target(), begin * sizeof(GPULight), (end - begin) * sizeof(GPULight), &packed[begin]);
+                uploadedBytes += (end - begin) * sizeof(GPULight);
+                i = end;
+            }
+            glBindBuffer(target(), 0);
+
+            uploaded = packed;
+            count = (unsigned int)packed.size();
+            uploads++;
+            return true;
+        }
+
+        GLenum target() const
+        {
+            return storageBuffer ? GL_SHADER_STORAGE_BUFFER : GL_UNIFORM_BUFFER;
+        }
+};
+#endif
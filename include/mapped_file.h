@@ -0,0 +1,119 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <cstddef>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Read-only memory mapping of a whole file: the pages come straight from the OS page cache, nothing is copied
+// until they are read (e.g. by glBufferData). The mapping lives as long as the object.
+class MappedFile
+{
+    public:
+        MappedFile() {}
+        explicit MappedFile(const std::string& path)
+        {
+            open(path);
+        }
+        ~MappedFile()
+        {
+            close();
+        }
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool open(const std::string& path)
+        {
+            close();
+#ifdef _WIN32
+            file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+            if (file == INVALID_HANDLE_VALUE)
+                return false;
+            LARGE_INTEGER fileSize;
+            if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+            {
+                close();
+                return false;
+            }
+            mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mapping)
+                bytes = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            if (!bytes)
+            {
+                close();
+                return false;
+            }
+            length = (size_t)fileSize.QuadPart;
+#else
+            int descriptor = ::open(path.c_str(), O_RDONLY);
+            if (descriptor < 0)
+                return false;
+            struct stat status;
+            if (fstat(descriptor, &status) != 0 || status.st_size == 0)
+            {
+                ::close(descriptor);
+                return false;
+            }
+            void* address = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            ::close(descriptor); // the mapping keeps the file alive
+            if (address == MAP_FAILED)
+                return false;
+            madvise(address, (size_t)status.st_size, MADV_SEQUENTIAL); // read once from start to end
+            bytes = address;
+            length = (size_t)status.st_size;
+#endif
+            return true;
+        }
+
+        void close()
+        {
+#ifdef _WIN32
+            if (bytes)
+                UnmapViewOfFile(bytes);
+            if (mapping)
+                CloseHandle(mapping);
+            if (file != INVALID_HANDLE_VALUE)
+                CloseHandle(file);
+            mapping = NULL;
+            file = INVALID_HANDLE_VALUE;
+#else
+            if (bytes)
+                munmap(bytes, length);
+#endif
+            bytes = nullptr;
+            length = 0;
+        }
+
+        bool isOpen() const
+        {
+            return bytes != nullptr;
+        }
+        const unsigned char* data() const
+        {
+            return (const unsigned char*)bytes;
+        }
+        size_t size() const
+        {
+            return length;
+        }
+
+    private:
+        void* bytes = nullptr;
+        size_t length = 0;
+#ifdef _WIN32
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = NULL;
+#endif
+};
+#endif
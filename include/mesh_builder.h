@@ -0,0 +1,386 @@
+#ifndef MESH_BUILDER_H
+#define MESH_BUILDER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <gl_ext.h>
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <iomanip>
+
+// Indexed mesh builder: triangle soups (every triangle with its own 3 vertices) are welded into unique vertices
+// plus an index buffer, then triangles are reordered for the post-transform vertex cache (Forsyth, "Linear-speed
+// vertex cache optimisation") and, when it doesn't cost cache efficiency, for overdraw (clusters sorted to draw
+// the outer, occluding ones first, as in Sander et al. "Fast triangle reordering for vertex locality and reduced
+// overdraw"). Vertices are finally renumbered in first use order for the pre-transform (fetch) cache.
+
+const unsigned int FORSYTH_CACHE_SIZE = 32; // LRU cache of the scoring model
+const unsigned int POST_TRANSFORM_CACHE_SIZE = 16; // FIFO cache simulated for the statistics and the overdraw clusters
+const float OVERDRAW_THRESHOLD = 1.05f; // max ACMR growth accepted by the overdraw reordering
+
+struct IndexedMesh
+{
+    std::vector<float> vertices; // interleaved, vertexFloats floats per vertex (position first)
+    unsigned int vertexFloats = 0;
+    std::vector<uint32_t> indices; // triangle list
+
+    size_t vertexCount() const
+    {
+        return vertexFloats ? vertices.size() / vertexFloats : 0;
+    }
+
+    // 16-bit indices whenever every vertex can be addressed
+    GLenum indexType() const
+    {
+        return vertexCount() <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    }
+
+    // fills the buffer bound to GL_ELEMENT_ARRAY_BUFFER with the indices (in the index type)
+    void bufferIndices() const
+    {
+        if (indexType() == GL_UNSIGNED_INT)
+        {
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
+            return;
+        }
+        std::vector<uint16_t> shortIndices(indices.begin(), indices.end());
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(uint16_t), shortIndices.data(), GL_STATIC_DRAW);
+    }
+};
+
+// average cache miss ratio (transformed vertices per triangle) of the indices with a FIFO post-transform cache:
+// 3 for a triangle soup, 0.5 is the ideal of a large regular grid
+// ------------------------------------------------------------------------
+inline float averageCacheMissRatio(const std::vector<uint32_t>& indices, size_t vertexCount, unsigned int cacheSize = POST_TRANSFORM_CACHE_SIZE)
+{
+    if (indices.empty())
+        return 0.0f;
+    std::vector<unsigned int> cachedAt(vertexCount, 0); // insertion stamp + 1, 0 = never cached
+    unsigned int stamp = 0;
+    unsigned int misses = 0;
+    for (uint32_t index : indices)
+        if (cachedAt[index] == 0 || stamp - (cachedAt[index] - 1) >= cacheSize)
+        {
+            cachedAt[index] = ++stamp;
+            misses++;
+        }
+    return (float)misses / (indices.size() / 3);
+}
+
+// merges the vertices of the soup that are bitwise equal
+// ------------------------------------------------------------------------
+inline IndexedMesh weldVertices(const float* soup, size_t floatCount, unsigned int vertexFloats)
+{
+    IndexedMesh mesh;
+    mesh.vertexFloats = vertexFloats;
+    std::unordered_map<std::string, uint32_t> unique;
+    size_t soupVertices = floatCount / vertexFloats;
+    mesh.indices.reserve(soupVertices);
+    for (size_t i = 0; i < soupVertices; i++)
+    {
+        const float* vertex = soup + i * vertexFloats;
+        std::string key((const char*)vertex, vertexFloats * sizeof(float));
+        auto found = unique.find(key);
+        if (found != unique.end())
+        {
+            mesh.indices.push_back(found->second);
+            continue;
+        }
+        uint32_t index = (uint32_t)mesh.vertexCount();
+        unique.emplace(key, index);
+        mesh.vertices.insert(mesh.vertices.end(), vertex, vertex + vertexFloats);
+        mesh.indices.push_back(index);
+    }
+    return mesh;
+}
+
+// Forsyth's vertex score: vertices just used (and in the cache) score high, and so do the ones with few triangles
+// left, so that the remaining isolated triangles are not left behind
+// ------------------------------------------------------------------------
+inline float forsythVertexScore(int cachePosition, unsigned int remainingTriangles)
+{
+    if (remainingTriangles == 0)
+        return -1.0f;
+    float score = 0.0f;
+    if (cachePosition >= 0)
+    {
+        if (cachePosition < 3)
+            score = 0.75f; // the last triangle's vertices: fixed score, so that strips don't just bounce back and forth
+        else
+            score = std::pow(1.0f - (float)(cachePosition - 3) / (FORSYTH_CACHE_SIZE - 3), 1.5f);
+    }
+    return score + 2.0f / std::sqrt((float)remainingTriangles);
+}
+
+// reorders the triangles for the post-transform vertex cache
+// ------------------------------------------------------------------------
+inline void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount)
+{
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    // triangles of every vertex (the first `remaining` entries are the ones not emitted yet)
+    std::vector<unsigned int> remaining(vertexCount, 0);
+    for (uint32_t index : indices)
+        remaining[index]++;
+    std::vector<size_t> firstTriangle(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++)
+        firstTriangle[v + 1] = firstTriangle[v] + remaining[v];
+    std::vector<uint32_t> vertexTriangles(indices.size());
+    std::vector<size_t> filled(firstTriangle.begin(), firstTriangle.end() - 1);
+    for (size_t t = 0; t < triangleCount; t++)
+        for (int k = 0; k < 3; k++)
+            vertexTriangles[filled[indices[t * 3 + k]]++] = (uint32_t)t;
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> vertexScore(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+        vertexScore[v] = forsythVertexScore(-1, remaining[v]);
+    std::vector<float> triangleScore(triangleCount);
+    for (size_t t = 0; t < triangleCount; t++)
+        triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+    std::vector<bool> emitted(triangleCount, false);
+
+    std::vector<uint32_t> cache, nextCache;
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+    size_t bestTriangle = 0;
+    for (size_t t = 1; t < triangleCount; t++)
+        if (triangleScore[t] > triangleScore[bestTriangle])
+            bestTriangle = t;
+    size_t scanFrom = 0; // triangles before this one are all emitted
+
+    while (output.size() < indices.size())
+    {
+        // emit the best triangle and take it out of the lists of its vertices
+        emitted[bestTriangle] = true;
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t v = indices[bestTriangle * 3 + k];
+            output.push_back(v);
+            uint32_t* begin = &vertexTriangles[firstTriangle[v]];
+            uint32_t* end = begin + remaining[v];
+            *std::find(begin, end, (uint32_t)bestTriangle) = *(end - 1);
+            remaining[v]--;
+        }
+
+        // LRU cache: the triangle's vertices move to the front, the overflow is evicted
+        nextCache.assign(indices.begin() + bestTriangle * 3, indices.begin() + bestTriangle * 3 + 3);
+        for (uint32_t v : cache)
+            if (v != nextCache[0] && v != nextCache[1] && v != nextCache[2])
+                nextCache.push_back(v);
+        for (size_t i = FORSYTH_CACHE_SIZE; i < nextCache.size(); i++)
+        {
+            cachePosition[nextCache[i]] = -1;
+            vertexScore[nextCache[i]] = forsythVertexScore(-1, remaining[nextCache[i]]);
+        }
+        nextCache.resize(std::min<size_t>(nextCache.size(), FORSYTH_CACHE_SIZE));
+        cache.swap(nextCache);
+        for (size_t i = 0; i < cache.size(); i++)
+        {
+            cachePosition[cache[i]] = (int)i;
+            vertexScore[cache[i]] = forsythVertexScore((int)i, remaining[cache[i]]);
+        }
+
+        // rescore the triangles touching the cache and pick the best one among them
+        float bestScore = -1.0f;
+        for (uint32_t v : cache)
+            for (size_t i = firstTriangle[v]; i < firstTriangle[v] + remaining[v]; i++)
+            {
+                uint32_t t = vertexTriangles[i];
+                triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+                if (triangleScore[t] > bestScore)
+                {
+                    bestScore = triangleScore[t];
+                    bestTriangle = t;
+                }
+            }
+        if (bestScore < 0.0f)
+        {
+            // nothing left around the cache: restart from the first triangle not emitted
+            while (scanFrom < triangleCount && emitted[scanFrom])
+                scanFrom++;
+            bestTriangle = scanFrom;
+        }
+    }
+    indices.swap(output);
+}
+
+// reorders clusters of triangles so that the ones facing outwards, which occlude the others, are drawn first;
+// clusters break where the cache restarts (a triangle with 3 misses), so the cache efficiency is mostly kept
+// and the order is discarded if the ACMR grows more than threshold times
+// ------------------------------------------------------------------------
+inline void optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<float>& vertices, unsigned int vertexFloats, float threshold = OVERDRAW_THRESHOLD)
+{
+    size_t triangleCount = indices.size() / 3;
+    size_t vertexCount = vertices.size() / vertexFloats;
+    if (triangleCount < 2)
+        return;
+    auto position = [&](uint32_t index) { return glm::vec3(vertices[index * vertexFloats], vertices[index * vertexFloats + 1], vertices[index * vertexFloats + 2]); };
+
+    // cluster boundaries
+    std::vector<size_t> clusterStart;
+    std::vector<unsigned int> cachedAt(vertexCount, 0);
+    unsigned int stamp = 0;
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        int misses = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t index = indices[t * 3 + k];
+            if (cachedAt[index] == 0 || stamp - (cachedAt[index] - 1) >= POST_TRANSFORM_CACHE_SIZE)
+            {
+                cachedAt[index] = ++stamp;
+                misses++;
+            }
+        }
+        if (t == 0 || misses == 3)
+            clusterStart.push_back(t);
+    }
+    if (clusterStart.size() < 2)
+        return;
+    clusterStart.push_back(triangleCount);
+
+    // mesh centroid and, per cluster, area weighted centroid and normal
+    glm::vec3 meshCentroid(0.0f);
+    for (size_t v = 0; v < vertexCount; v++)
+        meshCentroid += position((uint32_t)v);
+    meshCentroid /= (float)vertexCount;
+    size_t clusterCount = clusterStart.size() - 1;
+    std::vector<float> sortKey(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++)
+    {
+        glm::vec3 centroid(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = clusterStart[c]; t < clusterStart[c + 1]; t++)
+        {
+            glm::vec3 a = position(indices[t * 3]), b = position(indices[t * 3 + 1]), c3 = position(indices[t * 3 + 2]);
+            glm::vec3 cross = glm::cross(b - a, c3 - a);
+            float triangleArea = glm::length(cross);
+            centroid += (a + b + c3) * (triangleArea / 3.0f);
+            normal += cross;
+            area += triangleArea;
+        }
+        centroid = area > 0.0f ? centroid / area : centroid;
+        float length = glm::length(normal);
+        sortKey[c] = length > 0.0f ? glm::dot(centroid - meshCentroid, normal / length) : 0.0f;
+    }
+    std::vector<size_t> order(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++)
+        order[c] = c;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sortKey[a] > sortKey[b]; });
+
+    std::vector<uint32_t> sorted;
+    sorted.reserve(indices.size());
+    for (size_t c : order)
+        sorted.insert(sorted.end(), indices.begin() + clusterStart[c] * 3, indices.begin() + clusterStart[c + 1] * 3);
+    if (averageCacheMissRatio(sorted, vertexCount) <= averageCacheMissRatio(indices, vertexCount) * threshold)
+        indices.swap(sorted);
+}
+
+// renumbers the vertices in the order the indices first use them
+// ------------------------------------------------------------------------
+inline void optimizeVertexFetch(IndexedMesh& mesh)
+{
+    const uint32_t unused = 0xFFFFFFFFu;
+    std::vector<uint32_t> remap(mesh.vertexCount(), unused);
+    std::vector<float> vertices;
+    vertices.reserve(mesh.vertices.size());
+    uint32_t next = 0;
+    for (uint32_t& index : mesh.indices)
+    {
+        if (remap[index] == unused)
+        {
+            remap[index] = next++;
+            vertices.insert(vertices.end(), mesh.vertices.begin() + index * mesh.vertexFloats, mesh.vertices.begin() + (index + 1) * mesh.vertexFloats);
+        }
+        index = remap[index];
+    }
+    mesh.vertices.swap(vertices);
+}
+
+// reorders an indexed mesh: vertex cache, overdraw, vertex fetch
+// ------------------------------------------------------------------------
+inline void optimizeIndexedMesh(IndexedMesh& mesh)
+{
+    optimizeVertexCache(mesh.indices, mesh.vertexCount());
+    optimizeOverdraw(mesh.indices, mesh.vertices, mesh.vertexFloats);
+    optimizeVertexFetch(mesh);
+}
+
+// full pipeline: weld, then optimize
+// ------------------------------------------------------------------------
+inline IndexedMesh buildIndexedMesh(const float* soup, size_t floatCount, unsigned int vertexFloats)
+{
+    IndexedMesh mesh = weldVertices(soup, floatCount, vertexFloats);
+    optimizeIndexedMesh(mesh);
+    return mesh;
+}
+
+// vertex shader invocations of one draw of the positions (attribute 0) of a soup (indices null) or of an indexed
+// mesh, counted by a pipeline statistics query with the rasterizer disabled (needs a program in use, 0 when the
+// query is not supported); startup only, it waits for the result
+// ------------------------------------------------------------------------
+inline unsigned long long countVertexInvocations(const std::vector<float>& vertices, unsigned int vertexFloats, const IndexedMesh* indexed)
+{
+    if (!glExt.pipelineStatistics)
+        return 0;
+    GLuint vao, vbo, ebo = 0, query;
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, vertexFloats * sizeof(float), (void*)0);
+    if (indexed)
+    {
+        glGenBuffers(1, &ebo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        indexed->bufferIndices();
+    }
+    glGenQueries(1, &query);
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBeginQuery(GL_VERTEX_SHADER_INVOCATIONS, query);
+    if (indexed)
+        glDrawElements(GL_TRIANGLES, (GLsizei)indexed->indices.size(), indexed->indexType(), (void*)0);
+    else
+        glDrawArrays(GL_TRIANGLES, 0, (GLsizei)(vertices.size() / vertexFloats));
+    glEndQuery(GL_VERTEX_SHADER_INVOCATIONS);
+    glDisable(GL_RASTERIZER_DISCARD);
+    GLuint64 invocations = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &invocations);
+    glDeleteQueries(1, &query);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glDeleteBuffers(1, &vbo);
+    if (ebo)
+        glDeleteBuffers(1, &ebo);
+    glDeleteVertexArrays(1, &vao);
+    return invocations;
+}
+
+// prints what indexing did to a mesh; measureInvocations also draws the soup and the indexed mesh with the
+// program in use, counting the vertex shader invocations of both
+// ------------------------------------------------------------------------
+inline void reportIndexedMesh(const std::string& name, const std::vector<float>& soup, const IndexedMesh& mesh, bool measureInvocations)
+{
+    size_t soupVertices = soup.size() / mesh.vertexFloats;
+    std::streamsize precision = std::cout.precision();
+    std::cout << std::fixed << std::setprecision(2) << "mesh " << name << ": " << soupVertices << " -> " << mesh.vertexCount() << " vertices, "
+              << mesh.indices.size() << (mesh.indexType() == GL_UNSIGNED_SHORT ? " 16-bit" : " 32-bit") << " indices | ACMR " << 3.0f << " -> "
+              << averageCacheMissRatio(mesh.indices, mesh.vertexCount());
+    if (measureInvocations && glExt.pipelineStatistics)
+        std::cout << " | vertex shader invocations: " << countVertexInvocations(soup, mesh.vertexFloats, nullptr) << " -> "
+                  << countVertexInvocations(mesh.vertices, mesh.vertexFloats, &mesh);
+    std::cout << std::defaultfloat << std::setprecision(precision) << std::endl;
+}
+#endif
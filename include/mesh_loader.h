@@ -0,0 +1,668 @@
+#ifndef MESH_LOADER_H
+#define MESH_LOADER_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <nlohmann/json.hpp>
+
+#include <primitives.h>
+#include <mesh_builder.h>
+#include <mapped_file.h>
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <fstream>
+#include <filesystem>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <cctype>
+#include <iostream>
+
+// Mesh files (OBJ, glTF 2.0 .gltf/.glb) for the scene. The first load parses the file, indexes and optimizes the
+// mesh (mesh_builder.h) and stores it in a compact binary layout next to the source (<file>.meshcache); the
+// following loads memory map the cache and hand its pages to glBufferData, nothing is parsed.
+//
+// Compact layout, 16 bytes per vertex (32 as floats):
+// - position : 3 x unorm16 in the mesh bounds (+ 16 bits of padding), the shader rescales them
+// - normal : octahedral encoding, 2 x snorm16
+// - texture coordinates : 2 x half float
+
+const char MESH_CACHE_MAGIC[8] = "HDRMESH";
+const uint32_t MESH_CACHE_VERSION = 1;
+const char* const MESH_CACHE_EXTENSION = ".meshcache";
+
+struct CompactVertex
+{
+    uint16_t position[4];
+    int16_t normal[2];
+    uint16_t texCoords[2];
+};
+static_assert(sizeof(CompactVertex) == 16, "CompactVertex must be 16 bytes");
+
+// header of the cache file, followed by the vertices and then by the indices (indexSize bytes each)
+struct MeshCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t indexSize;
+    uint64_t vertexCount;
+    uint64_t indexCount;
+    uint64_t sourceSize; // the cache is stale when the source size or modification time differ
+    int64_t sourceTime;
+    float boundsMin[3];
+    float boundsMax[3];
+};
+static_assert(sizeof(MeshCacheHeader) % 8 == 0, "MeshCacheHeader must keep the vertices aligned");
+
+// A mesh in the compact layout: either a memory mapped cache file or an image built in memory (same bytes)
+class CompactMesh
+{
+    public:
+        bool mapped = false; // true when read from the cache
+
+        const MeshCacheHeader& header() const
+        {
+            return *(const MeshCacheHeader*)bytes();
+        }
+        const unsigned char* vertexData() const
+        {
+            return bytes() + sizeof(MeshCacheHeader);
+        }
+        size_t vertexBytes() const
+        {
+            return header().vertexCount * sizeof(CompactVertex);
+        }
+        const unsigned char* indexData() const
+        {
+            return vertexData() + vertexBytes();
+        }
+        size_t indexBytes() const
+        {
+            return header().indexCount * header().indexSize;
+        }
+        size_t fileBytes() const
+        {
+            return mapped ? file.size() : image.size();
+        }
+        glm::vec3 boundsMin() const
+        {
+            return glm::make_vec3(header().boundsMin);
+        }
+        glm::vec3 boundsMax() const
+        {
+            return glm::make_vec3(header().boundsMax);
+        }
+
+        // compact image of an indexed mesh (vertexFloats = 8: position, normal, texture coordinates)
+        void build(const IndexedMesh& mesh)
+        {
+            mapped = false;
+            file.close();
+            size_t vertexCount = mesh.vertexCount();
+            uint32_t indexSize = mesh.indexType() == GL_UNSIGNED_SHORT ? 2 : 4;
+            image.assign(sizeof(MeshCacheHeader) + vertexCount * sizeof(CompactVertex) + mesh.indices.size() * indexSize, 0);
+
+            MeshCacheHeader header = {};
+            std::memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+            header.version = MESH_CACHE_VERSION;
+            header.indexSize = indexSize;
+            header.vertexCount = vertexCount;
+            header.indexCount = mesh.indices.size();
+            glm::vec3 min(0.0f), max(0.0f);
+            for (size_t v = 0; v < vertexCount; v++)
+            {
+                glm::vec3 position = glm::make_vec3(&mesh.vertices[v * mesh.vertexFloats]);
+                min = v == 0 ? position : glm::min(min, position);
+                max = v == 0 ? position : glm::max(max, position);
+            }
+            std::memcpy(header.boundsMin, glm::value_ptr(min), sizeof(header.boundsMin));
+            std::memcpy(header.boundsMax, glm::value_ptr(max), sizeof(header.boundsMax));
+            std::memcpy(image.data(), &header, sizeof(header));
+
+            glm::vec3 extent = max - min;
+            CompactVertex* vertices = (CompactVertex*)(image.data() + sizeof(MeshCacheHeader));
+            for (size_t v = 0; v < vertexCount; v++)
+            {
+                const float* source = &mesh.vertices[v * mesh.vertexFloats];
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    float unit = extent[axis] > 0.0f ? (source[axis] - min[axis]) / extent[axis] : 0.0f;
+                    vertices[v].position[axis] = (uint16_t)std::lround(glm::clamp(unit, 0.0f, 1.0f) * 65535.0f);
+                }
+                glm::vec2 octahedral = encodeOctahedral(glm::make_vec3(source + 3));
+                vertices[v].normal[0] = (int16_t)std::lround(glm::clamp(octahedral.x, -1.0f, 1.0f) * 32767.0f);
+                vertices[v].normal[1] = (int16_t)std::lround(glm::clamp(octahedral.y, -1.0f, 1.0f) * 32767.0f);
+                vertices[v].texCoords[0] = glm::packHalf1x16(source[6]);
+                vertices[v].texCoords[1] = glm::packHalf1x16(source[7]);
+            }
+            unsigned char* indices = image.data() + sizeof(MeshCacheHeader) + vertexCount * sizeof(CompactVertex);
+            for (size_t i = 0; i < mesh.indices.size(); i++)
+            {
+                if (indexSize == 2)
+                    ((uint16_t*)indices)[i] = (uint16_t)mesh.indices[i];
+                else
+                    ((uint32_t*)indices)[i] = mesh.indices[i];
+            }
+        }
+
+        // stamps the source file into the header and writes the image to the cache path (through a temporary
+        // file, so that a crash never leaves a truncated cache behind)
+        bool write(const std::string& cachePath, uint64_t sourceSize, int64_t sourceTime)
+        {
+            MeshCacheHeader* header = (MeshCacheHeader*)image.data();
+            header->sourceSize = sourceSize;
+            header->sourceTime = sourceTime;
+            std::string temporaryPath = cachePath + ".tmp";
+            bool written;
+            {
+                std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+                written = out.write((const char*)image.data(), image.size()) && out.flush();
+            }
+            std::error_code error;
+            if (written)
+                std::filesystem::rename(temporaryPath, cachePath, error);
+            if (!written || error)
+            {
+                std::filesystem::remove(temporaryPath, error);
+                return false;
+            }
+            return true;
+        }
+
+        // maps the cache, valid only if it matches the source and its sizes are consistent
+        bool map(const std::string& cachePath, uint64_t sourceSize, int64_t sourceTime)
+        {
+            image.clear();
+            mapped = file.open(cachePath);
+            if (!mapped)
+                return false;
+            bool valid = file.size() >= sizeof(MeshCacheHeader);
+            if (valid)
+            {
+                const MeshCacheHeader& cached = header();
+                valid = std::memcmp(cached.magic, MESH_CACHE_MAGIC, sizeof(cached.magic)) == 0 && cached.version == MESH_CACHE_VERSION &&
+                        cached.sourceSize == sourceSize && cached.sourceTime == sourceTime && (cached.indexSize == 2 || cached.indexSize == 4) &&
+                        file.size() == sizeof(MeshCacheHeader) + vertexBytes() + indexBytes();
+            }
+            if (!valid)
+            {
+                file.close();
+                mapped = false;
+            }
+            return mapped;
+        }
+
+    private:
+        MappedFile file;
+        std::vector<unsigned char> image;
+
+        const unsigned char* bytes() const
+        {
+            return mapped ? file.data() : image.data();
+        }
+
+        static glm::vec2 encodeOctahedral(glm::vec3 n)
+        {
+            float length = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+            if (length == 0.0f)
+                return glm::vec2(0.0f);
+            n /= length;
+            glm::vec2 encoded(n.x, n.y);
+            if (n.z < 0.0f)
+            {
+                glm::vec2 sign(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+                encoded = (1.0f - glm::abs(glm::vec2(n.y, n.x))) * sign;
+            }
+            return encoded;
+        }
+};
+
+// OBJ: v / vt / vn / f (polygons are fanned into triangles, negative indices allowed); corners without a normal
+// (or with a zero length one) get the face normal. Vertices are welded on their (position, texcoord, normal) index triple.
+// ------------------------------------------------------------------------
+inline bool loadObj(const std::string& path, IndexedMesh& mesh)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    std::vector<glm::vec3> positions, normals;
+    std::vector<glm::vec2> texCoords;
+    struct Corner
+    {
+        long position, texCoord, normal;
+        bool operator==(const Corner& other) const { return position == other.position && texCoord == other.texCoord && normal == other.normal; }
+    };
+    struct CornerHash
+    {
+        size_t operator()(const Corner& corner) const
+        {
+            return std::hash<long>()(corner.position) ^ (std::hash<long>()(corner.texCoord) * 0x9E3779B97F4A7C15ull) ^ (std::hash<long>()(corner.normal) * 0xC2B2AE3D27D4EB4Full);
+        }
+    };
+    std::vector<Corner> face;
+    std::unordered_map<Corner, uint32_t, CornerHash> welded; // index triple -> vertex (only for corners with a normal)
+    mesh = IndexedMesh();
+    mesh.vertexFloats = PRIMITIVE_VERTEX_FLOATS;
+
+    auto addVertex = [&](const Corner& corner, const glm::vec3& faceNormal) -> uint32_t
+    {
+        bool hasNormal = corner.normal >= 0 && normals[corner.normal] != glm::vec3(0.0f);
+        if (hasNormal)
+        {
+            auto found = welded.find(corner);
+            if (found != welded.end())
+                return found->second;
+        }
+        glm::vec3 position = positions[corner.position];
+        glm::vec3 normal = hasNormal ? normals[corner.normal] : faceNormal;
+        glm::vec2 texCoord = corner.texCoord >= 0 ? texCoords[corner.texCoord] : glm::vec2(0.0f);
+        uint32_t index = (uint32_t)mesh.vertexCount();
+        float vertex[8] = { position.x, position.y, position.z, normal.x, normal.y, normal.z, texCoord.x, texCoord.y };
+        mesh.vertices.insert(mesh.vertices.end(), vertex, vertex + 8);
+        if (hasNormal)
+            welded.emplace(corner, index);
+        return index;
+    };
+    // OBJ indices start from 1, negative ones count back from the last element
+    auto resolve = [](long index, size_t count) -> long
+    {
+        long resolved = index > 0 ? index - 1 : (long)count + index;
+        return resolved >= 0 && resolved < (long)count ? resolved : -1;
+    };
+
+    const char* cursor = text.c_str();
+    const char* end = cursor + text.size();
+    while (cursor < end)
+    {
+        const char* lineEnd = (const char*)std::memchr(cursor, '\n', end - cursor);
+        if (!lineEnd)
+            lineEnd = end;
+        while (cursor < lineEnd && (*cursor == ' ' || *cursor == '\t'))
+            cursor++;
+        char* next = nullptr;
+        if (cursor[0] == 'v' && (cursor[1] == ' ' || cursor[1] == '\t'))
+        {
+            float x = std::strtof(cursor + 2, &next);
+            float y = std::strtof(next, &next);
+            float z = std::strtof(next, &next);
+            positions.push_back(glm::vec3(x, y, z));
+        }
+        else if (cursor[0] == 'v' && cursor[1] == 'n')
+        {
+            float x = std::strtof(cursor + 3, &next);
+            float y = std::strtof(next, &next);
+            float z = std::strtof(next, &next);
+            glm::vec3 normal(x, y, z);
+            normals.push_back(glm::length(normal) > 0.0f ? glm::normalize(normal) : glm::vec3(0.0f)); // zero: face normal
+        }
+        else if (cursor[0] == 'v' && cursor[1] == 't')
+        {
+            float u = std::strtof(cursor + 3, &next);
+            float v = std::strtof(next, &next);
+            texCoords.push_back(glm::vec2(u, v));
+        }
+        else if (cursor[0] == 'f' && (cursor[1] == ' ' || cursor[1] == '\t'))
+        {
+            face.clear();
+            const char* token = cursor + 2;
+            while (token < lineEnd)
+            {
+                long value = std::strtol(token, &next, 10);
+                if (next == token)
+                {
+                    token++;
+                    continue;
+                }
+                Corner corner = { resolve(value, positions.size()), -1, -1 };
+                token = next;
+                if (*token == '/')
+                {
+                    token++;
+                    if (*token != '/')
+                    {
+                        corner.texCoord = resolve(std::strtol(token, &next, 10), texCoords.size());
+                        token = next;
+                    }
+                    if (*token == '/')
+                    {
+                        corner.normal = resolve(std::strtol(token + 1, &next, 10), normals.size());
+                        token = next;
+                    }
+                }
+                if (corner.position >= 0)
+                    face.push_back(corner);
+            }
+            for (size_t k = 2; k < face.size(); k++)
+            {
+                glm::vec3 a = positions[face[0].position], b = positions[face[k - 1].position], c = positions[face[k].position];
+                glm::vec3 cross = glm::cross(b - a, c - a);
+                glm::vec3 faceNormal = glm::length(cross) > 0.0f ? glm::normalize(cross) : glm::vec3(0.0f, 1.0f, 0.0f);
+                mesh.indices.push_back(addVertex(face[0], faceNormal));
+                mesh.indices.push_back(addVertex(face[k - 1], faceNormal));
+                mesh.indices.push_back(addVertex(face[k], faceNormal));
+            }
+        }
+        cursor = lineEnd + 1;
+    }
+    return !mesh.indices.empty();
+}
+
+// glTF 2.0 (.gltf with external or base64 buffers, .glb): the triangle primitives of the nodes of the default
+// scene, transformed by the node hierarchy, merged into one mesh (POSITION, NORMAL, TEXCOORD_0)
+// ------------------------------------------------------------------------
+class GltfReader
+{
+    public:
+        bool load(const std::string& path, IndexedMesh& mesh)
+        {
+            mesh = IndexedMesh();
+            mesh.vertexFloats = PRIMITIVE_VERTEX_FLOATS;
+            std::ifstream file(path, std::ios::binary);
+            if (!file)
+                return false;
+            std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            directory = std::filesystem::path(path).parent_path();
+            try
+            {
+                if (contents.size() >= 20 && contents.compare(0, 4, "glTF") == 0)
+                {
+                    // GLB: header (12 bytes), JSON chunk, optional BIN chunk
+                    uint32_t jsonLength = readU32(contents, 12);
+                    document = nlohmann::json::parse(contents.substr(20, jsonLength));
+                    size_t binOffset = 20 + ((jsonLength + 3) & ~3u);
+                    if (binOffset + 8 <= contents.size())
+                        glbBuffer = contents.substr(binOffset + 8, readU32(contents, binOffset));
+                }
+                else
+                    document = nlohmann::json::parse(contents);
+                loadBuffers();
+                size_t sceneIndex = document.value("scene", 0);
+                if (document.contains("scenes") && sceneIndex < document["scenes"].size())
+                    for (size_t node : document["scenes"][sceneIndex].value("nodes", std::vector<size_t>()))
+                        addNode(node, glm::mat4(1.0f), mesh);
+                else if (document.contains("meshes"))
+                    for (size_t m = 0; m < document["meshes"].size(); m++)
+                        addMesh(m, glm::mat4(1.0f), mesh);
+            }
+            catch (const std::exception& error)
+            {
+                std::cout << "glTF error in " << path << ": " << error.what() << std::endl;
+                return false;
+            }
+            return !mesh.indices.empty();
+        }
+
+    private:
+        nlohmann::json document;
+        std::filesystem::path directory;
+        std::string glbBuffer;
+        std::vector<std::string> buffers;
+
+        static uint32_t readU32(const std::string& bytes, size_t offset)
+        {
+            uint32_t value;
+            std::memcpy(&value, bytes.data() + offset, sizeof(value));
+            return value;
+        }
+
+        static std::string decodeBase64(const std::string& text)
+        {
+            std::string decoded;
+            unsigned int bits = 0;
+            int count = 0;
+            for (char c : text)
+            {
+                int value;
+                if (c >= 'A' && c <= 'Z') value = c - 'A';
+                else if (c >= 'a' && c <= 'z') value = c - 'a' + 26;
+                else if (c >= '0' && c <= '9') value = c - '0' + 52;
+                else if (c == '+') value = 62;
+                else if (c == '/') value = 63;
+                else continue;
+                bits = (bits << 6) | value;
+                count += 6;
+                if (count >= 8)
+                {
+                    count -= 8;
+                    decoded.push_back((char)((bits >> count) & 0xFF));
+                }
+            }
+            return decoded;
+        }
+
+        void loadBuffers()
+        {
+            for (const nlohmann::json& buffer : document.value("buffers", nlohmann::json::array()))
+            {
+                if (!buffer.contains("uri"))
+                {
+                    buffers.push_back(glbBuffer);
+                    continue;
+                }
+                std::string uri = buffer["uri"];
+                if (uri.compare(0, 5, "data:") == 0)
+                {
+                    buffers.push_back(decodeBase64(uri.substr(uri.find(',') + 1)));
+                    continue;
+                }
+                std::ifstream file(directory / uri, std::ios::binary);
+                buffers.push_back(std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>()));
+            }
+        }
+
+        void addNode(size_t index, const glm::mat4& parent, IndexedMesh& mesh)
+        {
+            const nlohmann::json& node = document["nodes"][index];
+            glm::mat4 local(1.0f);
+            if (node.contains("matrix"))
+            {
+                std::vector<float> matrix = node["matrix"];
+                local = glm::make_mat4(matrix.data()); // column major, as glm
+            }
+            else
+            {
+                std::vector<float> t = node.value("translation", std::vector<float>{ 0.0f, 0.0f, 0.0f });
+                std::vector<float> r = node.value("rotation", std::vector<float>{ 0.0f, 0.0f, 0.0f, 1.0f });
+                std::vector<float> s = node.value("scale", std::vector<float>{ 1.0f, 1.0f, 1.0f });
+                local = glm::translate(glm::mat4(1.0f), glm::vec3(t[0], t[1], t[2])) * glm::mat4_cast(glm::quat(r[3], r[0], r[1], r[2]))
+                        * glm::scale(glm::mat4(1.0f), glm::vec3(s[0], s[1], s[2]));
+            }
+            glm::mat4 world = parent * local;
+            if (node.contains("mesh"))
+                addMesh(node["mesh"], world, mesh);
+            for (size_t child : node.value("children", std::vector<size_t>()))
+                addNode(child, world, mesh);
+        }
+
+        // elements of an accessor as floats (normalized integers are converted), components per element in `components`
+        std::vector<float> readAccessor(size_t index, int& components)
+        {
+            const nlohmann::json& accessor = document["accessors"][index];
+            static const std::unordered_map<std::string, int> typeComponents = { { "SCALAR", 1 }, { "VEC2", 2 }, { "VEC3", 3 }, { "VEC4", 4 } };
+            components = typeComponents.at(accessor["type"].get<std::string>());
+            size_t count = accessor["count"];
+            int componentType = accessor["componentType"];
+            bool normalized = accessor.value("normalized", false);
+            size_t componentSize = componentType == 5126 || componentType == 5125 ? 4 : (componentType == 5122 || componentType == 5123 ? 2 : 1);
+            std::vector<float> values(count * components, 0.0f);
+            if (!accessor.contains("bufferView"))
+                return values; // all zeros (sparse accessors are not supported)
+            const nlohmann::json& view = document["bufferViews"][accessor["bufferView"].get<size_t>()];
+            const std::string& buffer = buffers.at(view["buffer"]);
+            size_t stride = view.value("byteStride", (size_t)0);
+            if (stride == 0)
+                stride = componentSize * components;
+            size_t offset = view.value("byteOffset", (size_t)0) + accessor.value("byteOffset", (size_t)0);
+            if (count > 0 && offset + (count - 1) * stride + componentSize * components > buffer.size())
+                throw std::runtime_error("accessor out of its buffer");
+            for (size_t e = 0; e < count; e++)
+                for (int c = 0; c < components; c++)
+                {
+                    const char* source = buffer.data() + offset + e * stride + c * componentSize;
+                    float value = 0.0f;
+                    switch (componentType)
+                    {
+                        case 5126: { float f; std::memcpy(&f, source, 4); value = f; break; }
+                        case 5125: { uint32_t u; std::memcpy(&u, source, 4); value = (float)u; break; }
+                        case 5123: { uint16_t u; std::memcpy(&u, source, 2); value = normalized ? u / 65535.0f : u; break; }
+                        case 5122: { int16_t i; std::memcpy(&i, source, 2); value = normalized ? std::max(i / 32767.0f, -1.0f) : i; break; }
+                        case 5121: { uint8_t u = (uint8_t)*source; value = normalized ? u / 255.0f : u; break; }
+                        case 5120: { int8_t i = (int8_t)*source; value = normalized ? std::max(i / 127.0f, -1.0f) : i; break; }
+                    }
+                    values[e * components + c] = value;
+                }
+            return values;
+        }
+
+        // indices as integers (floats would lose precision over 2^24)
+        std::vector<uint32_t> readIndices(size_t index)
+        {
+            const nlohmann::json& accessor = document["accessors"][index];
+            const nlohmann::json& view = document["bufferViews"][accessor["bufferView"].get<size_t>()];
+            const std::string& buffer = buffers.at(view["buffer"]);
+            size_t count = accessor["count"];
+            int componentType = accessor["componentType"];
+            size_t size = componentType == 5125 ? 4 : (componentType == 5123 ? 2 : 1);
+            size_t offset = view.value("byteOffset", (size_t)0) + accessor.value("byteOffset", (size_t)0);
+            if (offset + count * size > buffer.size())
+                throw std::runtime_error("indices out of their buffer");
+            std::vector<uint32_t> indices(count);
+            for (size_t i = 0; i < count; i++)
+            {
+                const char* source = buffer.data() + offset + i * size;
+                if (size == 4)
+                    std::memcpy(&indices[i], source, 4);
+                else if (size == 2)
+                {
+                    uint16_t value;
+                    std::memcpy(&value, source, 2);
+                    indices[i] = value;
+                }
+                else
+                    indices[i] = (uint8_t)*source;
+            }
+            return indices;
+        }
+
+        void addMesh(size_t index, const glm::mat4& world, IndexedMesh& mesh)
+        {
+            glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(world)));
+            for (const nlohmann::json& primitive : document["meshes"][index]["primitives"])
+            {
+                if (primitive.value("mode", 4) != 4 || !primitive["attributes"].contains("POSITION"))
+                    continue; // only triangle lists
+                int components;
+                std::vector<float> positions = readAccessor(primitive["attributes"]["POSITION"], components);
+                size_t vertexCount = positions.size() / 3;
+                std::vector<float> normals, texCoords;
+                if (primitive["attributes"].contains("NORMAL"))
+                    normals = readAccessor(primitive["attributes"]["NORMAL"], components);
+                if (primitive["attributes"].contains("TEXCOORD_0"))
+                    texCoords = readAccessor(primitive["attributes"]["TEXCOORD_0"], components);
+                std::vector<uint32_t> indices;
+                if (primitive.contains("indices"))
+                    indices = readIndices(primitive["indices"]);
+                else
+                    for (uint32_t i = 0; i < vertexCount; i++)
+                        indices.push_back(i);
+                if (normals.size() != vertexCount * 3)
+                    normals = flatNormals(positions, indices);
+
+                uint32_t base = (uint32_t)mesh.vertexCount();
+                for (size_t v = 0; v < vertexCount; v++)
+                {
+                    glm::vec3 position = glm::vec3(world * glm::vec4(glm::make_vec3(&positions[v * 3]), 1.0f));
+                    glm::vec3 normal = normalMatrix * glm::make_vec3(&normals[v * 3]);
+                    normal = glm::length(normal) > 0.0f ? glm::normalize(normal) : glm::vec3(0.0f, 1.0f, 0.0f);
+                    glm::vec2 texCoord = texCoords.size() >= (v + 1) * 2 ? glm::vec2(texCoords[v * 2], texCoords[v * 2 + 1]) : glm::vec2(0.0f);
+                    float vertex[8] = { position.x, position.y, position.z, normal.x, normal.y, normal.z, texCoord.x, texCoord.y };
+                    mesh.vertices.insert(mesh.vertices.end(), vertex, vertex + 8);
+                }
+                for (size_t i = 0; i + 2 < indices.size(); i += 3)
+                    if (indices[i] < vertexCount && indices[i + 1] < vertexCount && indices[i + 2] < vertexCount)
+                        for (int k = 0; k < 3; k++)
+                            mesh.indices.push_back(base + indices[i + k]);
+            }
+        }
+
+        // area weighted vertex normals, for primitives without NORMAL
+        static std::vector<float> flatNormals(const std::vector<float>& positions, const std::vector<uint32_t>& indices)
+        {
+            size_t vertexCount = positions.size() / 3;
+            std::vector<glm::vec3> sums(vertexCount, glm::vec3(0.0f));
+            for (size_t i = 0; i + 2 < indices.size(); i += 3)
+            {
+                if (indices[i] >= vertexCount || indices[i + 1] >= vertexCount || indices[i + 2] >= vertexCount)
+                    continue;
+                glm::vec3 a = glm::make_vec3(&positions[indices[i] * 3]), b = glm::make_vec3(&positions[indices[i + 1] * 3]), c = glm::make_vec3(&positions[indices[i + 2] * 3]);
+                glm::vec3 cross = glm::cross(b - a, c - a);
+                for (int k = 0; k < 3; k++)
+                    sums[indices[i + k]] += cross;
+            }
+            std::vector<float> normals(vertexCount * 3);
+            for (size_t v = 0; v < vertexCount; v++)
+                std::memcpy(&normals[v * 3], glm::value_ptr(sums[v]), 3 * sizeof(float));
+            return normals;
+        }
+};
+
+// statistics of a mesh file load
+struct MeshLoadStats
+{
+    bool cached = false; // read from the cache (warm) or parsed (cold)
+    double milliseconds = 0.0;
+    size_t sourceBytes = 0;
+    size_t cacheBytes = 0;
+};
+
+// loads a mesh file in the compact layout, from its cache when it is up to date
+// ------------------------------------------------------------------------
+inline bool loadCompactMesh(const std::string& path, CompactMesh& mesh, MeshLoadStats& stats)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::error_code error;
+    uint64_t sourceSize = std::filesystem::file_size(path, error);
+    if (error)
+    {
+        std::cout << "mesh file not found: " << path << std::endl;
+        return false;
+    }
+    int64_t sourceTime = (int64_t)std::filesystem::last_write_time(path, error).time_since_epoch().count();
+    std::string cachePath = path + MESH_CACHE_EXTENSION;
+
+    stats = MeshLoadStats();
+    stats.sourceBytes = (size_t)sourceSize;
+    stats.cached = mesh.map(cachePath, sourceSize, sourceTime);
+    if (!stats.cached)
+    {
+        IndexedMesh indexed;
+        std::string extension = std::filesystem::path(path).extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+        bool loaded = false;
+        if (extension == ".obj")
+            loaded = loadObj(path, indexed);
+        else if (extension == ".gltf" || extension == ".glb")
+            loaded = GltfReader().load(path, indexed);
+        if (!loaded)
+        {
+            std::cout << "mesh file not loaded (OBJ or glTF with triangles expected): " << path << std::endl;
+            return false;
+        }
+        optimizeIndexedMesh(indexed);
+        mesh.build(indexed);
+        if (!mesh.write(cachePath, sourceSize, sourceTime))
+            std::cout << "mesh cache not written: " << cachePath << std::endl;
+    }
+    stats.cacheBytes = mesh.fileBytes();
+    stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return true;
+}
+#endif
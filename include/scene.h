@@ -0,0 +1,710 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <nlohmann/json.hpp>
+
+#include <shader.h>
+#include <bounds.h>
+#include <primitives.h>
+#include <mesh_builder.h>
+#include <mesh_loader.h>
+#include <bvh.h>
+#include <thread_pool.h>
+
+#include <vector>
+#include <string>
+#include <map>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstddef>
+#include <cmath>
+#include <limits>
+
+// first vertex attribute of the per-instance model matrix (a mat4 takes 4 locations)
+const unsigned int INSTANCE_MODEL_LOCATION = 3;
+// vectors of the vertex uniforms left to lightVS besides the mesh parameter arrays (the mesh index travels in the last
+// row of the instance matrix)
+const unsigned int SCENE_SHADER_RESERVED_VECTORS = 16;
+// indices a draw call is worth without multi draw indirect: the batches of a material become one draw when that makes
+// the instances run at most this many more indices per saved draw
+const GLsizei DRAW_CALL_INDICES = 4096;
+
+// glMultiDrawElementsIndirect command
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// A mesh is a range of the shared vertex and index buffers of the scene
+struct SceneMesh
+{
+    std::string name;
+    GLsizei vertexCount = 0; // unique vertices
+    GLsizei indexCount = 0;
+    GLuint firstIndex = 0; // in the shared index buffer
+    GLint baseVertex = 0; // in the shared vertex buffer (indices are relative to the mesh)
+    glm::vec3 positionScale = glm::vec3(1.0f); // positions are quantized in the bounds: position = stored * scale + offset
+    glm::vec3 positionOffset = glm::vec3(0.0f);
+    bool inverseNormals = false; // the mesh is seen from inside (e.g. the tunnel)
+    BoundingBox bounds; // local space
+};
+
+struct SceneMaterial
+{
+    std::string name;
+    GLuint diffuse = 0; // sRGB diffuse texture
+};
+
+// All the instances that share mesh and material: one indirect command (one instanced draw call without multi draw indirect).
+// The model matrices of the visible instances live in the batch range of the instance buffer, read as per-instance
+// vertex attributes.
+struct SceneBatch
+{
+    unsigned int mesh = 0;
+    unsigned int material = 0;
+    GLuint firstInstance = 0; // range of the batch in the instance buffer
+    GLuint drawFirst = 0; // first visible instance (packed after the visible ones of the previous batches of the material without multi draw indirect)
+    std::vector<glm::mat4> models;
+    std::vector<BoundingBox> instanceBounds; // world space
+    BoundingBox bounds; // world space, all the instances
+    std::vector<uint32_t> visible; // slots of the instances that passed the last cull, in the instance buffer
+    GLsizei visibleCount = 0; // instances drawn
+};
+
+// Scene read from the scene file:
+// - "meshes" : name -> { "primitive": "cube" | "tunnel" or "file": OBJ / glTF path, "inverse_normals": bool }
+// - "materials" : name -> { "diffuse": texture path }
+// - "instances" : [{ "mesh", "material", "position", "rotation" (degrees, x y z), "scale",
+//                   "array": { "count": [x, y, z], "offset": [x, y, z] } }] (array repeats the instance on a grid)
+// The instances are culled against the view frustum through a BVH over their world bounds, the batches draw only the visible ones.
+// Every mesh is packed in shared vertex and index buffers drawn through a single vao; with OpenGL 4.3 the batches of a
+// material are drawn by one glMultiDrawElementsIndirect from a command buffer built once (only the instance counts change).
+// Otherwise the visible instances of a material are packed together and, when it costs fewer vertices than the draws it
+// saves, the material is drawn by one glDrawElementsInstanced over the index ranges of all its meshes (merged once, made
+// absolute): lightVS collapses the vertices that are not of the mesh of the instance. The mesh parameters live in arrays
+// sized by shaderPreamble(); scenes with more meshes than they hold set them before every batch.
+class Scene
+{
+    public:
+        std::vector<SceneMesh> meshes;
+        std::vector<SceneMaterial> materials;
+        std::vector<SceneBatch> batches;
+        unsigned int drawCalls = 0; // draw calls issued by the last draw()
+        bool indirect = false; // batches drawn with multi draw indirect
+        double loadMilliseconds = 0.0; // meshes loaded and uploaded
+        double cullMilliseconds = 0.0; // last cull (with the refit of moved instances)
+        size_t visibleInstances = 0;
+        unsigned long long generation = 0; // changes whenever an instance moves (for caches of the rendered image)
+        InstanceBVH bvh; // over every instance, indexed by instance id (batches in order, then slots)
+
+        typedef std::function<unsigned int(const char* path, bool gammaCorrection)> TextureLoader;
+
+        // measureMeshes: counts the vertex shader invocations of every mesh before and after indexing (uses the program in use)
+        // indirect: multi draw indirect when the context supports it
+        Scene(const nlohmann::json& scene, TextureLoader loadTexture, ThreadPool& pool, bool indirect = true, bool measureMeshes = false) : pool(pool)
+        {
+            this->indirect = indirect && glExt.multiDrawIndirect;
+            auto start = std::chrono::steady_clock::now();
+            nlohmann::json meshList = scene.value("meshes", nlohmann::json::object());
+            std::map<std::string, unsigned int> meshIndex;
+            for (auto& mesh : meshList.items())
+            {
+                meshIndex[mesh.key()] = (unsigned int)meshes.size();
+                bool inverseNormals = mesh.value().value("inverse_normals", false);
+                if (mesh.value().contains("file"))
+                    addMeshFile(mesh.key(), mesh.value()["file"], inverseNormals);
+                else
+                    addPrimitive(mesh.key(), primitiveVertices(mesh.value().value("primitive", std::string(""))), inverseNormals, measureMeshes);
+            }
+            packMeshes();
+            meshesPerBatch = meshes.size() > meshCapacity();
+            if (meshesPerBatch)
+            {
+                std::cout << "scene: " << meshes.size() << " meshes, more than the " << meshCapacity() << " of the shader arrays: mesh parameters set per batch" << std::endl;
+                this->indirect = false;
+            }
+            loadMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            nlohmann::json materialList = scene.value("materials", nlohmann::json::object());
+            std::map<std::string, unsigned int> materialIndex;
+            std::map<std::string, GLuint> textures; // every texture is loaded once
+            for (auto& material : materialList.items())
+            {
+                std::string path = material.value()["diffuse"];
+                if (textures.find(path) == textures.end())
+                    textures[path] = loadTexture(path.c_str(), true);
+                materialIndex[material.key()] = (unsigned int)materials.size();
+                materials.push_back({ material.key(), textures[path] });
+            }
+
+            nlohmann::json instanceList = scene.value("instances", nlohmann::json::array());
+            std::map<std::pair<unsigned int, unsigned int>, unsigned int> batchIndex;
+            for (const nlohmann::json& instance : instanceList)
+            {
+                auto mesh = meshIndex.find(instance.value("mesh", std::string("")));
+                auto material = materialIndex.find(instance.value("material", std::string("")));
+                if (mesh == meshIndex.end() || material == materialIndex.end())
+                {
+                    std::cout << "scene instance with unknown mesh or material: " << instance.dump() << std::endl;
+                    continue;
+                }
+                auto key = std::make_pair(mesh->second, material->second);
+                if (batchIndex.find(key) == batchIndex.end())
+                {
+                    batchIndex[key] = (unsigned int)batches.size();
+                    batches.push_back(SceneBatch());
+                    batches.back().mesh = mesh->second;
+                    batches.back().material = material->second;
+                }
+                addInstances(batches[batchIndex[key]], instance);
+            }
+            // batches of the same material are contiguous: one indirect draw each
+            std::stable_sort(batches.begin(), batches.end(), [](const SceneBatch& a, const SceneBatch& b) { return a.material < b.material; });
+            createBuffers();
+            buildBVH();
+            std::cout << "scene: " << meshes.size() << " meshes (loaded in " << loadMilliseconds << " ms), " << materials.size() << " materials, "
+                      << instanceCount() << " instances in " << batches.size() << " batches, bvh of " << bvh.nodes.size() << " nodes built in "
+                      << bvh.buildMilliseconds << " ms | " << (this->indirect ? "multi draw indirect" : meshesPerBatch ? "one draw per batch" : "batches of a material merged") << std::endl;
+        }
+
+        ~Scene()
+        {
+            glDeleteVertexArrays(1, &vao);
+            glDeleteBuffers(1, &vertexBuffer);
+            glDeleteBuffers(1, &indexBuffer);
+            glDeleteBuffers(1, &mergedIndexBuffer);
+            glDeleteBuffers(1, &instanceBuffer);
+            glDeleteBuffers(1, &commandBuffer);
+        }
+
+        // size of the mesh parameter arrays of lightVS: as many meshes as the vertex uniforms hold (three vectors each)
+        static unsigned int meshCapacity()
+        {
+            GLint components = 0;
+            glGetIntegerv(GL_MAX_VERTEX_UNIFORM_COMPONENTS, &components);
+            return (unsigned int)std::max(1, (components / 4 - (GLint)SCENE_SHADER_RESERVED_VECTORS) / 3);
+        }
+
+        // defines to pass as preamble to the programs that draw the scene (lightVS)
+        static std::string shaderPreamble()
+        {
+            return "#define MAX_SCENE_MESHES " + std::to_string(meshCapacity());
+        }
+
+        size_t instanceCount() const
+        {
+            size_t count = 0;
+            for (const SceneBatch& batch : batches)
+                count += batch.models.size();
+            return count;
+        }
+
+        // moves an instance: the BVH is refit by the next cull
+        void setInstanceModel(unsigned int batchIndex, unsigned int slot, const glm::mat4& model)
+        {
+            SceneBatch& batch = batches[batchIndex];
+            batch.models[slot] = model;
+            batch.instanceBounds[slot] = transformBounds(meshes[batch.mesh].bounds, model);
+            batch.bounds.min = glm::min(batch.bounds.min, batch.instanceBounds[slot].min);
+            batch.bounds.max = glm::max(batch.bounds.max, batch.instanceBounds[slot].max);
+            moved = true;
+            uploadAll = true;
+            generation++;
+        }
+
+        // keeps the instances whose bounds intersect the frustum; the instance buffers are rewritten only when the
+        // visible set (or a model) changes
+        void cull(const Frustum& frustum)
+        {
+            auto start = std::chrono::steady_clock::now();
+            if (moved)
+            {
+                std::vector<BoundingBox> boxes;
+                boxes.reserve(instanceBatch.size());
+                for (const SceneBatch& batch : batches)
+                    boxes.insert(boxes.end(), batch.instanceBounds.begin(), batch.instanceBounds.end());
+                bvh.refit(boxes, pool);
+                moved = false;
+            }
+            bvh.cull(frustum, visibleIds);
+            std::sort(visibleIds.begin(), visibleIds.end()); // grouped by batch, in instance order
+            visibleInstances = visibleIds.size();
+            size_t next = 0;
+            GLuint packed = 0; // next free instance of the material
+            bool countsChanged = false;
+            glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+            for (unsigned int b = 0; b < batches.size(); b++)
+            {
+                SceneBatch& batch = batches[b];
+                visibleSlots.clear();
+                for (; next < visibleIds.size() && instanceBatch[visibleIds[next]] == b; next++)
+                    visibleSlots.push_back(instanceSlot[visibleIds[next]]);
+                if (batch.visibleCount != (GLsizei)visibleSlots.size())
+                {
+                    batch.visibleCount = (GLsizei)visibleSlots.size();
+                    commands[b].instanceCount = (GLuint)batch.visibleCount;
+                    countsChanged = true;
+                }
+                GLuint drawFirst = batch.firstInstance;
+                if (!indirect)
+                {
+                    if (b == 0 || batches[b - 1].material != batch.material)
+                        packed = batch.firstInstance;
+                    drawFirst = packed;
+                    packed += (GLuint)batch.visibleCount;
+                }
+                bool shifted = drawFirst != batch.drawFirst;
+                batch.drawFirst = drawFirst;
+                if (!uploadAll && !shifted && visibleSlots == batch.visible)
+                    continue;
+                batch.visible.swap(visibleSlots);
+                visibleModels.clear();
+                for (uint32_t slot : batch.visible)
+                {
+                    visibleModels.push_back(batch.models[slot]);
+                    visibleModels.back()[0][3] = meshesPerBatch ? 0.0f : (float)batch.mesh; // read by lightVS, the row is restored to 0 0 0 1
+                }
+                if (visibleModels.empty())
+                    continue;
+                glBufferSubData(GL_ARRAY_BUFFER, batch.drawFirst * sizeof(glm::mat4), visibleModels.size() * sizeof(glm::mat4), visibleModels.data());
+            }
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            if (indirect && countsChanged)
+            {
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+                glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            }
+            uploadAll = false;
+            cullMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // locations of the mesh parameters arrays in a program that draws the scene (resolved once per program)
+        struct Uniforms
+        {
+            UniformHandle meshPositionScale;
+            UniformHandle meshPositionOffset;
+            UniformHandle meshVertices;
+        };
+
+        static Uniforms uniforms(const Shader& shader)
+        {
+            return { shader.uniform("meshPositionScale"), shader.uniform("meshPositionOffset"), shader.uniform("meshVertices") };
+        }
+
+        // draws the visible instances of every batch with the given shader (diffuse texture on unit 0, mesh parameters arrays)
+        void draw(Shader& shader)
+        {
+            draw(shader, uniforms(shader));
+        }
+        void draw(Shader& shader, const Uniforms& meshUniforms)
+        {
+            drawCalls = 0;
+            if (!meshesPerBatch)
+                setMeshUniforms(shader, meshUniforms, 0, (int)meshes.size());
+            glActiveTexture(GL_TEXTURE0);
+            glBindVertexArray(vao);
+            if (indirect)
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+            else
+                glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+            GLsizeiptr indexSize = indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+            size_t merged = 0; // next merged range
+            for (size_t first = 0; first < batches.size();)
+            {
+                // batches [first, end) share the material
+                size_t end = first;
+                GLsizei visible = 0;
+                for (; end < batches.size() && batches[end].material == batches[first].material; end++)
+                    visible += batches[end].visibleCount;
+                for (; merged < mergedRanges.size() && mergedRanges[merged].firstBatch < first; merged++);
+                if (visible > 0)
+                {
+                    glBindTexture(GL_TEXTURE_2D, materials[batches[first].material].diffuse);
+                    if (indirect)
+                    {
+                        glExt.MultiDrawElementsIndirect(GL_TRIANGLES, indexType, (void*)(first * sizeof(DrawElementsIndirectCommand)), (GLsizei)(end - first), 0);
+                        drawCalls++;
+                    }
+                    else if (merged < mergedRanges.size() && mergedRanges[merged].firstBatch == first && worthMerging(mergedRanges[merged], visible))
+                    {
+                        setInstanceAttributes(batches[first].drawFirst); // the visible instances of the material are packed
+                        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mergedIndexBuffer);
+                        glDrawElementsInstanced(GL_TRIANGLES, mergedRanges[merged].indexCount, GL_UNSIGNED_INT, (void*)(mergedRanges[merged].firstIndex * sizeof(uint32_t)), visible);
+                        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+                        drawCalls++;
+                    }
+                    else
+                        for (size_t b = first; b < end; b++)
+                        {
+                            const SceneBatch& batch = batches[b];
+                            const SceneMesh& mesh = meshes[batch.mesh];
+                            if (batch.visibleCount == 0)
+                                continue;
+                            if (meshesPerBatch)
+                                setMeshUniforms(shader, meshUniforms, batch.mesh, 1);
+                            setInstanceAttributes(batch.drawFirst); // no base instance before OpenGL 4.2
+                            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh.indexCount, indexType, (void*)(mesh.firstIndex * indexSize), batch.visibleCount, mesh.baseVertex);
+                            drawCalls++;
+                        }
+                }
+                first = end;
+            }
+            glBindBuffer(indirect ? GL_DRAW_INDIRECT_BUFFER : GL_ARRAY_BUFFER, 0);
+            glBindVertexArray(0);
+        }
+
+        // screen size in pixels of the largest visible instance of every material (the bounding sphere seen from the eye,
+        // the texture assumed to span the instance once), reported once per material; infinite when the eye is inside.
+        // pixelsPerRadian: viewport height over the vertical field of view
+        void textureFootprints(const glm::vec3& eye, float pixelsPerRadian, const std::function<void(GLuint texture, float pixels)>& footprint)
+        {
+            materialPixels.assign(materials.size(), 0.0f);
+            for (const SceneBatch& batch : batches)
+            {
+                float& pixels = materialPixels[batch.material];
+                for (GLsizei i = 0; i < batch.visibleCount; i++)
+                {
+                    const BoundingBox& bounds = batch.instanceBounds[batch.visible[i]];
+                    float radius = 0.5f * glm::length(bounds.max - bounds.min);
+                    float distance = glm::length(0.5f * (bounds.min + bounds.max) - eye);
+                    if (distance <= radius)
+                    {
+                        pixels = std::numeric_limits<float>::infinity();
+                        break;
+                    }
+                    pixels = std::max(pixels, 2.0f * std::asin(radius / distance) * pixelsPerRadian);
+                }
+            }
+            for (size_t m = 0; m < materials.size(); m++)
+                if (materialPixels[m] > 0.0f)
+                    footprint(materials[m].diffuse, materialPixels[m]);
+        }
+
+        // world bounds of the batches (used to cull lights that reach no geometry)
+        void appendBounds(std::vector<BoundingBox>& bounds) const
+        {
+            for (const SceneBatch& batch : batches)
+                bounds.push_back(batch.bounds);
+        }
+
+    private:
+        ThreadPool& pool;
+        GLuint vao = 0; // shared buffers, every batch draws through it
+        GLuint vertexBuffer = 0;
+        GLuint indexBuffer = 0;
+        GLenum indexType = GL_UNSIGNED_SHORT; // 32-bit as soon as a mesh needs it
+        GLuint instanceBuffer = 0;
+        GLuint commandBuffer = 0;
+        std::vector<DrawElementsIndirectCommand> commands; // one per batch
+        std::vector<glm::vec4> meshPositionScale; // per mesh, w = inverse normals
+        std::vector<glm::vec4> meshPositionOffset;
+        std::vector<glm::ivec2> meshVertices; // per mesh, first and end vertex in the shared vertex buffer
+        bool meshesPerBatch = false; // more meshes than the shader arrays hold: element 0 is set before every batch
+
+        // batches [firstBatch, endBatch) of one material: the index ranges of their meshes one after the other in
+        // mergedIndexBuffer, with the base vertex added
+        struct MergedRange
+        {
+            size_t firstBatch;
+            size_t endBatch;
+            GLuint firstIndex;
+            GLsizei indexCount;
+        };
+        std::vector<MergedRange> mergedRanges; // materials of more than one batch, without multi draw indirect
+        GLuint mergedIndexBuffer = 0;
+        std::vector<std::unique_ptr<CompactMesh>> staged; // mesh data until packMeshes() (mapped caches are not copied)
+        std::vector<uint32_t> instanceBatch; // batch and slot of every instance id
+        std::vector<uint32_t> instanceSlot;
+        bool moved = false; // instances moved since the last cull
+        bool uploadAll = true; // the instance buffers must be rewritten
+        std::vector<uint32_t> visibleIds; // scratch of cull()
+        std::vector<uint32_t> visibleSlots;
+        std::vector<glm::mat4> visibleModels;
+        std::vector<float> materialPixels;
+
+        void buildBVH()
+        {
+            std::vector<BoundingBox> boxes;
+            for (unsigned int b = 0; b < batches.size(); b++)
+                for (unsigned int slot = 0; slot < batches[b].instanceBounds.size(); slot++)
+                {
+                    boxes.push_back(batches[b].instanceBounds[slot]);
+                    instanceBatch.push_back(b);
+                    instanceSlot.push_back(slot);
+                }
+            bvh.build(boxes, pool);
+        }
+
+        static glm::vec3 vec3(const nlohmann::json& value, const glm::vec3& fallback)
+        {
+            return value.is_array() ? glm::vec3(value[0], value[1], value[2]) : fallback;
+        }
+
+        // the triangle soup becomes an indexed, cache optimized mesh in the compact layout
+        void addPrimitive(const std::string& name, const std::vector<float>& soup, bool inverseNormals, bool measure)
+        {
+            if (soup.empty())
+                std::cout << "scene mesh without vertices: " << name << std::endl;
+            IndexedMesh indexed = buildIndexedMesh(soup.data(), soup.size(), PRIMITIVE_VERTEX_FLOATS);
+            if (!soup.empty())
+                reportIndexedMesh(name, soup, indexed, measure);
+            std::unique_ptr<CompactMesh> compact(new CompactMesh());
+            compact->build(indexed);
+            addMesh(name, std::move(compact), inverseNormals);
+        }
+
+        // OBJ / glTF file, through its binary cache
+        void addMeshFile(const std::string& name, const std::string& path, bool inverseNormals)
+        {
+            std::unique_ptr<CompactMesh> compact(new CompactMesh());
+            MeshLoadStats stats;
+            if (!loadCompactMesh(path, *compact, stats))
+            {
+                compact.reset(new CompactMesh());
+                compact->build(IndexedMesh()); // empty range of the shared buffers
+                addMesh(name, std::move(compact), inverseNormals);
+                return;
+            }
+            double megabyte = 1024.0 * 1024.0;
+            std::streamsize precision = std::cout.precision();
+            std::cout << std::fixed << std::setprecision(2) << "mesh " << name << " (" << path << "): " << compact->header().vertexCount << " vertices, "
+                      << compact->header().indexCount / 3 << " triangles | " << (stats.cached ? "warm (cache mapped)" : "cold (parsed and cached)")
+                      << " in " << stats.milliseconds << " ms | " << stats.sourceBytes / megabyte
+                      << " MB source, " << stats.cacheBytes / megabyte << " MB cache" << std::defaultfloat << std::setprecision(precision) << std::endl;
+            addMesh(name, std::move(compact), inverseNormals);
+        }
+
+        // records the mesh, its data is uploaded by packMeshes()
+        void addMesh(const std::string& name, std::unique_ptr<CompactMesh> compact, bool inverseNormals)
+        {
+            SceneMesh mesh;
+            mesh.name = name;
+            mesh.inverseNormals = inverseNormals;
+            mesh.vertexCount = (GLsizei)compact->header().vertexCount;
+            mesh.indexCount = (GLsizei)compact->header().indexCount;
+            mesh.bounds = BoundingBox(compact->boundsMin(), compact->boundsMax());
+            mesh.positionScale = compact->boundsMax() - compact->boundsMin();
+            mesh.positionOffset = compact->boundsMin();
+            meshes.push_back(mesh);
+            staged.push_back(std::move(compact));
+        }
+
+        // every mesh in one vertex and one index buffer (the compact vertices as they are, straight from the mapped
+        // cache for mesh files; 16-bit indices are widened when another mesh needs 32 bits)
+        void packMeshes()
+        {
+            size_t vertexCount = 0, indexCount = 0;
+            for (size_t m = 0; m < meshes.size(); m++)
+            {
+                meshes[m].baseVertex = (GLint)vertexCount;
+                meshes[m].firstIndex = (GLuint)indexCount;
+                vertexCount += meshes[m].vertexCount;
+                indexCount += meshes[m].indexCount;
+                if (staged[m]->header().indexSize == 4)
+                    indexType = GL_UNSIGNED_INT;
+                meshPositionScale.push_back(glm::vec4(meshes[m].positionScale, meshes[m].inverseNormals ? 1.0f : 0.0f));
+                meshPositionOffset.push_back(glm::vec4(meshes[m].positionOffset, 0.0f));
+                meshVertices.push_back(glm::ivec2(meshes[m].baseVertex, meshes[m].baseVertex + meshes[m].vertexCount));
+            }
+            size_t indexSize = indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+            glGenBuffers(1, &vertexBuffer);
+            glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+            glBufferData(GL_ARRAY_BUFFER, std::max<size_t>(1, vertexCount) * sizeof(CompactVertex), nullptr, GL_STATIC_DRAW);
+            glGenBuffers(1, &indexBuffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, std::max<size_t>(1, indexCount) * indexSize, nullptr, GL_STATIC_DRAW);
+            std::vector<uint32_t> widened;
+            for (size_t m = 0; m < meshes.size(); m++)
+            {
+                const CompactMesh& compact = *staged[m];
+                glBufferSubData(GL_ARRAY_BUFFER, meshes[m].baseVertex * sizeof(CompactVertex), compact.vertexBytes(), compact.vertexData());
+                if (compact.header().indexSize == indexSize)
+                    glBufferSubData(GL_COPY_WRITE_BUFFER, meshes[m].firstIndex * indexSize, compact.indexBytes(), compact.indexData());
+                else
+                {
+                    const uint16_t* indices = (const uint16_t*)compact.indexData();
+                    widened.assign(indices, indices + meshes[m].indexCount);
+                    glBufferSubData(GL_COPY_WRITE_BUFFER, meshes[m].firstIndex * indexSize, widened.size() * sizeof(uint32_t), widened.data());
+                }
+            }
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            staged.clear();
+        }
+
+        void addInstances(SceneBatch& batch, const nlohmann::json& instance)
+        {
+            glm::vec3 position = vec3(instance.value("position", nlohmann::json()), glm::vec3(0.0f));
+            glm::vec3 rotation = vec3(instance.value("rotation", nlohmann::json()), glm::vec3(0.0f));
+            glm::vec3 scale = vec3(instance.value("scale", nlohmann::json()), glm::vec3(1.0f));
+            glm::ivec3 count(1);
+            glm::vec3 offset(0.0f);
+            if (instance.contains("array"))
+            {
+                const nlohmann::json& array = instance["array"];
+                count = glm::max(glm::ivec3(vec3(array.value("count", nlohmann::json()), glm::vec3(1.0f))), glm::ivec3(1));
+                offset = vec3(array.value("offset", nlohmann::json()), glm::vec3(0.0f));
+            }
+            glm::mat4 local = glm::mat4(1.0f);
+            local = glm::rotate(local, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
+            local = glm::rotate(local, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
+            local = glm::rotate(local, glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
+            local = glm::scale(local, scale);
+            const BoundingBox& meshBounds = meshes[batch.mesh].bounds;
+            for (int z = 0; z < count.z; z++)
+                for (int y = 0; y < count.y; y++)
+                    for (int x = 0; x < count.x; x++)
+                    {
+                        glm::mat4 model = glm::translate(glm::mat4(1.0f), position + offset * glm::vec3(x, y, z)) * local;
+                        batch.models.push_back(model);
+                        batch.instanceBounds.push_back(transformBounds(meshBounds, model));
+                    }
+        }
+
+        static BoundingBox transformBounds(const BoundingBox& box, const glm::mat4& model)
+        {
+            glm::vec3 center = glm::vec3(model * glm::vec4((box.min + box.max) * 0.5f, 1.0f));
+            glm::vec3 halfSize = (box.max - box.min) * 0.5f;
+            glm::vec3 extent = glm::abs(glm::vec3(model[0])) * halfSize.x + glm::abs(glm::vec3(model[1])) * halfSize.y + glm::abs(glm::vec3(model[2])) * halfSize.z;
+            return BoundingBox(center - extent, center + extent);
+        }
+
+        // per-instance model matrix columns, starting at the given instance of the instance buffer (bound to GL_ARRAY_BUFFER)
+        // mesh parameters of meshes [first, first + count) in the arrays from element 0
+        void setMeshUniforms(Shader& shader, const Uniforms& meshUniforms, unsigned int first, int count)
+        {
+            if (count == 0)
+                return;
+            shader.setVec4Array(meshUniforms.meshPositionScale, &meshPositionScale[first], count);
+            shader.setVec4Array(meshUniforms.meshPositionOffset, &meshPositionOffset[first], count);
+            shader.setIVec2Array(meshUniforms.meshVertices, &meshVertices[first], count);
+        }
+
+        // one draw over the meshes of the material makes every instance run the indices of all of them: merged when the
+        // extra indices cost less than the draws saved
+        bool worthMerging(const MergedRange& range, GLsizei visible) const
+        {
+            GLsizei batchDraws = 0;
+            long long separateIndices = 0;
+            for (size_t b = range.firstBatch; b < range.endBatch; b++)
+                if (batches[b].visibleCount > 0)
+                {
+                    batchDraws++;
+                    separateIndices += (long long)meshes[batches[b].mesh].indexCount * batches[b].visibleCount;
+                }
+            long long mergedIndices = (long long)range.indexCount * visible;
+            return batchDraws > 1 && mergedIndices <= separateIndices + (long long)(batchDraws - 1) * DRAW_CALL_INDICES;
+        }
+
+        // without multi draw indirect, the index ranges of the meshes of every material of more than one batch (read back
+        // from the shared index buffer)
+        void mergeBatches()
+        {
+            size_t indexCount = meshes.empty() ? 0 : meshes.back().firstIndex + meshes.back().indexCount;
+            size_t indexSize = indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+            std::vector<unsigned char> shared(indexCount * indexSize);
+            std::vector<uint32_t> merged;
+            glBindBuffer(GL_COPY_READ_BUFFER, indexBuffer);
+            if (indexCount > 0)
+                glGetBufferSubData(GL_COPY_READ_BUFFER, 0, shared.size(), shared.data());
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            for (size_t first = 0; first < batches.size();)
+            {
+                size_t end = first;
+                for (; end < batches.size() && batches[end].material == batches[first].material; end++);
+                if (end - first > 1)
+                {
+                    MergedRange range = { first, end, (GLuint)merged.size(), 0 };
+                    for (size_t b = first; b < end; b++)
+                    {
+                        const SceneMesh& mesh = meshes[batches[b].mesh];
+                        for (GLsizei i = 0; i < mesh.indexCount; i++)
+                        {
+                            size_t index = mesh.firstIndex + i;
+                            uint32_t vertex = indexSize == 2 ? ((const uint16_t*)shared.data())[index] : ((const uint32_t*)shared.data())[index];
+                            merged.push_back((uint32_t)mesh.baseVertex + vertex);
+                        }
+                    }
+                    range.indexCount = (GLsizei)(merged.size() - range.firstIndex);
+                    mergedRanges.push_back(range);
+                }
+                first = end;
+            }
+            if (merged.empty())
+                return;
+            glGenBuffers(1, &mergedIndexBuffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, mergedIndexBuffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, merged.size() * sizeof(uint32_t), merged.data(), GL_STATIC_DRAW);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+
+        void setInstanceAttributes(GLuint firstInstance)
+        {
+            for (unsigned int column = 0; column < 4; column++)
+                glVertexAttribPointer(INSTANCE_MODEL_LOCATION + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(firstInstance * sizeof(glm::mat4) + column * sizeof(glm::vec4))); //model matrix columns
+        }
+
+        // batch bounds, the vao of the shared buffers, the instance buffer (a range per batch) and the indirect commands
+        void createBuffers()
+        {
+            GLuint instanceCount = 0;
+            for (SceneBatch& batch : batches)
+            {
+                if (!batch.instanceBounds.empty())
+                {
+                    batch.bounds = batch.instanceBounds[0];
+                    for (const BoundingBox& box : batch.instanceBounds)
+                    {
+                        batch.bounds.min = glm::min(batch.bounds.min, box.min);
+                        batch.bounds.max = glm::max(batch.bounds.max, box.max);
+                    }
+                }
+                batch.firstInstance = instanceCount;
+                instanceCount += (GLuint)batch.models.size();
+                const SceneMesh& mesh = meshes[batch.mesh];
+                commands.push_back({ (GLuint)mesh.indexCount, 0, mesh.firstIndex, mesh.baseVertex, batch.firstInstance });
+            }
+            glGenVertexArrays(1, &vao);
+            glBindVertexArray(vao);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer); // recorded in the vao
+            glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, position)); //positions (unorm16 in the bounds)
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, normal)); //normals (octahedral snorm16)
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, texCoords)); //texcoords (half)
+            glGenBuffers(1, &instanceBuffer);
+            glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+            glBufferData(GL_ARRAY_BUFFER, std::max<GLuint>(1, instanceCount) * sizeof(glm::mat4), nullptr, GL_DYNAMIC_DRAW); // rewritten with the visible ones
+            for (unsigned int column = 0; column < 4; column++)
+            {
+                glEnableVertexAttribArray(INSTANCE_MODEL_LOCATION + column);
+                glVertexAttribDivisor(INSTANCE_MODEL_LOCATION + column, 1);
+            }
+            setInstanceAttributes(0); // the base instance of the indirect commands offsets them
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            glBindVertexArray(0);
+            if (indirect)
+            {
+                glGenBuffers(1, &commandBuffer);
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+                glBufferData(GL_DRAW_INDIRECT_BUFFER, std::max<size_t>(1, commands.size()) * sizeof(DrawElementsIndirectCommand), commands.data(), GL_DYNAMIC_DRAW);
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            }
+            else if (!meshesPerBatch)
+                mergeBatches();
+        }
+};
+#endif
@@ -2,21 +2,71 @@
 #define SHADER_H
 
 #include <glad/glad.h>
+#include <gl_ext.h>
 #include <glm/glm.hpp>
 
 #include <string>
+#include <vector>
+#include <unordered_map>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <filesystem>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <memory>
+
+// location of a uniform, resolved once from the location cache of the program (-1 if the uniform is not active)
+struct UniformHandle
+{
+    GLint location = -1;
+};
 
 class Shader
 {
 public:
     unsigned int ID;
+    bool linked = false; // compiled and linked without errors
+    // glGetUniformLocation calls of every program (on any thread): the active uniforms are looked up once after link,
+    // so the count grows only at startup or when a program is rebuilt (or for names that are not active uniforms,
+    // looked up once each)
+    static inline std::atomic<unsigned long long> locationQueries{0};
+    // programs built so far, how many of them came from the binary cache and the time spent building them all
+    static inline unsigned int programsBuilt = 0;
+    static inline unsigned int binaryHits = 0;
+    static inline double buildMilliseconds = 0.0;
+
+    // the programs created from now on are stored with glGetProgramBinary in directory (OpenGL 4.1), keyed by a hash
+    // of their sources (with the preamble) and of the driver; a later run loads them with glProgramBinary and compiles
+    // only when the binary is missing or refused (other driver, other sources)
+    // ------------------------------------------------------------------------
+    static void enableBinaryCache(const std::string& directory)
+    {
+        if (!glExt.programBinaries)
+        {
+            std::cout << "programs: program binaries not supported, every program is compiled" << std::endl;
+            return;
+        }
+        std::error_code error;
+        if (!std::filesystem::create_directories(directory, error) && error)
+        {
+            std::cout << "programs: cannot create the cache directory " << directory << ", every program is compiled" << std::endl;
+            return;
+        }
+        binaryCacheDirectory = directory;
+    }
     // constructor generates the shader on the fly
+    // the optional preamble (defines, extensions) is inserted in every stage right after the #version line
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr, const std::string& preamble = "")
     {
+        sourcePaths = { vertexPath, fragmentPath };
+        if (geometryPath != nullptr)
+            sourcePaths.push_back(geometryPath);
+        sourcePreamble = preamble;
         // 1. retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
         std::string fragmentCode;
@@ -58,6 +108,17 @@ public:
             std::cout << vertexPath << std::endl;
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
         }
+        vertexCode = insertPreamble(vertexCode, preamble);
+        fragmentCode = insertPreamble(fragmentCode, preamble);
+        geometryCode = insertPreamble(geometryCode, preamble);
+        // a program linked by an earlier run is loaded from the binary cache, skipping the compilation
+        std::chrono::steady_clock::time_point buildBegin = std::chrono::steady_clock::now();
+        uint64_t key = binaryKey({ vertexCode, fragmentCode, geometryCode });
+        if (loadBinary(key))
+        {
+            built(buildBegin, true);
+            return;
+        }
         const char* vShaderCode = vertexCode.c_str();
         const char * fShaderCode = fragmentCode.c_str();
         // 2. compile shaders
@@ -88,8 +149,13 @@ public:
         glAttachShader(ID, fragment);
         if(geometryPath != nullptr)
             glAttachShader(ID, geometry);
+        if (!binaryCacheDirectory.empty())
+            glExt.ProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
         glLinkProgram(ID);
         checkCompileErrors(ID, "PROGRAM");
+        cacheUniforms();
+        saveBinary(key);
+        built(buildBegin, false);
         // delete the shaders as they're linked into our program now and no longer necessary
         glDeleteShader(vertex);
         glDeleteShader(fragment);
@@ -97,72 +163,388 @@ public:
             glDeleteShader(geometry);
 
     }
+    // constructor generates a compute shader program on the fly (OpenGL 4.3)
+    // ------------------------------------------------------------------------
+    Shader(const char* computePath)
+    {
+        sourcePaths = { computePath };
+        // 1. retrieve the compute source code from filePath
+        std::string computeCode;
+        std::ifstream cShaderFile;
+        cShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
+        try 
+        {
+            cShaderFile.open(computePath);
+            std::stringstream cShaderStream;
+            cShaderStream << cShaderFile.rdbuf();
+            cShaderFile.close();
+            computeCode = cShaderStream.str();
+        }
+        catch (std::ifstream::failure& e)
+        {
+            std::cout << computePath << std::endl;
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
+        }
+        std::chrono::steady_clock::time_point buildBegin = std::chrono::steady_clock::now();
+        uint64_t key = binaryKey({ computeCode });
+        if (loadBinary(key))
+        {
+            built(buildBegin, true);
+            return;
+        }
+        const char* cShaderCode = computeCode.c_str();
+        // 2. compile shader
+        unsigned int compute = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(compute, 1, &cShaderCode, NULL);
+        glCompileShader(compute);
+        checkCompileErrors(compute, "COMPUTE");
+        // shader Program
+        ID = glCreateProgram();
+        glAttachShader(ID, compute);
+        if (!binaryCacheDirectory.empty())
+            glExt.ProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(ID);
+        checkCompileErrors(ID, "PROGRAM");
+        cacheUniforms();
+        saveBinary(key);
+        built(buildBegin, false);
+        glDeleteShader(compute);
+    }
+    // source files of the program (vertex, fragment and geometry, or compute)
+    // ------------------------------------------------------------------------
+    const std::vector<std::string>& sources() const
+    {
+        return sourcePaths;
+    }
+    // the same program built again from the current content of its source files (on the thread whose context is current)
+    // ------------------------------------------------------------------------
+    std::unique_ptr<Shader> rebuild() const
+    {
+        if (sourcePaths.size() == 1)
+            return std::make_unique<Shader>(sourcePaths[0].c_str());
+        return std::make_unique<Shader>(sourcePaths[0].c_str(), sourcePaths[1].c_str(), sourcePaths.size() > 2 ? sourcePaths[2].c_str() : nullptr, sourcePreamble);
+    }
+    // exchanges the programs (and their uniform locations) of the two shaders, e.g. to put a rebuilt program in place
+    // ------------------------------------------------------------------------
+    void swapProgram(Shader& other)
+    {
+        std::swap(ID, other.ID);
+        std::swap(linked, other.linked);
+        std::swap(locations, other.locations);
+    }
     // activate the shader
     // ------------------------------------------------------------------------
     void useProgram() 
     { 
         glUseProgram(ID); 
     }
-    // utility uniform functions
+    // utility uniform functions (by name through the location cache, or by handle)
+    // ------------------------------------------------------------------------
+    UniformHandle uniform(const std::string &name) const
+    {
+        UniformHandle handle;
+        handle.location = location(name);
+        return handle;
+    }
     // ------------------------------------------------------------------------
     void setBool(const std::string &name, bool value) const
     {         
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+        setBool(uniform(name), value); 
+    }
+    void setBool(UniformHandle handle, bool value) const
+    {         
+        glUniform1i(handle.location, (int)value); 
     }
     // ------------------------------------------------------------------------
     void setInt(const std::string &name, int value) const
     { 
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
+        setInt(uniform(name), value); 
+    }
+    void setInt(UniformHandle handle, int value) const
+    { 
+        glUniform1i(handle.location, value); 
     }
     // ------------------------------------------------------------------------
     void setFloat(const std::string &name, float value) const
     { 
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
+        setFloat(uniform(name), value); 
+    }
+    void setFloat(UniformHandle handle, float value) const
+    { 
+        glUniform1f(handle.location, value); 
+    }
+    void setFloatArray(const std::string &name, const float* values, int count) const
+    { 
+        setFloatArray(uniform(name), values, count); 
+    }
+    void setFloatArray(UniformHandle handle, const float* values, int count) const
+    { 
+        glUniform1fv(handle.location, count, values); 
     }
     // ------------------------------------------------------------------------
     void setVec2(const std::string &name, const glm::vec2 &value) const
     { 
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        setVec2(uniform(name), value); 
+    }
+    void setVec2(UniformHandle handle, const glm::vec2 &value) const
+    { 
+        glUniform2fv(handle.location, 1, &value[0]); 
     }
     void setVec2(const std::string &name, float x, float y) const
     { 
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y); 
+        glUniform2f(location(name), x, y); 
+    }
+    void setIVec2Array(const std::string &name, const glm::ivec2* values, int count) const
+    { 
+        setIVec2Array(uniform(name), values, count); 
+    }
+    void setIVec2Array(UniformHandle handle, const glm::ivec2* values, int count) const
+    { 
+        glUniform2iv(handle.location, count, &values[0][0]); 
     }
     // ------------------------------------------------------------------------
     void setVec3(const std::string &name, const glm::vec3 &value) const
     { 
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        setVec3(uniform(name), value); 
+    }
+    void setVec3(UniformHandle handle, const glm::vec3 &value) const
+    { 
+        glUniform3fv(handle.location, 1, &value[0]); 
     }
     void setVec3(const std::string &name, float x, float y, float z) const
     { 
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z); 
+        glUniform3f(location(name), x, y, z); 
+    }
+    void setVec3Array(const std::string &name, const glm::vec3* values, int count) const
+    { 
+        setVec3Array(uniform(name), values, count); 
+    }
+    void setVec3Array(UniformHandle handle, const glm::vec3* values, int count) const
+    { 
+        glUniform3fv(handle.location, count, &values[0][0]); 
+    }
+    void setIVec3(const std::string &name, int x, int y, int z) const
+    { 
+        glUniform3i(location(name), x, y, z); 
     }
     // ------------------------------------------------------------------------
     void setVec4(const std::string &name, const glm::vec4 &value) const
     { 
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        setVec4(uniform(name), value); 
+    }
+    void setVec4(UniformHandle handle, const glm::vec4 &value) const
+    { 
+        glUniform4fv(handle.location, 1, &value[0]); 
+    }
+    void setVec4Array(const std::string &name, const glm::vec4* values, int count) const
+    { 
+        setVec4Array(uniform(name), values, count); 
+    }
+    void setVec4Array(UniformHandle handle, const glm::vec4* values, int count) const
+    { 
+        glUniform4fv(handle.location, count, &values[0][0]); 
     }
     void setVec4(const std::string &name, float x, float y, float z, float w) 
     { 
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w); 
+        glUniform4f(location(name), x, y, z, w); 
     }
     // ------------------------------------------------------------------------
     void setMat2(const std::string &name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix2fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat3(const std::string &name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat4(const std::string &name, const glm::mat4 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setMat4(uniform(name), mat);
+    }
+    void setMat4(UniformHandle handle, const glm::mat4 &mat) const
+    {
+        glUniformMatrix4fv(handle.location, 1, GL_FALSE, &mat[0][0]);
     }
 
 private:
+    static inline std::string binaryCacheDirectory; // empty: programs are always compiled
+    static const uint32_t BINARY_CACHE_VERSION = 1;
+
+    // header of a cached program binary, followed by the binary
+    struct BinaryHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t key;
+        uint32_t format;
+        uint32_t length;
+    };
+
+    std::vector<std::string> sourcePaths;
+    std::string sourcePreamble;
+    mutable std::unordered_map<std::string, GLint> locations; // uniform name -> location, filled after link
+
+    // utility function for the key of a program in the binary cache: FNV-1a of the stage sources and of the driver
+    // ------------------------------------------------------------------------
+    static uint64_t binaryKey(const std::vector<std::string>& sources)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        auto add = [&hash](const std::string& text) {
+            for (unsigned char c : text)
+            {
+                hash ^= c;
+                hash *= 1099511628211ull;
+            }
+            hash ^= 0xFF; // separator, so that moving text between stages changes the key
+            hash *= 1099511628211ull;
+        };
+        for (const std::string& source : sources)
+            add(source);
+        for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+        {
+            const GLubyte* value = glGetString(name);
+            add(value ? (const char*)value : "");
+        }
+        add(std::to_string(BINARY_CACHE_VERSION));
+        return hash;
+    }
+    static std::string binaryPath(uint64_t key)
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+        return (std::filesystem::path(binaryCacheDirectory) / name).string();
+    }
+    // utility function for loading the program from the binary cache; false (and no program) if it is missing or refused
+    // ------------------------------------------------------------------------
+    bool loadBinary(uint64_t key)
+    {
+        if (binaryCacheDirectory.empty())
+            return false;
+        std::string path = binaryPath(key);
+        std::error_code error;
+        uintmax_t fileSize = std::filesystem::file_size(path, error);
+        if (error || fileSize < sizeof(BinaryHeader))
+            return false;
+        std::ifstream file(path, std::ios::binary);
+        BinaryHeader header;
+        if (!file.read((char*)&header, sizeof(header)) || std::memcmp(header.magic, "PRG1", 4) != 0 || header.version != BINARY_CACHE_VERSION
+            || header.key != key)
+            return false;
+        // a truncated or corrupt file must not make us allocate the length it claims
+        if (header.length == 0 || header.length != fileSize - sizeof(BinaryHeader))
+            return false;
+        std::vector<char> binary(header.length);
+        if (!file.read(binary.data(), header.length))
+            return false;
+        ID = glCreateProgram();
+        glExt.ProgramBinary(ID, header.format, binary.data(), (GLsizei)header.length);
+        GLint success = 0;
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            // binary format of another driver version: compiled again (and stored again) by the caller
+            while (glGetError() != GL_NO_ERROR) {}
+            glDeleteProgram(ID);
+            ID = 0;
+            return false;
+        }
+        cacheUniforms();
+        linked = true;
+        return true;
+    }
+    // utility function for storing the linked program in the binary cache (written to a temporary file, then renamed)
+    // ------------------------------------------------------------------------
+    void saveBinary(uint64_t key) const
+    {
+        if (binaryCacheDirectory.empty())
+            return;
+        GLint success = 0, length = 0;
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (!success || length <= 0)
+            return;
+        std::vector<char> binary(length);
+        GLsizei written = 0;
+        GLenum format = 0;
+        glExt.GetProgramBinary(ID, length, &written, &format, binary.data());
+        BinaryHeader header = { { 'P', 'R', 'G', '1' }, BINARY_CACHE_VERSION, key, format, (uint32_t)written };
+        std::string path = binaryPath(key), temporary = path + ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+            file.write((const char*)&header, sizeof(header));
+            file.write(binary.data(), written);
+            if (!file)
+                return;
+        }
+        std::remove(path.c_str());
+        std::rename(temporary.c_str(), path.c_str());
+    }
+    static void built(std::chrono::steady_clock::time_point begin, bool fromCache)
+    {
+        programsBuilt++;
+        binaryHits += fromCache ? 1 : 0;
+        buildMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    }
+
+    // utility function for caching the location of every active uniform after link: arrays are reachable by their
+    // name, with [0] and by every element; members of uniform blocks have no location and are left out
+    // ------------------------------------------------------------------------
+    void cacheUniforms()
+    {
+        locations.clear();
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<GLchar> buffer(maxLength + 1);
+        for (GLint i = 0; i < count; i++)
+        {
+            GLint size = 0;
+            GLenum type;
+            glGetActiveUniform(ID, (GLuint)i, maxLength + 1, nullptr, &size, &type, buffer.data());
+            std::string name(buffer.data());
+            GLint uniformLocation = glGetUniformLocation(ID, name.c_str());
+            locationQueries++;
+            if (uniformLocation < 0)
+                continue;
+            locations[name] = uniformLocation;
+            if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+            {
+                std::string base = name.substr(0, name.size() - 3);
+                locations[base] = uniformLocation;
+                for (GLint element = 1; element < size; element++)
+                {
+                    std::string elementName = base + "[" + std::to_string(element) + "]";
+                    locations[elementName] = glGetUniformLocation(ID, elementName.c_str());
+                    locationQueries++;
+                }
+            }
+        }
+    }
+    // utility function for the location of a uniform: from the cache, else asked to the program once and remembered
+    // ------------------------------------------------------------------------
+    GLint location(const std::string &name) const
+    {
+        auto cached = locations.find(name);
+        if (cached != locations.end())
+            return cached->second;
+        GLint uniformLocation = glGetUniformLocation(ID, name.c_str());
+        locationQueries++;
+        locations[name] = uniformLocation;
+        return uniformLocation;
+    }
+    // utility function for adding defines/extensions after the #version directive (which must stay the first line)
+    // ------------------------------------------------------------------------
+    static std::string insertPreamble(const std::string& code, const std::string& preamble)
+    {
+        if (preamble.empty())
+            return code;
+        size_t versionLineEnd = code.rfind("#version", 0) == 0 ? code.find('\n') : std::string::npos;
+        if (versionLineEnd == std::string::npos)
+            return preamble + "\n" + code;
+        return code.substr(0, versionLineEnd + 1) + preamble + "\n" + code.substr(versionLineEnd + 1);
+    }
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type)
@@ -181,6 +563,7 @@ private:
         else
         {
             glGetProgramiv(shader, GL_LINK_STATUS, &success);
+            linked = success != 0;
             if(!success)
             {
                 glGetProgramInfoLog(shader, 1024, NULL, infoLog);
@@ -0,0 +1,269 @@
+#ifndef SHADER_RELOADER_H
+#define SHADER_RELOADER_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <shader.h>
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+// Hot reload of the programs whose source files change in the shader directory. A background thread waits for
+// changes (inotify on Linux, a change notification on Windows, a timestamp scan every POLL_MILLISECONDS elsewhere)
+// and rebuilds the programs of the modified files in a hidden context shared with the window, so the frames keep
+// going while the driver compiles. update(), between frames on the GL thread, swaps the rebuilt programs in; a program
+// that does not compile or link is dropped and the old one stays.
+class ShaderReloader
+{
+    public:
+        static constexpr int POLL_MILLISECONDS = 250; // longest wait for a change before checking for the stop request
+        static constexpr int SETTLE_MILLISECONDS = 50; // editors may write a file in several steps
+
+        unsigned int reloads = 0; // programs swapped so far
+        std::atomic<unsigned int> failures{ 0 }; // rebuilds that did not compile or link (the old program stayed)
+
+        ShaderReloader(GLFWwindow* window, const std::string& directory) : directory(directory)
+        {
+            glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+            context = glfwCreateWindow(1, 1, "shader compiler", nullptr, window); // same hints as the window, shared objects
+            glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+            if (context == nullptr)
+            {
+                std::cout << "shaders: cannot create a shared context, hot reload is off" << std::endl;
+                return;
+            }
+            openWatch();
+            worker = std::thread([this]() { run(); });
+            std::cout << "shaders: watching " << directory << " (" << watchMethod() << ")" << std::endl;
+        }
+
+        ~ShaderReloader()
+        {
+            stopping = true;
+            if (worker.joinable())
+                worker.join();
+            closeWatch();
+            for (Rebuilt& rebuilt : ready)
+                glDeleteProgram(rebuilt.replacement->ID);
+            if (context)
+                glfwDestroyWindow(context);
+        }
+
+        ShaderReloader(const ShaderReloader&) = delete;
+        ShaderReloader& operator=(const ShaderReloader&) = delete;
+
+        // rebuilds the shader whenever one of its source files changes
+        void watch(Shader& shader)
+        {
+            Watched watched;
+            watched.shader = &shader;
+            for (const std::string& path : shader.sources())
+                watched.times.push_back(modificationTime(path));
+            std::lock_guard<std::mutex> lock(mutex);
+            shaders.push_back(watched);
+        }
+
+        // puts the programs rebuilt since the last call in place of the old ones (deleted); the number of swapped programs
+        unsigned int update()
+        {
+            std::vector<Rebuilt> rebuilt;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                rebuilt.swap(ready);
+            }
+            for (Rebuilt& program : rebuilt)
+            {
+                program.target->swapProgram(*program.replacement);
+                glDeleteProgram(program.replacement->ID);
+                std::cout << "shaders: " << program.target->sources().back() << " reloaded (program rebuilt in " << program.milliseconds << " ms)" << std::endl;
+            }
+            reloads += (unsigned int)rebuilt.size();
+            return (unsigned int)rebuilt.size();
+        }
+
+    private:
+        struct Watched
+        {
+            Shader* shader = nullptr;
+            std::vector<std::filesystem::file_time_type> times; // of the source files, at the last build
+        };
+
+        struct Rebuilt
+        {
+            Shader* target = nullptr;
+            std::unique_ptr<Shader> replacement;
+            double milliseconds = 0.0;
+        };
+
+        std::string directory;
+        GLFWwindow* context = nullptr;
+        std::thread worker;
+        std::atomic<bool> stopping{ false };
+        std::mutex mutex; // guards shaders and ready
+        std::vector<Watched> shaders;
+        std::vector<Rebuilt> ready;
+#ifdef _WIN32
+        HANDLE notification = INVALID_HANDLE_VALUE;
+#elif defined(__linux__)
+        int notification = -1;
+#endif
+
+        static std::filesystem::file_time_type modificationTime(const std::string& path)
+        {
+            std::error_code error;
+            std::filesystem::file_time_type time = std::filesystem::last_write_time(path, error);
+            return error ? std::filesystem::file_time_type::min() : time;
+        }
+
+        void run()
+        {
+            glfwMakeContextCurrent(context);
+            while (!stopping)
+            {
+                if (!waitForChange())
+                    continue;
+                std::this_thread::sleep_for(std::chrono::milliseconds(SETTLE_MILLISECONDS));
+                rebuildChanged();
+            }
+            glfwMakeContextCurrent(nullptr);
+        }
+
+        // programs with a source file newer than their last build, compiled and linked one after the other
+        void rebuildChanged()
+        {
+            std::vector<Watched> snapshot;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                snapshot = shaders;
+            }
+            for (size_t s = 0; s < snapshot.size(); s++)
+            {
+                const std::vector<std::string>& paths = snapshot[s].shader->sources();
+                std::vector<std::filesystem::file_time_type> times;
+                for (const std::string& path : paths)
+                    times.push_back(modificationTime(path));
+                if (times == snapshot[s].times)
+                    continue;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    shaders[s].times = times;
+                }
+                std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+                std::unique_ptr<Shader> replacement = snapshot[s].shader->rebuild();
+                glFinish(); // the program is complete before the GL thread uses it
+                double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+                if (!replacement->linked)
+                {
+                    glDeleteProgram(replacement->ID);
+                    failures++;
+                    std::cout << "shaders: " << paths.back() << " failed to build, the old program stays in use" << std::endl;
+                    continue;
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                for (Rebuilt& pending : ready)
+                    if (pending.target == snapshot[s].shader)
+                    {
+                        // rebuilt twice before a swap: the newer program wins
+                        glDeleteProgram(pending.replacement->ID);
+                        pending.replacement = std::move(replacement);
+                        pending.milliseconds = milliseconds;
+                    }
+                if (replacement)
+                    ready.push_back({ snapshot[s].shader, std::move(replacement), milliseconds });
+            }
+        }
+
+#ifdef _WIN32
+        void openWatch()
+        {
+            notification = FindFirstChangeNotificationA(directory.c_str(), FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+        }
+        void closeWatch()
+        {
+            if (notification != INVALID_HANDLE_VALUE)
+                FindCloseChangeNotification(notification);
+        }
+        bool waitForChange()
+        {
+            if (notification == INVALID_HANDLE_VALUE)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(POLL_MILLISECONDS));
+                return true;
+            }
+            if (WaitForSingleObject(notification, POLL_MILLISECONDS) != WAIT_OBJECT_0)
+                return false;
+            FindNextChangeNotification(notification);
+            return true;
+        }
+        const char* watchMethod() const
+        {
+            return notification != INVALID_HANDLE_VALUE ? "change notifications" : "polling";
+        }
+#elif defined(__linux__)
+        void openWatch()
+        {
+            notification = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (notification >= 0 && inotify_add_watch(notification, directory.c_str(), IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE) < 0)
+            {
+                close(notification);
+                notification = -1;
+            }
+        }
+        void closeWatch()
+        {
+            if (notification >= 0)
+                close(notification);
+        }
+        bool waitForChange()
+        {
+            if (notification < 0)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(POLL_MILLISECONDS));
+                return true;
+            }
+            pollfd descriptor = { notification, POLLIN, 0 };
+            if (poll(&descriptor, 1, POLL_MILLISECONDS) <= 0)
+                return false;
+            // the events only wake the thread up, the timestamps tell which programs changed
+            char events[4096];
+            while (read(notification, events, sizeof(events)) > 0) {}
+            return true;
+        }
+        const char* watchMethod() const
+        {
+            return notification >= 0 ? "inotify" : "polling";
+        }
+#else
+        void openWatch() {}
+        void closeWatch() {}
+        bool waitForChange()
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(POLL_MILLISECONDS));
+            return true;
+        }
+        const char* watchMethod() const
+        {
+            return "polling";
+        }
+#endif
+};
+#endif
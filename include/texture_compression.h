@@ -0,0 +1,494 @@
+#ifndef TEXTURE_COMPRESSION_H
+#define TEXTURE_COMPRESSION_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <thread_pool.h>
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <mutex>
+
+// CPU encoders for the BPTC block formats (16 bytes per 4x4 block):
+// - BC7 mode 6: one subset, RGBA endpoints of 7 bits plus a shared p-bit, 4-bit indices (8 bpp images, LDR)
+// - BC6H mode 11: one region, 10-bit unsigned half endpoints, 4-bit indices (half float images, HDR)
+// Endpoints start from the principal axis of the block colors and are refined by least squares on the chosen
+// indices; every candidate is scored with the exact decoder arithmetic. Blocks are encoded in parallel on the pool.
+
+const int BPTC_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// mip level of an image, pixels row by row (RGBA8 or RGB half float)
+template <typename T>
+struct MipLevel
+{
+    int width = 0;
+    int height = 0;
+    std::vector<T> pixels;
+};
+
+typedef MipLevel<glm::u8vec4> MipLevel8;
+typedef MipLevel<glm::u16vec3> MipLevelHalf; // half float bit patterns
+
+// error of an encoded image
+struct CompressionQuality
+{
+    double squaredError = 0.0; // summed on the RGB channels (8-bit units for BC7, tone mapped 8-bit units for BC6H)
+    size_t samples = 0;
+
+    double psnr() const
+    {
+        if (samples == 0 || squaredError <= 0.0)
+            return 99.0;
+        return 10.0 * std::log10(255.0 * 255.0 / (squaredError / samples));
+    }
+};
+
+// little endian bit writer of a 128-bit block
+struct BlockWriter
+{
+    uint8_t bytes[16] = {};
+    int position = 0;
+
+    void write(uint32_t value, int bits)
+    {
+        for (int i = 0; i < bits; i++, position++)
+            if (value & (1u << i))
+                bytes[position >> 3] |= (uint8_t)(1u << (position & 7));
+    }
+};
+
+inline size_t bptcBlockCount(int width, int height)
+{
+    return (size_t)((width + 3) / 4) * (size_t)((height + 3) / 4);
+}
+
+// 4x4 block at (bx, by), edges clamped
+template <typename T>
+inline void gatherBlock(const MipLevel<T>& level, int bx, int by, T block[16])
+{
+    for (int y = 0; y < 4; y++)
+        for (int x = 0; x < 4; x++)
+        {
+            int px = std::min(bx * 4 + x, level.width - 1);
+            int py = std::min(by * 4 + y, level.height - 1);
+            block[y * 4 + x] = level.pixels[(size_t)py * level.width + px];
+        }
+}
+
+// principal axis of points (power iteration on the covariance), returns the mean
+template <int N>
+inline void principalAxis(const float points[16][N], float mean[N], float axis[N])
+{
+    for (int c = 0; c < N; c++)
+    {
+        mean[c] = 0.0f;
+        for (int i = 0; i < 16; i++)
+            mean[c] += points[i][c];
+        mean[c] /= 16.0f;
+    }
+    float covariance[N][N] = {};
+    for (int i = 0; i < 16; i++)
+        for (int a = 0; a < N; a++)
+            for (int b = 0; b < N; b++)
+                covariance[a][b] += (points[i][a] - mean[a]) * (points[i][b] - mean[b]);
+    for (int c = 0; c < N; c++)
+        axis[c] = 1.0f;
+    for (int iteration = 0; iteration < 8; iteration++)
+    {
+        float next[N] = {};
+        float length = 0.0f;
+        for (int a = 0; a < N; a++)
+        {
+            for (int b = 0; b < N; b++)
+                next[a] += covariance[a][b] * axis[b];
+            length += next[a] * next[a];
+        }
+        if (length < 1e-12f)
+            break;
+        length = std::sqrt(length);
+        for (int c = 0; c < N; c++)
+            axis[c] = next[c] / length;
+    }
+}
+
+// endpoints along the axis through the extreme projections
+template <int N>
+inline void axisEndpoints(const float points[16][N], const float mean[N], const float axis[N], float low[N], float high[N])
+{
+    float minimum = 1e30f, maximum = -1e30f;
+    for (int i = 0; i < 16; i++)
+    {
+        float t = 0.0f;
+        for (int c = 0; c < N; c++)
+            t += (points[i][c] - mean[c]) * axis[c];
+        minimum = std::min(minimum, t);
+        maximum = std::max(maximum, t);
+    }
+    for (int c = 0; c < N; c++)
+    {
+        low[c] = mean[c] + axis[c] * minimum;
+        high[c] = mean[c] + axis[c] * maximum;
+    }
+}
+
+// least squares endpoints for fixed interpolation weights (false if the indices are all equal)
+template <int N>
+inline bool fitEndpoints(const float points[16][N], const int indices[16], float low[N], float high[N])
+{
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax[N] = {}, bx[N] = {};
+    for (int i = 0; i < 16; i++)
+    {
+        float w = BPTC_WEIGHTS[indices[i]] / 64.0f;
+        float a = 1.0f - w;
+        aa += a * a;
+        ab += a * w;
+        bb += w * w;
+        for (int c = 0; c < N; c++)
+        {
+            ax[c] += a * points[i][c];
+            bx[c] += w * points[i][c];
+        }
+    }
+    float determinant = aa * bb - ab * ab;
+    if (std::fabs(determinant) < 1e-6f)
+        return false;
+    for (int c = 0; c < N; c++)
+    {
+        low[c] = (ax[c] * bb - bx[c] * ab) / determinant;
+        high[c] = (bx[c] * aa - ax[c] * ab) / determinant;
+    }
+    return true;
+}
+
+// BC7 mode 6
+// ------------------------------------------------------------------------
+struct BC7Candidate
+{
+    int endpoints[2][4]; // 7-bit values
+    int pbits[2];
+    int indices[16];
+    int error;
+};
+
+inline int bc7Endpoint(int value7, int pbit)
+{
+    return (value7 << 1) | pbit;
+}
+
+// quantizes the float endpoints with the given p-bits and picks the best index of every pixel
+inline void bc7Evaluate(const glm::u8vec4 block[16], const float low[4], const float high[4], int p0, int p1, BC7Candidate& candidate)
+{
+    int pbits[2] = { p0, p1 };
+    const float* ends[2] = { low, high };
+    int palette[16][4];
+    for (int e = 0; e < 2; e++)
+    {
+        candidate.pbits[e] = pbits[e];
+        for (int c = 0; c < 4; c++)
+            candidate.endpoints[e][c] = glm::clamp((int)std::lround((ends[e][c] - pbits[e]) / 2.0f), 0, 127);
+    }
+    for (int i = 0; i < 16; i++)
+        for (int c = 0; c < 4; c++)
+        {
+            int e0 = bc7Endpoint(candidate.endpoints[0][c], pbits[0]);
+            int e1 = bc7Endpoint(candidate.endpoints[1][c], pbits[1]);
+            palette[i][c] = ((64 - BPTC_WEIGHTS[i]) * e0 + BPTC_WEIGHTS[i] * e1 + 32) >> 6;
+        }
+    candidate.error = 0;
+    for (int p = 0; p < 16; p++)
+    {
+        int best = 0, bestError = 1 << 30;
+        for (int i = 0; i < 16; i++)
+        {
+            int error = 0;
+            for (int c = 0; c < 4; c++)
+            {
+                int d = palette[i][c] - block[p][c];
+                error += d * d;
+            }
+            if (error < bestError)
+            {
+                bestError = error;
+                best = i;
+            }
+        }
+        candidate.indices[p] = best;
+        candidate.error += bestError;
+    }
+}
+
+inline void bc7EncodeBlock(const glm::u8vec4 block[16], uint8_t output[16], CompressionQuality& quality)
+{
+    float points[16][4];
+    for (int i = 0; i < 16; i++)
+        for (int c = 0; c < 4; c++)
+            points[i][c] = block[i][c];
+    float mean[4], axis[4], low[4], high[4];
+    principalAxis<4>(points, mean, axis);
+    axisEndpoints<4>(points, mean, axis, low, high);
+
+    BC7Candidate best, candidate;
+    best.error = 1 << 30;
+    for (int iteration = 0; iteration < 2; iteration++)
+    {
+        for (int p = 0; p < 4; p++)
+        {
+            bc7Evaluate(block, low, high, p & 1, p >> 1, candidate);
+            if (candidate.error < best.error)
+                best = candidate;
+        }
+        if (best.error == 0 || !fitEndpoints<4>(points, best.indices, low, high))
+            break;
+    }
+
+    // the anchor (first pixel) index must have its high bit clear
+    if (best.indices[0] & 8)
+    {
+        for (int c = 0; c < 4; c++)
+            std::swap(best.endpoints[0][c], best.endpoints[1][c]);
+        std::swap(best.pbits[0], best.pbits[1]);
+        for (int i = 0; i < 16; i++)
+            best.indices[i] = 15 - best.indices[i];
+    }
+    BlockWriter writer;
+    writer.write(1u << 6, 7); // mode 6
+    for (int c = 0; c < 4; c++)
+    {
+        writer.write(best.endpoints[0][c], 7);
+        writer.write(best.endpoints[1][c], 7);
+    }
+    writer.write(best.pbits[0], 1);
+    writer.write(best.pbits[1], 1);
+    for (int i = 0; i < 16; i++)
+        writer.write(best.indices[i], i == 0 ? 3 : 4);
+    std::memcpy(output, writer.bytes, 16);
+
+    for (int p = 0; p < 16; p++)
+        for (int c = 0; c < 3; c++)
+        {
+            int e0 = bc7Endpoint(best.endpoints[0][c], best.pbits[0]);
+            int e1 = bc7Endpoint(best.endpoints[1][c], best.pbits[1]);
+            int d = (((64 - BPTC_WEIGHTS[best.indices[p]]) * e0 + BPTC_WEIGHTS[best.indices[p]] * e1 + 32) >> 6) - block[p][c];
+            quality.squaredError += d * d;
+        }
+    quality.samples += 16 * 3;
+}
+
+// BC6H mode 11 (unsigned half)
+// ------------------------------------------------------------------------
+
+// decoder arithmetic: 10-bit endpoint -> 16-bit interpolation space -> half bit pattern
+inline int bc6hUnquantize(int value10)
+{
+    if (value10 == 0)
+        return 0;
+    if (value10 == 1023)
+        return 0xFFFF;
+    return ((value10 << 16) + 0x8000) >> 10;
+}
+
+inline int bc6hFinish(int value16)
+{
+    return (value16 * 31) >> 6;
+}
+
+// half bit pattern -> tone mapped 8-bit value (error metric of the quality report)
+inline float bc6hToneMapped(int half)
+{
+    float value = glm::unpackHalf1x16((uint16_t)half);
+    return 255.0f * value / (1.0f + value);
+}
+
+inline void bc6hEncodeBlock(const glm::u16vec3 block[16], uint8_t output[16], CompressionQuality& quality)
+{
+    // the half bit patterns are close to logarithmic: endpoints are fit in that space (as the decoder interpolates)
+    float points[16][3];
+    for (int i = 0; i < 16; i++)
+        for (int c = 0; c < 3; c++)
+            points[i][c] = (float)std::min<int>(block[i][c], 0x7BFF);
+    float mean[3], axis[3], low[3], high[3];
+    principalAxis<3>(points, mean, axis);
+    axisEndpoints<3>(points, mean, axis, low, high);
+
+    int bestEndpoints[2][3] = {}, bestIndices[16] = {};
+    long long bestError = -1;
+    for (int iteration = 0; iteration < 2; iteration++)
+    {
+        int endpoints[2][3];
+        const float* ends[2] = { low, high };
+        int palette[16][3];
+        for (int e = 0; e < 2; e++)
+            for (int c = 0; c < 3; c++) // half = (unq * 31) >> 6 and unq = value10 * 64 + 32
+                endpoints[e][c] = glm::clamp((int)std::lround((ends[e][c] * 64.0f / 31.0f - 32.0f) / 64.0f), 0, 1023);
+        for (int i = 0; i < 16; i++)
+            for (int c = 0; c < 3; c++)
+            {
+                int e0 = bc6hUnquantize(endpoints[0][c]), e1 = bc6hUnquantize(endpoints[1][c]);
+                palette[i][c] = bc6hFinish(((64 - BPTC_WEIGHTS[i]) * e0 + BPTC_WEIGHTS[i] * e1 + 32) >> 6);
+            }
+        int indices[16];
+        long long error = 0;
+        for (int p = 0; p < 16; p++)
+        {
+            long long best = -1;
+            for (int i = 0; i < 16; i++)
+            {
+                long long e = 0;
+                for (int c = 0; c < 3; c++)
+                {
+                    long long d = palette[i][c] - (long long)points[p][c];
+                    e += d * d;
+                }
+                if (best < 0 || e < best)
+                {
+                    best = e;
+                    indices[p] = i;
+                }
+            }
+            error += best;
+        }
+        if (bestError < 0 || error < bestError)
+        {
+            bestError = error;
+            std::memcpy(bestEndpoints, endpoints, sizeof(endpoints));
+            std::memcpy(bestIndices, indices, sizeof(indices));
+        }
+        if (bestError == 0 || !fitEndpoints<3>(points, bestIndices, low, high))
+            break;
+    }
+
+    if (bestIndices[0] & 8)
+    {
+        for (int c = 0; c < 3; c++)
+            std::swap(bestEndpoints[0][c], bestEndpoints[1][c]);
+        for (int i = 0; i < 16; i++)
+            bestIndices[i] = 15 - bestIndices[i];
+    }
+    BlockWriter writer;
+    writer.write(0x03, 5); // mode 11
+    for (int e = 0; e < 2; e++)
+        for (int c = 0; c < 3; c++)
+            writer.write(bestEndpoints[e][c], 10);
+    for (int i = 0; i < 16; i++)
+        writer.write(bestIndices[i], i == 0 ? 3 : 4);
+    std::memcpy(output, writer.bytes, 16);
+
+    for (int p = 0; p < 16; p++)
+        for (int c = 0; c < 3; c++)
+        {
+            int e0 = bc6hUnquantize(bestEndpoints[0][c]), e1 = bc6hUnquantize(bestEndpoints[1][c]);
+            int half = bc6hFinish(((64 - BPTC_WEIGHTS[bestIndices[p]]) * e0 + BPTC_WEIGHTS[bestIndices[p]] * e1 + 32) >> 6);
+            double d = bc6hToneMapped(half) - bc6hToneMapped(block[p][c]);
+            quality.squaredError += d * d;
+        }
+    quality.samples += 16 * 3;
+}
+
+// Encodes a level, rows of blocks in parallel (safe from a pool job: the caller takes part)
+// ------------------------------------------------------------------------
+template <typename T, typename Encoder>
+inline std::vector<uint8_t> bptcEncodeLevel(const MipLevel<T>& level, Encoder encodeBlock, ThreadPool& pool, CompressionQuality& quality)
+{
+    int blocksX = (level.width + 3) / 4, blocksY = (level.height + 3) / 4;
+    std::vector<uint8_t> blocks((size_t)blocksX * blocksY * 16);
+    std::mutex qualityMutex;
+    pool.parallelFor(0, (size_t)blocksY, [&](size_t begin, size_t end) {
+        CompressionQuality part;
+        T block[16];
+        for (size_t by = begin; by < end; by++)
+            for (int bx = 0; bx < blocksX; bx++)
+            {
+                gatherBlock(level, bx, (int)by, block);
+                encodeBlock(block, &blocks[(by * blocksX + bx) * 16], part);
+            }
+        std::lock_guard<std::mutex> lock(qualityMutex);
+        quality.squaredError += part.squaredError;
+        quality.samples += part.samples;
+    });
+    return blocks;
+}
+
+inline std::vector<uint8_t> encodeBC7(const MipLevel8& level, ThreadPool& pool, CompressionQuality& quality)
+{
+    return bptcEncodeLevel(level, bc7EncodeBlock, pool, quality);
+}
+
+inline std::vector<uint8_t> encodeBC6H(const MipLevelHalf& level, ThreadPool& pool, CompressionQuality& quality)
+{
+    return bptcEncodeLevel(level, bc6hEncodeBlock, pool, quality);
+}
+
+// Mip chains (2x2 box filter, odd sizes clamp); sRGB levels are averaged in linear space
+// ------------------------------------------------------------------------
+inline float srgbToLinear(float value)
+{
+    return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+inline float linearToSrgb(float value)
+{
+    return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+}
+
+inline MipLevel8 downsample(const MipLevel8& level, bool srgb)
+{
+    static float toLinear[256];
+    static bool tableReady = false;
+    if (!tableReady)
+    {
+        for (int i = 0; i < 256; i++)
+            toLinear[i] = srgbToLinear(i / 255.0f);
+        tableReady = true;
+    }
+    MipLevel8 next;
+    next.width = std::max(1, level.width / 2);
+    next.height = std::max(1, level.height / 2);
+    next.pixels.resize((size_t)next.width * next.height);
+    for (int y = 0; y < next.height; y++)
+        for (int x = 0; x < next.width; x++)
+        {
+            glm::vec4 sum(0.0f);
+            for (int sy = 0; sy < 2; sy++)
+                for (int sx = 0; sx < 2; sx++)
+                {
+                    glm::u8vec4 texel = level.pixels[(size_t)std::min(y * 2 + sy, level.height - 1) * level.width + std::min(x * 2 + sx, level.width - 1)];
+                    for (int c = 0; c < 3; c++)
+                        sum[c] += srgb ? toLinear[texel[c]] : texel[c] / 255.0f;
+                    sum.a += texel.a / 255.0f;
+                }
+            sum *= 0.25f;
+            glm::u8vec4& out = next.pixels[(size_t)y * next.width + x];
+            for (int c = 0; c < 3; c++)
+                out[c] = (uint8_t)std::lround(255.0f * glm::clamp(srgb ? linearToSrgb(sum[c]) : sum[c], 0.0f, 1.0f));
+            out.a = (uint8_t)std::lround(255.0f * sum.a);
+        }
+    return next;
+}
+
+inline MipLevelHalf downsample(const MipLevelHalf& level)
+{
+    MipLevelHalf next;
+    next.width = std::max(1, level.width / 2);
+    next.height = std::max(1, level.height / 2);
+    next.pixels.resize((size_t)next.width * next.height);
+    for (int y = 0; y < next.height; y++)
+        for (int x = 0; x < next.width; x++)
+        {
+            glm::vec3 sum(0.0f);
+            for (int sy = 0; sy < 2; sy++)
+                for (int sx = 0; sx < 2; sx++)
+                {
+                    glm::u16vec3 texel = level.pixels[(size_t)std::min(y * 2 + sy, level.height - 1) * level.width + std::min(x * 2 + sx, level.width - 1)];
+                    for (int c = 0; c < 3; c++)
+                        sum[c] += glm::unpackHalf1x16(texel[c]);
+                }
+            for (int c = 0; c < 3; c++)
+                next.pixels[(size_t)y * next.width + x][c] = glm::packHalf1x16(sum[c] * 0.25f);
+        }
+    return next;
+}
+#endif
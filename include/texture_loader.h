@@ -0,0 +1,582 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <glad/glad.h>
+#include <stb/stb_image.h>
+
+#include <thread_pool.h>
+#include <gl_ext.h>
+#include <ktx2.h>
+#include <texture_compression.h>
+#include <texture_residency.h>
+#include <environment_map.h>
+
+#include <vector>
+#include <string>
+#include <future>
+#include <memory>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <filesystem>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+
+// Loads 2D textures and cubemaps. The texture objects are created at once with a 1x1 placeholder texel, so the first
+// frame can be drawn right away; the images are decoded on the thread pool (stb_image allocates the pixels, which the job
+// then copies into a mapped pixel unpack buffer; environment maps are converted straight into it), and update() (once
+// per frame on the GL thread) uploads every texture whose images are all decoded.
+// With async = false every image is decoded and uploaded before load() returns.
+// With compression (and BPTC support) the jobs produce BC7 (8-bit images) or BC6H (HDR images) blocks instead:
+// the first run encodes them on the pool and stores them in a KTX2 file of the cache directory, named after the hash
+// of the source file, and the later runs upload the mapped cache file directly.
+// With streaming on top, compressed 2D textures upload only their small levels and the residency manager streams the
+// finer ones from the cache file as the scene needs them (uncompressed textures stay whole).
+class TextureLoader
+{
+    public:
+        static const uint64_t CACHE_VERSION = 1; // part of the cache key, changes when the encoders change
+
+        unsigned long long generation = 0; // increases every time a texture gets its real images
+        double loadMilliseconds = 0.0; // from the first load to the last upload
+        size_t compressedBytes = 0; // video memory of the compressed textures
+        size_t uncompressedBytes = 0; // the same textures as uploaded without compression
+        std::unique_ptr<TextureResidency> streaming; // null unless enableStreaming() is called
+
+        TextureLoader(ThreadPool& pool, bool async = true, bool compression = false, const std::string& cacheDirectory = "cache/textures")
+            : pool(pool), async(async), compression(compression && glExt.textureCompressionBPTC), cacheDirectory(cacheDirectory)
+        {
+            if (compression && !glExt.textureCompressionBPTC)
+                std::cout << "textures: BPTC compression not supported, textures are uploaded uncompressed" << std::endl;
+            std::error_code error;
+            if (this->compression && !std::filesystem::create_directories(cacheDirectory, error) && error)
+                std::cout << "textures: cannot create the cache directory " << cacheDirectory << ", compressed textures are not cached" << std::endl;
+        }
+
+        ~TextureLoader()
+        {
+            for (Request& request : requests)
+                for (Image& image : request.images)
+                {
+                    if (image.decoded.valid())
+                        image.decoded.wait();
+                    release(image);
+                }
+        }
+
+        TextureLoader(const TextureLoader&) = delete;
+        TextureLoader& operator=(const TextureLoader&) = delete;
+
+        // streams the mip levels of the compressed 2D textures loaded from now on, within budgetBytes of video memory
+        void enableStreaming(size_t budgetBytes, int residentSize)
+        {
+            if (compression)
+                streaming = std::make_unique<TextureResidency>(pool, budgetBytes, residentSize, async);
+            else
+                std::cout << "textures: streaming needs compressed textures, every texture stays resident" << std::endl;
+        }
+
+        // 2D texture with mipmaps, sRGB when gammaCorrection (1, 3 or 4 components)
+        GLuint load(const std::string& path, bool gammaCorrection)
+        {
+            GLuint texture;
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            Request request;
+            request.texture = texture;
+            request.target = GL_TEXTURE_2D;
+            request.gammaCorrection = gammaCorrection;
+            request.images.resize(1);
+            request.images[0].path = path;
+            request.images[0].target = GL_TEXTURE_2D;
+            submit(request);
+            return texture;
+        }
+
+        // cubemap from its 6 faces (+x, -x, +y, -y, +z, -z), drawn with the placeholder until all of them are decoded
+        GLuint loadCubemap(const std::vector<std::string>& faces)
+        {
+            GLuint texture;
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+            Request request;
+            request.texture = texture;
+            request.target = GL_TEXTURE_CUBE_MAP;
+            request.gammaCorrection = false;
+            request.images.resize(faces.size());
+            for (size_t i = 0; i < faces.size(); i++)
+            {
+                request.images[i].path = faces[i];
+                request.images[i].target = GL_TEXTURE_CUBE_MAP_POSITIVE_X + (GLenum)i;
+            }
+            submit(request);
+            return texture;
+        }
+
+        // cubemap resampled from an equirectangular HDR image (.hdr or .exr), GL_RGB16F if halfFloat else GL_RGB9_E5;
+        // one job loads and converts the image into a single unpack buffer holding the 6 faces
+        GLuint loadEnvironment(const std::string& path, int faceSize, bool halfFloat, float intensity)
+        {
+            GLuint texture;
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+            if (requests.empty() && uploaded == 0)
+                firstLoad = std::chrono::steady_clock::now();
+            const unsigned char placeholder[4] = { 128, 128, 128, 255 };
+            for (GLenum face = 0; face < 6; face++)
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+
+            Request request;
+            request.texture = texture;
+            request.target = GL_TEXTURE_CUBE_MAP;
+            request.images.resize(1);
+            Image& image = request.images[0];
+            image.path = path;
+            image.target = GL_TEXTURE_CUBE_MAP;
+            image.width = image.height = faceSize;
+            image.faces = 6;
+            image.internalFormat = halfFloat ? GL_RGB16F : GL_RGB9_E5;
+            image.dataFormat = GL_RGB;
+            image.dataType = halfFloat ? GL_HALF_FLOAT : GL_UNSIGNED_INT_5_9_9_9_REV;
+            size_t bytes = (size_t)faceSize * faceSize * (halfFloat ? 6 : 4) * 6;
+            glGenBuffers(1, &image.unpackBuffer);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, image.unpackBuffer);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+            image.mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            void* destination = image.mapped;
+            launch(image, [this, path, destination, faceSize, halfFloat, intensity]() {
+                std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+                EquirectangularImage source;
+                std::string error;
+                if (destination == nullptr || !loadEquirectangular(path, source, error))
+                {
+                    std::cout << "Environment map failed to load at path: " << path << " (" << error << ")" << std::endl;
+                    return false;
+                }
+                std::chrono::steady_clock::time_point loaded = std::chrono::steady_clock::now();
+                equirectangularToCubemap(source, faceSize, halfFloat, intensity, destination, pool);
+                std::chrono::steady_clock::time_point converted = std::chrono::steady_clock::now();
+                std::cout << "environment " << path << ": " << source.width << "x" << source.height << " read in "
+                          << std::chrono::duration<double, std::milli>(loaded - begin).count() << " ms, 6 faces of " << faceSize << "x" << faceSize << " "
+                          << (halfFloat ? "RGB16F" : "RGB9_E5") << " converted in " << std::chrono::duration<double, std::milli>(converted - loaded).count()
+                          << " ms (" << pool.size() << " threads)" << std::endl;
+                return true;
+            });
+            requests.push_back(std::move(request));
+            if (!async)
+                update();
+            return texture;
+        }
+
+        // uploads the textures whose images are all decoded and the streamed levels; true if any texture changed
+        bool update()
+        {
+            if (streaming && streaming->update())
+                generation++;
+            bool changed = false;
+            for (size_t r = 0; r < requests.size();)
+            {
+                if (!decoded(requests[r]))
+                {
+                    r++;
+                    continue;
+                }
+                upload(requests[r]);
+                requests.erase(requests.begin() + r);
+                changed = true;
+            }
+            if (changed && requests.empty())
+            {
+                loadMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - firstLoad).count();
+                std::cout << "textures: " << uploaded << " decoded and uploaded in " << loadMilliseconds << " ms ("
+                          << (async ? "asynchronous, " + std::to_string(pool.size()) + " threads" : "synchronous") << ")" << std::endl;
+                if (compressedBytes > 0)
+                {
+                    const double megabyte = 1024.0 * 1024.0;
+                    std::streamsize precision = std::cout.precision();
+                    std::cout << "textures: BPTC " << std::fixed << std::setprecision(1) << compressedBytes / megabyte << " MB of video memory instead of "
+                              << uncompressedBytes / megabyte << " MB (" << (double)uncompressedBytes / compressedBytes << "x)"
+                              << std::defaultfloat << std::setprecision(precision) << std::endl;
+                }
+            }
+            return changed;
+        }
+
+        size_t pending() const
+        {
+            return requests.size();
+        }
+
+    private:
+        // block compressed levels of an image, read from the mapped cache file (or kept in memory if it cannot be written)
+        struct CompressedImage
+        {
+            GLenum internalFormat = 0;
+            KTX2File file;
+            std::vector<KTX2File::Level> levels; // largest first
+            std::vector<std::vector<uint8_t>> encoded;
+            size_t uncompressedBytes = 0;
+            std::string report;
+        };
+
+        // one image of a texture: decoded by a job and copied into the mapped unpack buffer, or compressed
+        struct Image
+        {
+            std::string path;
+            GLenum target = GL_TEXTURE_2D; // 2D or cubemap face (or the whole cubemap if faces = 6)
+            int width = 0, height = 0, components = 0;
+            int faces = 1;
+            GLenum internalFormat = 0, dataFormat = 0, dataType = GL_UNSIGNED_BYTE; // from the components if internalFormat = 0
+            GLuint unpackBuffer = 0;
+            void* mapped = nullptr;
+            std::shared_ptr<CompressedImage> compressed;
+            std::future<bool> decoded;
+            bool valid = false; // decoded without errors (set by upload)
+        };
+
+        struct Request
+        {
+            GLuint texture = 0;
+            GLenum target = GL_TEXTURE_2D;
+            bool gammaCorrection = false;
+            std::vector<Image> images;
+        };
+
+        ThreadPool& pool;
+        bool async;
+        bool compression;
+        std::string cacheDirectory;
+        std::vector<Request> requests;
+        std::chrono::steady_clock::time_point firstLoad;
+        unsigned int uploaded = 0;
+
+        void submit(Request& request)
+        {
+            if (requests.empty() && uploaded == 0)
+                firstLoad = std::chrono::steady_clock::now();
+            const unsigned char placeholder[4] = { 128, 128, 128, 255 };
+            for (Image& image : request.images)
+            {
+                glTexImage2D(image.target, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+                if (compression)
+                {
+                    // cubemaps (the skybox) are sampled without mipmaps
+                    image.compressed = std::make_shared<CompressedImage>();
+                    launch(image, [this, path = image.path, compressed = image.compressed, srgb = request.gammaCorrection,
+                                   mipmaps = request.target == GL_TEXTURE_2D]() {
+                        return compressImage(path, srgb, mipmaps, *compressed);
+                    });
+                    continue;
+                }
+                // the header gives the size of the unpack buffer; a job decodes the pixels (in a buffer of stb_image) and copies them into it
+                if (!stbi_info(image.path.c_str(), &image.width, &image.height, &image.components))
+                {
+                    std::cout << "Texture failed to load at path: " << image.path << std::endl;
+                    continue;
+                }
+                if (image.components == 2)
+                    image.components = 4; // grey and alpha are expanded by stb_image
+                size_t bytes = (size_t)image.width * image.height * image.components;
+                glGenBuffers(1, &image.unpackBuffer);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, image.unpackBuffer);
+                glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+                image.mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                std::string path = image.path;
+                void* destination = image.mapped;
+                int components = image.components;
+                launch(image, [path, destination, bytes, components]() {
+                    int width, height, fileComponents;
+                    unsigned char* data = stbi_load(path.c_str(), &width, &height, &fileComponents, components);
+                    if (data == nullptr || destination == nullptr || (size_t)width * height * components != bytes)
+                    {
+                        std::cout << "Texture failed to load at path: " << path << std::endl;
+                        stbi_image_free(data);
+                        return false;
+                    }
+                    std::memcpy(destination, data, bytes);
+                    stbi_image_free(data);
+                    return true;
+                });
+            }
+            requests.push_back(std::move(request));
+            if (!async)
+                update();
+        }
+
+        // the job runs on the pool, or right away when loading synchronously
+        template <typename Job>
+        void launch(Image& image, Job job)
+        {
+            if (async)
+                image.decoded = pool.submit(job);
+            else
+            {
+                std::promise<bool> result;
+                result.set_value(job());
+                image.decoded = result.get_future();
+            }
+        }
+
+        static bool decoded(Request& request)
+        {
+            for (Image& image : request.images)
+                if (image.decoded.valid() && image.decoded.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                    return false;
+            return true;
+        }
+
+        void release(Image& image)
+        {
+            if (image.unpackBuffer == 0)
+                return;
+            if (image.mapped)
+            {
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, image.unpackBuffer);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                image.mapped = nullptr;
+            }
+            glDeleteBuffers(1, &image.unpackBuffer);
+            image.unpackBuffer = 0;
+        }
+
+        // every image from its unpack buffer; a cubemap keeps the placeholder faces if any face failed
+        void upload(Request& request)
+        {
+            bool complete = true;
+            for (Image& image : request.images)
+            {
+                image.valid = image.decoded.valid() && image.decoded.get();
+                complete = complete && image.valid;
+            }
+            glBindTexture(request.target, request.texture);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // rows of 1 and 3 components images are not 4-byte aligned
+            for (Image& image : request.images)
+            {
+                if (image.compressed)
+                {
+                    if (image.valid && (complete || request.target == GL_TEXTURE_2D))
+                        uploadCompressed(image, request);
+                    image.compressed.reset(); // unmaps the cache file (unless streamed)
+                    continue;
+                }
+                if (image.unpackBuffer == 0)
+                    continue;
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, image.unpackBuffer);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                image.mapped = nullptr;
+                if (image.valid && (complete || request.target == GL_TEXTURE_2D))
+                {
+                    GLenum internalFormat = image.internalFormat, dataFormat = image.dataFormat;
+                    if (internalFormat == 0)
+                        formats(image.components, request.target == GL_TEXTURE_2D && request.gammaCorrection, internalFormat, dataFormat);
+                    size_t faceBytes = (size_t)image.width * image.height * (image.dataType == GL_HALF_FLOAT ? 6 : 4);
+                    if (image.faces == 1)
+                        glTexImage2D(image.target, 0, internalFormat, image.width, image.height, 0, dataFormat, image.dataType, (void*)0);
+                    else
+                        for (int face = 0; face < image.faces; face++)
+                            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, internalFormat, image.width, image.height, 0, dataFormat, image.dataType,
+                                         (void*)(face * faceBytes));
+                }
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                release(image);
+            }
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            if (request.target == GL_TEXTURE_2D && complete && !compression)
+                glGenerateMipmap(GL_TEXTURE_2D);
+            uploaded++;
+            generation++;
+        }
+
+        // all the levels of the image, as stored (the cache holds the whole mip chain of 2D textures), or only the small
+        // ones when streamed: the residency manager keeps the compressed image, so the mapping outlives the upload
+        void uploadCompressed(Image& image, Request& request)
+        {
+            const CompressedImage& compressed = *image.compressed;
+            if (streaming && request.target == GL_TEXTURE_2D && compressed.levels.size() > 1)
+                streaming->add(request.texture, compressed.internalFormat, compressed.levels, image.compressed);
+            else
+            {
+                for (size_t level = 0; level < compressed.levels.size(); level++)
+                {
+                    const KTX2File::Level& data = compressed.levels[level];
+                    glCompressedTexImage2D(image.target, (GLint)level, compressed.internalFormat, data.width, data.height, 0, (GLsizei)data.size, data.data);
+                }
+                if (request.target == GL_TEXTURE_2D)
+                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)compressed.levels.size() - 1);
+            }
+            for (const KTX2File::Level& data : compressed.levels)
+                compressedBytes += data.size;
+            uncompressedBytes += compressed.uncompressedBytes;
+            std::cout << compressed.report << std::endl;
+        }
+
+        // FNV-1a of the source file and of the encoding options
+        static uint64_t cacheKey(const std::vector<unsigned char>& source, bool srgb, bool mipmaps)
+        {
+            uint64_t hash = 14695981039346656037ull;
+            auto add = [&hash](uint64_t byte) {
+                hash ^= byte;
+                hash *= 1099511628211ull;
+            };
+            for (unsigned char byte : source)
+                add(byte);
+            add(srgb);
+            add(mipmaps);
+            add(CACHE_VERSION);
+            return hash;
+        }
+
+        // runs on the pool: maps the cached KTX2 file of the source, or encodes (blocks in parallel) and caches it
+        bool compressImage(const std::string& path, bool srgb, bool mipmaps, CompressedImage& compressed)
+        {
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            std::ifstream sourceFile(path, std::ios::binary);
+            std::vector<unsigned char> source((std::istreambuf_iterator<char>(sourceFile)), std::istreambuf_iterator<char>());
+            if (source.empty())
+            {
+                std::cout << "Texture failed to load at path: " << path << std::endl;
+                return false;
+            }
+            bool hdr = stbi_is_hdr_from_memory(source.data(), (int)source.size()) != 0;
+            uint32_t vkFormat = hdr ? VK_FORMAT_BC6H_UFLOAT_BLOCK : (srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK);
+            compressed.internalFormat = hdr ? GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT : (srgb ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : GL_COMPRESSED_RGBA_BPTC_UNORM);
+            char name[32];
+            std::snprintf(name, sizeof(name), "%016llx.ktx2", (unsigned long long)cacheKey(source, srgb, mipmaps));
+            std::string cachePath = (std::filesystem::path(cacheDirectory) / name).string();
+
+            std::string outcome;
+            CompressionQuality quality;
+            if (compressed.file.map(cachePath) && compressed.file.format() == vkFormat)
+            {
+                compressed.levels = compressed.file.levels;
+                outcome = "cache hit";
+            }
+            else
+            {
+                std::vector<std::vector<uint8_t>> levels;
+                int width, height, components;
+                if (hdr)
+                {
+                    float* data = stbi_loadf_from_memory(source.data(), (int)source.size(), &width, &height, &components, 3);
+                    if (data == nullptr)
+                    {
+                        std::cout << "Texture failed to load at path: " << path << std::endl;
+                        return false;
+                    }
+                    MipLevelHalf level;
+                    level.width = width;
+                    level.height = height;
+                    level.pixels.resize((size_t)width * height);
+                    for (size_t i = 0; i < level.pixels.size(); i++)
+                        level.pixels[i] = glm::u16vec3(glm::packHalf1x16(data[i * 3]), glm::packHalf1x16(data[i * 3 + 1]), glm::packHalf1x16(data[i * 3 + 2]));
+                    stbi_image_free(data);
+                    while (true)
+                    {
+                        levels.push_back(encodeBC6H(level, pool, quality));
+                        if (!mipmaps || (level.width == 1 && level.height == 1))
+                            break;
+                        level = downsample(level);
+                    }
+                }
+                else
+                {
+                    unsigned char* data = stbi_load_from_memory(source.data(), (int)source.size(), &width, &height, &components, 4);
+                    if (data == nullptr)
+                    {
+                        std::cout << "Texture failed to load at path: " << path << std::endl;
+                        return false;
+                    }
+                    MipLevel8 level;
+                    level.width = width;
+                    level.height = height;
+                    level.pixels.resize((size_t)width * height);
+                    std::memcpy(level.pixels.data(), data, level.pixels.size() * 4);
+                    stbi_image_free(data);
+                    if (components == 1) // sampled as a GL_RED texture: (r, 0, 0, 1)
+                        for (glm::u8vec4& pixel : level.pixels)
+                            pixel.g = pixel.b = 0;
+                    while (true)
+                    {
+                        levels.push_back(encodeBC7(level, pool, quality));
+                        if (!mipmaps || (level.width == 1 && level.height == 1))
+                            break;
+                        level = downsample(level, srgb);
+                    }
+                }
+                double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+                std::ostringstream text;
+                text << std::fixed << std::setprecision(1) << "PSNR " << quality.psnr() << " dB" << (hdr ? " (tone mapped)" : "") << ", encoded in " << milliseconds << " ms";
+                outcome = text.str();
+                if (writeKTX2(cachePath, vkFormat, width, height, levels) && compressed.file.map(cachePath))
+                    compressed.levels = compressed.file.levels;
+                else
+                {
+                    compressed.encoded = std::move(levels);
+                    for (size_t level = 0; level < compressed.encoded.size(); level++)
+                        compressed.levels.push_back({ (uint32_t)std::max(1, width >> level), (uint32_t)std::max(1, height >> level),
+                                                           compressed.encoded[level].data(), compressed.encoded[level].size() });
+                    outcome += ", not cached";
+                }
+            }
+
+            size_t texels = 0, bytes = 0;
+            for (const KTX2File::Level& level : compressed.levels)
+            {
+                texels += (size_t)level.width * level.height;
+                bytes += level.size;
+            }
+            // without compression the image is decoded to 8 bits with the components of the file (see formats())
+            int fileWidth, fileHeight, components;
+            if (!stbi_info_from_memory(source.data(), (int)source.size(), &fileWidth, &fileHeight, &components))
+                components = 4;
+            if (components == 2)
+                components = 4;
+            compressed.uncompressedBytes = texels * components;
+            const char* uncompressedFormat = components == 1 ? "R8" : components == 3 ? (srgb ? "SRGB8" : "RGB8") : (srgb ? "SRGB8_ALPHA8" : "RGBA8");
+            const KTX2File::Level& top = compressed.levels.front();
+            std::ostringstream report;
+            report << "texture " << path << ": " << top.width << "x" << top.height << " " << (hdr ? "BC6H" : (srgb ? "BC7 sRGB" : "BC7")) << ", "
+                   << compressed.levels.size() << (compressed.levels.size() == 1 ? " level, " : " levels, ") << std::fixed << std::setprecision(2)
+                   << bytes / (1024.0 * 1024.0) << " MB (" << std::setprecision(1) << (double)compressed.uncompressedBytes / bytes << "x less than "
+                   << uncompressedFormat << "), " << outcome;
+            compressed.report = report.str();
+            return true;
+        }
+
+        static void formats(int components, bool gammaCorrection, GLenum& internalFormat, GLenum& dataFormat)
+        {
+            if (components == 1)
+                internalFormat = dataFormat = GL_RED;
+            else if (components == 4)
+            {
+                internalFormat = gammaCorrection ? GL_SRGB_ALPHA : GL_RGBA;
+                dataFormat = GL_RGBA;
+            }
+            else
+            {
+                internalFormat = gammaCorrection ? GL_SRGB : GL_RGB;
+                dataFormat = GL_RGB;
+            }
+        }
+};
+#endif
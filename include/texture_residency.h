@@ -0,0 +1,295 @@
+#ifndef TEXTURE_RESIDENCY_H
+#define TEXTURE_RESIDENCY_H
+
+#include <glad/glad.h>
+
+#include <ktx2.h>
+#include <thread_pool.h>
+
+#include <vector>
+#include <string>
+#include <future>
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+
+// Mip level streaming of block compressed 2D textures, whose levels stay readable in their mapped KTX2 cache file.
+// A texture starts with its small levels only (the tail, up to residentSize texels a side, always resident); every
+// frame the scene reports the screen footprint of each texture, and the finer levels it needs are streamed one at
+// a time: a pool job copies the level from the mapping into a mapped unpack buffer, the next update() uploads it and
+// lowers GL_TEXTURE_BASE_LEVEL. When a level does not fit in the budget, the finest levels of the least recently
+// used textures are evicted first (base level raised, level storage released).
+class TextureResidency
+{
+    public:
+        static const unsigned int MAX_STREAMS = 4; // levels copied at the same time
+
+        struct Stats
+        {
+            size_t residentBytes = 0; // levels in video memory
+            size_t completeBytes = 0; // every level of every texture
+            size_t budgetBytes = 0;
+            unsigned int textures = 0;
+            unsigned int pendingLevels = 0;
+            unsigned long long streamedLevels = 0;
+            unsigned long long evictedLevels = 0;
+        };
+
+        TextureResidency(ThreadPool& pool, size_t budgetBytes, int residentSize, bool async = true)
+            : pool(pool), residentSize(std::max(4, residentSize)), async(async)
+        {
+            statistics.budgetBytes = budgetBytes;
+        }
+
+        ~TextureResidency()
+        {
+            for (Entry& entry : entries)
+                if (entry.stream.copied.valid())
+                {
+                    entry.stream.copied.wait();
+                    releaseStream(entry.stream);
+                }
+        }
+
+        TextureResidency(const TextureResidency&) = delete;
+        TextureResidency& operator=(const TextureResidency&) = delete;
+
+        // a texture with its levels (largest first), kept readable by owner; the tail levels are uploaded at once
+        void add(GLuint texture, GLenum internalFormat, const std::vector<KTX2File::Level>& levels, std::shared_ptr<void> owner)
+        {
+            Entry entry;
+            entry.texture = texture;
+            entry.internalFormat = internalFormat;
+            entry.levels = levels;
+            entry.owner = owner;
+            entry.tailLevel = (int)levels.size() - 1;
+            while (entry.tailLevel > 0 && std::max(levels[entry.tailLevel - 1].width, levels[entry.tailLevel - 1].height) <= (uint32_t)residentSize)
+                entry.tailLevel--;
+            entry.residentLevel = entry.wantedLevel = entry.tailLevel;
+            glBindTexture(GL_TEXTURE_2D, texture);
+            for (int level = entry.tailLevel; level < (int)levels.size(); level++)
+            {
+                glCompressedTexImage2D(GL_TEXTURE_2D, level, internalFormat, levels[level].width, levels[level].height, 0, (GLsizei)levels[level].size, levels[level].data);
+                statistics.residentBytes += levels[level].size;
+            }
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, entry.tailLevel);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size() - 1);
+            for (const KTX2File::Level& level : levels)
+                statistics.completeBytes += level.size;
+            statistics.textures++;
+            index[texture] = entries.size();
+            entries.push_back(std::move(entry));
+        }
+
+        bool manages(GLuint texture) const
+        {
+            return index.find(texture) != index.end();
+        }
+
+        // the texture covers about pixels texels a side on screen this frame (the largest of its requests counts)
+        void request(GLuint texture, float pixels)
+        {
+            auto found = index.find(texture);
+            if (found == index.end())
+                return;
+            Entry& entry = entries[found->second];
+            float ratio = std::max(entry.levels[0].width, entry.levels[0].height) / std::max(pixels, 1.0f);
+            int level = std::min((int)std::floor(std::log2(std::max(ratio, 1.0f))), entry.tailLevel);
+            entry.wantedLevel = std::min(entry.wantedLevel, level);
+            entry.lastUsed = frame;
+        }
+
+        // once per frame on the GL thread: uploads the copied levels, then starts the copies the last requests need;
+        // true if the resident levels of any texture changed
+        bool update()
+        {
+            unsigned long long changes = statistics.streamedLevels + statistics.evictedLevels;
+            for (Entry& entry : entries)
+                if (entry.stream.copied.valid() && entry.stream.copied.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+                    finishStream(entry);
+
+            // the textures missing the most levels first
+            candidates.clear();
+            for (size_t e = 0; e < entries.size(); e++)
+                if (entries[e].wantedLevel < entries[e].residentLevel && !entries[e].stream.copied.valid())
+                    candidates.push_back(e);
+            std::sort(candidates.begin(), candidates.end(), [this](size_t a, size_t b) {
+                return entries[a].residentLevel - entries[a].wantedLevel > entries[b].residentLevel - entries[b].wantedLevel;
+            });
+            for (size_t e : candidates)
+            {
+                if (statistics.pendingLevels >= MAX_STREAMS)
+                    break;
+                Entry& entry = entries[e];
+                const KTX2File::Level& level = entry.levels[entry.residentLevel - 1];
+                if (!makeRoom(level.size, e))
+                    break;
+                startStream(entry, entry.residentLevel - 1);
+            }
+
+            for (Entry& entry : entries)
+                entry.wantedLevel = entry.tailLevel;
+            frame++;
+            return statistics.streamedLevels + statistics.evictedLevels != changes;
+        }
+
+        const Stats& stats() const
+        {
+            return statistics;
+        }
+
+        void report() const
+        {
+            const double megabyte = 1024.0 * 1024.0;
+            std::streamsize precision = std::cout.precision();
+            std::cout << "texture residency: " << std::fixed << std::setprecision(1) << statistics.residentBytes / megabyte << " MB resident of "
+                      << statistics.completeBytes / megabyte << " MB with every level (budget " << statistics.budgetBytes / megabyte << " MB), "
+                      << statistics.textures << " textures, " << statistics.streamedLevels << " levels streamed, " << statistics.evictedLevels
+                      << " evicted, " << statistics.pendingLevels << " pending" << std::defaultfloat << std::setprecision(precision) << std::endl;
+        }
+
+    private:
+        struct Stream
+        {
+            int level = -1;
+            GLuint unpackBuffer = 0;
+            void* mapped = nullptr;
+            std::future<bool> copied;
+        };
+
+        struct Entry
+        {
+            GLuint texture = 0;
+            GLenum internalFormat = 0;
+            std::vector<KTX2File::Level> levels;
+            std::shared_ptr<void> owner; // keeps the levels readable
+            int tailLevel = 0; // first level of the always resident tail
+            int residentLevel = 0; // finest resident level (base level of the texture)
+            int wantedLevel = 0; // finest level requested since the last update
+            unsigned long long lastUsed = 0; // frame of the last request
+            Stream stream;
+        };
+
+        ThreadPool& pool;
+        int residentSize;
+        bool async;
+        std::vector<Entry> entries;
+        std::unordered_map<GLuint, size_t> index;
+        std::vector<size_t> candidates;
+        Stats statistics;
+        unsigned long long frame = 0;
+        size_t inflightBytes = 0;
+
+        // evicts the finest levels of the least recently used textures (never the one asking, never a tail) until
+        // bytes fit in the budget; false if they cannot
+        bool makeRoom(size_t bytes, size_t asking)
+        {
+            while (statistics.residentBytes + inflightBytes + bytes > statistics.budgetBytes)
+            {
+                size_t victim = entries.size();
+                for (size_t e = 0; e < entries.size(); e++)
+                {
+                    const Entry& entry = entries[e];
+                    if (e == asking || entry.residentLevel >= entry.tailLevel || entry.stream.copied.valid())
+                        continue;
+                    // levels finer than the wanted one are free to go even if the texture is in use
+                    bool unused = entry.residentLevel < entry.wantedLevel || entry.lastUsed + 1 < frame;
+                    if (!unused)
+                        continue;
+                    if (victim == entries.size() || entry.lastUsed < entries[victim].lastUsed)
+                        victim = e;
+                }
+                if (victim == entries.size())
+                    return false;
+                evict(entries[victim]);
+            }
+            return true;
+        }
+
+        void evict(Entry& entry)
+        {
+            int level = entry.residentLevel;
+            glBindTexture(GL_TEXTURE_2D, entry.texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level + 1);
+            // an empty image releases the storage of the level (outside the base..max range it does not matter)
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            entry.residentLevel = level + 1;
+            statistics.residentBytes -= entry.levels[level].size;
+            statistics.evictedLevels++;
+        }
+
+        void startStream(Entry& entry, int level)
+        {
+            const KTX2File::Level& data = entry.levels[level];
+            Stream& stream = entry.stream;
+            stream.level = level;
+            glGenBuffers(1, &stream.unpackBuffer);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stream.unpackBuffer);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, data.size, nullptr, GL_STREAM_DRAW);
+            stream.mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, data.size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            // the copy reads the level from the mapped file (page faults and disk reads happen on the pool)
+            auto copy = [destination = stream.mapped, source = data.data, size = data.size]() {
+                if (destination == nullptr)
+                    return false;
+                std::memcpy(destination, source, size);
+                return true;
+            };
+            if (async)
+                stream.copied = pool.submit(copy);
+            else
+            {
+                std::promise<bool> result;
+                result.set_value(copy());
+                stream.copied = result.get_future();
+            }
+            inflightBytes += data.size;
+            statistics.pendingLevels++;
+        }
+
+        void finishStream(Entry& entry)
+        {
+            Stream& stream = entry.stream;
+            const KTX2File::Level& data = entry.levels[stream.level];
+            bool copied = stream.copied.get();
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stream.unpackBuffer);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            stream.mapped = nullptr;
+            if (copied && stream.level == entry.residentLevel - 1)
+            {
+                glBindTexture(GL_TEXTURE_2D, entry.texture);
+                glCompressedTexImage2D(GL_TEXTURE_2D, stream.level, entry.internalFormat, data.width, data.height, 0, (GLsizei)data.size, (void*)0);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, stream.level);
+                entry.residentLevel = stream.level;
+                statistics.residentBytes += data.size;
+                statistics.streamedLevels++;
+            }
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            inflightBytes -= data.size;
+            statistics.pendingLevels--;
+            releaseStream(stream);
+        }
+
+        static void releaseStream(Stream& stream)
+        {
+            if (stream.unpackBuffer == 0)
+                return;
+            if (stream.mapped)
+            {
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stream.unpackBuffer);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                stream.mapped = nullptr;
+            }
+            glDeleteBuffers(1, &stream.unpackBuffer);
+            stream.unpackBuffer = 0;
+            stream.level = -1;
+            stream.copied = std::future<bool>();
+        }
+};
+#endif
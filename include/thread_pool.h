@@ -0,0 +1,135 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <atomic>
+#include <algorithm>
+
+// A fixed-size pool of worker threads used by the CPU-side jobs (blur, baking, culling, decoding...)
+class ThreadPool
+{
+    public:
+        // creates the workers (0 = one per hardware thread)
+        ThreadPool(unsigned int threadCount = 0)
+        {
+            if (threadCount == 0)
+                threadCount = std::max(1u, std::thread::hardware_concurrency());
+            for (unsigned int i = 0; i < threadCount; i++)
+                workers.emplace_back([this] { workerLoop(); });
+        }
+
+        ~ThreadPool()
+        {
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                stopping = true;
+            }
+            queueCondition.notify_all();
+            for (std::thread& worker : workers)
+                worker.join();
+        }
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        unsigned int size() const
+        {
+            return (unsigned int)workers.size();
+        }
+
+        // queues a job and returns a future for its result
+        template <typename F>
+        auto submit(F&& job) -> std::future<decltype(job())>
+        {
+            using Result = decltype(job());
+            auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(job));
+            std::future<Result> result = task->get_future();
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                jobs.emplace([task] { (*task)(); });
+            }
+            queueCondition.notify_one();
+            return result;
+        }
+
+        // splits [begin, end) in chunks of at least minChunk elements and runs body(chunkBegin, chunkEnd) on the workers,
+        // the calling thread takes part in the work and the call returns when every chunk is done
+        // (helpers that start late find no chunk left, so it is safe to call from inside a pool job)
+        template <typename F>
+        void parallelFor(size_t begin, size_t end, F body, size_t minChunk = 1)
+        {
+            if (end <= begin)
+                return;
+            size_t count = end - begin;
+            size_t chunks = std::min((size_t)size() * 4, (count + minChunk - 1) / std::max<size_t>(minChunk, 1));
+            if (chunks <= 1 || size() <= 1)
+            {
+                body(begin, end);
+                return;
+            }
+            size_t chunkSize = (count + chunks - 1) / chunks;
+            struct ForState
+            {
+                std::atomic<size_t> nextChunk{0};
+                size_t doneChunks = 0;
+                std::mutex doneMutex;
+                std::condition_variable doneCondition;
+            };
+            auto state = std::make_shared<ForState>();
+            auto worker = [state, chunks, chunkSize, begin, end, &body]() {
+                for (size_t chunk = state->nextChunk++; chunk < chunks; chunk = state->nextChunk++)
+                {
+                    size_t chunkBegin = begin + chunk * chunkSize;
+                    size_t chunkEnd = std::min(end, chunkBegin + chunkSize);
+                    if (chunkBegin < chunkEnd)
+                        body(chunkBegin, chunkEnd);
+                    std::unique_lock<std::mutex> lock(state->doneMutex);
+                    if (++state->doneChunks == chunks)
+                        state->doneCondition.notify_all();
+                }
+            };
+            size_t helperCount = std::min((size_t)size(), chunks) - 1;
+            for (size_t i = 0; i < helperCount; i++)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(queueMutex);
+                    jobs.emplace(worker);
+                }
+                queueCondition.notify_one();
+            }
+            worker();
+            std::unique_lock<std::mutex> lock(state->doneMutex);
+            state->doneCondition.wait(lock, [&] { return state->doneChunks == chunks; });
+        }
+
+    private:
+        std::vector<std::thread> workers;
+        std::queue<std::function<void()>> jobs;
+        std::mutex queueMutex;
+        std::condition_variable queueCondition;
+        bool stopping = false;
+
+        void workerLoop()
+        {
+            while (true)
+            {
+                std::function<void()> job;
+                {
+                    std::unique_lock<std::mutex> lock(queueMutex);
+                    queueCondition.wait(lock, [this] { return stopping || !jobs.empty(); });
+                    if (stopping && jobs.empty())
+                        return;
+                    job = std::move(jobs.front());
+                    jobs.pop();
+                }
+                job();
+            }
+        }
+};
+#endif
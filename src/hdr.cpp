@@ -2,11 +2,14 @@
 #include <vector>
 #include <string>
 #include <filesystem>
+#include <chrono>
 #include <algorithm>
 #include <cmath>
 #include <fstream>
+#include <memory>
 
 #include <glad/glad.h>
+#include <gl_ext.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -14,11 +17,30 @@
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
+#undef STB_IMAGE_IMPLEMENTATION // the headers including stb_image only need the declarations
 
 #include <nlohmann/json.hpp>
 
 #include <shader.h>
 #include <camera.h>
+#include <bloom.h>
+#include <thread_pool.h>
+#include <cpu_blur.h>
+#include <fft_glare.h>
+#include <gpu_timer.h>
+#include <generation.h>
+#include <bounds.h>
+#include <lights.h>
+#include <light_set.h>
+#include <clusters.h>
+#include <light_benchmark.h>
+#include <gbuffer.h>
+#include <mesh_builder.h>
+#include <scene.h>
+#include <depth_prepass.h>
+#include <texture_loader.h>
+#include <ibl.h>
+#include <shader_reloader.h>
 
 using json = nlohmann::json;
 
@@ -36,6 +58,17 @@ struct Illumination{
     enum IlluminationType hdr; //type of hdr
     bool dynamicExposure; //dynamic exposure for global-type hdr for change dynamically exposure and create local-like behaviour
     bool bloomState; //blurring effect of lights
+    float bloomStdDev; //standard deviation (in pixels) of the gaussian used for blurring
+    int bloomKernelSize; //number of gaussian taps per side (center included)
+    unsigned int bloomBlurPasses; //number of times the two-dimensional blur is applied
+    float bloomThreshold; //luminance from which a pixel starts contributing to bloom
+    float bloomKnee; //width of the soft transition around the threshold (0 = hard threshold)
+    unsigned int bloomDownsample; //bloom buffers resolution divider (bright pass and blur run at reduced resolution)
+    bool glareState; //star shaped glare convolved on the CPU instead of the gaussian blur
+    bool bloomCompute; //gaussian blur done by compute shaders with shared memory tiles (OpenGL 4.3) instead of fragment shaders
+    bool bloomCache; //reuse the last bloom result while the scene inputs don't change
+    bool clusteredShading; //every fragment is lit only by the lights of its cluster (screen tile and depth slice)
+    bool deferredShading; //geometry written to a G-buffer first, then lit once per pixel
     float adaptationSpeed; //how fast you adapt from dark to light and viceversa
     float maxChange; //limit how much you can adapt frame by frame
 
@@ -61,6 +94,8 @@ unsigned int win_height = config["window"]["height"]; //height of the window
 
 // CAMERA SETTINGS
 Camera camera(glm::vec3(config["camera"]["x"], config["camera"]["y"], config["camera"]["z"]));
+const float nearPlane = 0.1f; //distance of the near clipping plane
+const float farPlane = 100.0f; //distance of the far clipping plane
 float lastX = (float)win_width / 2.0;
 float lastY = (float)win_height / 2.0;
 bool firstMouse = true;
@@ -70,29 +105,39 @@ float deltaTimeFrame = 0.0f; //difference of time from a frame and his predecess
 float lastFrame = 0.0f; //absolute time of the precedessor frame from the start of the program
 float currentFrame = 0.0f; //absolute time of the actual frame from the start of the program 
 
+// CPU JOBS
+ThreadPool threadPool; //workers shared by every CPU-side job
+
 // FUNCTION DECLARATIONS
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xposIn, double yposIn);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void processWindowInput(GLFWwindow *window);
-void processIlluminationInput(GLFWwindow* window, Illumination* illum, bool* illuminationChangeKeyPressed, bool* dynamicExposureKeyPressed , bool* bloomKeyPressed);
-unsigned int loadTexture(const char *path, bool gammaCorrection);
-unsigned int loadCubemapSkyboxTexture(std::vector<std::string> faces);
+void processIlluminationInput(GLFWwindow* window, Illumination* illum, bool* illuminationChangeKeyPressed, bool* dynamicExposureKeyPressed , bool* bloomKeyPressed, bool* glareKeyPressed, bool* bloomComputeKeyPressed, bool* clusteredKeyPressed, bool* deferredKeyPressed);
+void processDebugInput(GLFWwindow* window, bool* bloomReferenceKeyPressed, bool* bloomReferenceRequested);
 float* calculateLuminanceScreenStats(float* imageFrameData, int width, int height);
 void updateExposure(Illumination* illum);
+void checkBloomReference(const ImageRGBA32F& brightImage, const ImageRGBA32F& gpuBloomImage, Illumination* illum);
 
 int main()
 {
+    auto startupBegin = std::chrono::steady_clock::now(); //for the time to first frame
     glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
     #ifdef __APPLE__
         glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     #endif
 
-    GLFWwindow* window = glfwCreateWindow(win_width, win_height, "HDR_rendering_Elaborato", NULL, NULL);
+    // an OpenGL 4.3 context enables the compute paths, otherwise we fall back to 3.3
+    GLFWwindow* window = NULL;
+    int contextVersions[2][2] = { {4, 3}, {3, 3} };
+    for (unsigned int i = 0; i < 2 && window == NULL; i++)
+    {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, contextVersions[i][0]);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, contextVersions[i][1]);
+        window = glfwCreateWindow(win_width, win_height, "HDR_rendering_Elaborato", NULL, NULL);
+    }
     if (window == NULL)
     {
         std::cout << "Failed to create GLFW window" << std::endl;
@@ -112,6 +157,7 @@ int main()
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    loadGLExtensions((GLADloadproc)glfwGetProcAddress);
 
     // ILLUMINATION SETTINGS
     Illumination illum_settings;
@@ -127,36 +173,91 @@ int main()
     illum_settings.adaptationSpeed = config["illumination"]["adaptation_speed"];
     illum_settings.maxChange = config["illumination"]["max_change"];
     illum_settings.bloomState = config["illumination"]["bloom"]["state"];
+    illum_settings.bloomStdDev = config["illumination"]["bloom"]["standard_deviation"];
+    illum_settings.bloomKernelSize = config["illumination"]["bloom"]["kernel_size"];
+    illum_settings.bloomBlurPasses = config["illumination"]["bloom"]["two_dim_blur_pass"];
+    illum_settings.bloomThreshold = config["illumination"]["bloom"]["threshold"];
+    illum_settings.bloomKnee = config["illumination"]["bloom"]["knee"];
+    illum_settings.bloomDownsample = std::max(1u, config["illumination"]["bloom"]["downsample"].get<unsigned int>());
+    illum_settings.glareState = config["illumination"]["bloom"]["glare"]["state"];
+    illum_settings.bloomCompute = config["illumination"]["bloom"]["compute"].get<bool>() && glExt.computeShaders;
+    illum_settings.bloomCache = config["illumination"]["bloom"]["cache"];
+    illum_settings.clusteredShading = config["lights"]["clustered"];
+    illum_settings.deferredShading = config["lights"]["deferred"];
     bool illuminationChangeKeyPressed = false;
     bool dynamicExposureKeyPressed = false;
     bool bloomKeyPressed = false;
+    bool glareKeyPressed = false;
+    bool bloomComputeKeyPressed = false;
+    bool clusteredKeyPressed = false;
+    bool deferredKeyPressed = false;
+    bool bloomReferenceKeyPressed = false;
+    bool bloomReferenceRequested = false; //next frame's bloom is compared with the CPU reference blur
 
     // GLOBAL OPERATIONS
     glEnable(GL_DEPTH_TEST);
 
     // SHADERS
     //shader definitions
-    Shader lightShader("shader/lightVS.txt", "shader/lightFS.txt"); //for rendering container and lights
+    LightBuffer lightBuffer; //lights of the scene, uploaded to the GPU only when they change
+    lightBuffer.cutoff = config["lights"]["cutoff"];
+    std::vector<BoundingBox> drawBounds; //world bounds of the draws of the frame (lights reaching none of them are culled)
+    std::vector<uint32_t> visibleLights; //lights that survived culling
+    if (config["program_cache"]["state"])
+        Shader::enableBinaryCache(config["program_cache"]["cache"]); //programs linked by an earlier run are loaded as binaries
+    std::string scenePreamble = lightBuffer.shaderPreamble() + "\n" + Scene::shaderPreamble(); //lights and size of the mesh parameter arrays
+    Shader lightShader("shader/lightVS.txt", "shader/lightFS.txt", nullptr, scenePreamble); //for rendering the scene and its lights
+    Shader gbufferShader("shader/lightVS.txt", "shader/gbufferFS.txt", nullptr, Scene::shaderPreamble()); //for writing the G-buffer (deferred shading)
+    Shader depthShader("shader/lightVS.txt", "shader/depthFS.txt", nullptr, scenePreamble); //for the depth pre-pass (same vertex stage as lightShader)
+    Shader deferredShader("shader/deferredVS.txt", "shader/deferredFS.txt", nullptr, lightBuffer.shaderPreamble()); //for lighting the G-buffer (deferred shading)
     Shader skyboxShader("shader/skyboxVS.txt", "shader/skyboxFS.txt"); //for rendering skybox
+    Shader brightShader("shader/brightVS.txt", "shader/brightFS.txt"); //for extracting bright pixels at reduced resolution (post-processing operation)
     Shader blurShader("shader/blurVS.txt", "shader/blurFS.txt"); //for blooming (post-processing operation)
     Shader hdrShader("shader/hdrVS.txt", "shader/hdrFS.txt"); //for hdr (post-processing operation)
-
-    
-    lightShader.useProgram();
-    lightShader.setInt("difTex", 0);
-    skyboxShader.useProgram();
-    skyboxShader.setInt("skybox", 0);
-    blurShader.useProgram();
-    blurShader.setInt("brightFrame", 0);
-    blurShader.setFloat("stdDev", config["illumination"]["bloom"]["standard_deviation"]);
-    blurShader.setInt("kernelSize", config["illumination"]["bloom"]["kernel_size"]);
-    hdrShader.useProgram();
-    hdrShader.setInt("hdrBuffer", 0);
+    std::unique_ptr<Shader> blurComputeShader; //for blooming with compute shaders (only with OpenGL 4.3)
+    if (glExt.computeShaders)
+        blurComputeShader = std::make_unique<Shader>("shader/blurCS.txt");
+    std::cout << "programs: " << Shader::programsBuilt << " built in " << Shader::buildMilliseconds << " ms (" << Shader::binaryHits
+              << " loaded from the binary cache)" << std::endl;
+
+
+    LightClusters lightClusters(nearPlane, farPlane); //light lists of the clusters of the view frustum
+    const unsigned int gBufferUnit = 4; //first texture unit of the G-buffer targets in the deferred lighting pass
+    GpuTimers shadingTimers; //gpu time of the scene shading passes
+    DepthPrepass depthPrepass(DepthPrepass::parseMode(config["lights"]["depth_prepass"]), config["lights"]["overdraw_threshold"]); //forward shading: depth only pass, then lighting with GL_EQUAL
+    bool shadingTimersDeferred = illum_settings.deferredShading; //shading mode the timers are measuring
+    LightBenchmark lightBenchmark(shadingTimers, config["benchmark"]["lights"]["min"], config["benchmark"]["lights"]["max"], config["benchmark"]["lights"]["frames"],
+        config["benchmark"]["lights"]["forward_max"], config["benchmark"]["lights"]["intensity"]);
+    std::cout << "lights: " << (lightBuffer.storageBuffer ? "shader storage buffer" : "uniform buffer") << " (max " << lightBuffer.capacity << " lights)" << std::endl;
+    BlurKernel blurKernel; //gaussian weights of the blur, rebuilt only when bloom settings change
+    GlareKernel glareKernel = makeStarGlareKernel(config["illumination"]["bloom"]["glare"]["radius"], config["illumination"]["bloom"]["glare"]["spikes"],
+        config["illumination"]["bloom"]["glare"]["core_standard_deviation"], config["illumination"]["bloom"]["glare"]["spike_falloff"], config["illumination"]["bloom"]["glare"]["intensity"]);
+    GlareConvolver glareConvolver; //keeps the glare kernel spectrum between frames
+    int glarePathReported = -1; //last glare convolution path printed
+    GpuTimers bloomTimers; //gpu time of every bloom pass
+    bool bloomTimersCompute = illum_settings.bloomCompute; //blur implementation the timers are measuring
+    unsigned int frameCount = 0;
+    GenerationCounter bloomInputs; //changes whenever something the bright image depends on changes
+    unsigned long long bloomGeneration = 0; //generation of the inputs the current bloom result was computed with
+    bool bloomResultHorizontal = true; //bloom result is in pingpongColorbuffers[!bloomResultHorizontal]
+    unsigned long long skippedBloomPasses = 0; //bright and blur passes avoided by reusing the bloom result
+    unsigned int programGeneration = 0; //programs swapped by the hot reload (the bloom depends on them too)
+    //uniforms set every frame (locations resolved by configurePrograms, from the uniforms of the programs cached after link)
+    UniformHandle gbufferProjection, gbufferView;
+    UniformHandle deferredInverseProjection, deferredInverseView, deferredLightCount, deferredClustered;
+    UniformHandle depthProjection, depthView;
+    UniformHandle lightProjection, lightView, lightLightCount, lightClustered, lightViewPos;
+    UniformHandle skyboxView, skyboxProjection;
+    UniformHandle brightThreshold, brightKnee;
+    UniformHandle blurDirection, blurComputeDirection;
+    Scene::Uniforms gbufferMeshes, depthMeshes, lightMeshes;
+    UniformHandle hdrEnabled, hdrBloom, hdrExposure, hdrMaxLuminance, hdrAvgLuminance;
 
     // VAOs & VBOs (VertexArrayObjects & VertexBufferObjects)
-    //SkyBox settings
+    //SkyBox settings (indexed: 8 vertices instead of 36)
     unsigned int skyboxVAO;
     unsigned int skyboxVBO;
+    unsigned int skyboxEBO;
     float skyboxVertices[] = {
         // positions          
         -1.0f,  1.0f, -1.0f,
@@ -201,78 +302,33 @@ int main()
         -1.0f, -1.0f,  1.0f,
         1.0f, -1.0f,  1.0f
     };
+    bool measureMeshes = config["benchmark"]["meshes"]["state"]; //vertex shader invocations before and after indexing
+    skyboxShader.useProgram(); //any program works for counting the invocations
+    IndexedMesh skyboxMesh = buildIndexedMesh(skyboxVertices, sizeof(skyboxVertices) / sizeof(float), 3);
+    reportIndexedMesh("skybox", std::vector<float>(std::begin(skyboxVertices), std::end(skyboxVertices)), skyboxMesh, measureMeshes);
     glGenVertexArrays(1, &skyboxVAO);
     glGenBuffers(1, &skyboxVBO);
+    glGenBuffers(1, &skyboxEBO);
     glBindVertexArray(skyboxVAO);
     glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, skyboxMesh.vertices.size() * sizeof(float), skyboxMesh.vertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, skyboxEBO);
+    skyboxMesh.bufferIndices();
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-
-    //Container settings
-    unsigned int containerVAO;
-    unsigned int containerVBO;
-    float containerVertices[] = {
-        /*
-        // back face
-        -1.0f, -1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 0.0f, 0.0f, // bottom-left
-        1.0f,  1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 1.0f, 1.0f, // top-right
-        1.0f, -1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 1.0f, 0.0f, // bottom-right         
-        1.0f,  1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 1.0f, 1.0f, // top-right
-        -1.0f, -1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 0.0f, 0.0f, // bottom-left
-        -1.0f,  1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 0.0f, 1.0f, // top-left
-        */
-        // front face
-        -1.0f, -1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f, 0.0f, // bottom-left
-        1.0f, -1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f, 0.0f, // bottom-right
-        1.0f,  1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f, 1.0f, // top-right
-        1.0f,  1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f, 1.0f, // top-right
-        -1.0f,  1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f, 1.0f, // top-left
-        -1.0f, -1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f, 0.0f, // bottom-left
-        // left face
-        -1.0f,  1.0f,  1.0f, -1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-right
-        -1.0f,  1.0f, -1.0f, -1.0f,  0.0f,  0.0f, 1.0f, 1.0f, // top-left
-        -1.0f, -1.0f, -1.0f, -1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-left
-        -1.0f, -1.0f, -1.0f, -1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-left
-        -1.0f, -1.0f,  1.0f, -1.0f,  0.0f,  0.0f, 0.0f, 0.0f, // bottom-right
-        -1.0f,  1.0f,  1.0f, -1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-right
-        // right face
-        1.0f,  1.0f,  1.0f,  1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-left
-        1.0f, -1.0f, -1.0f,  1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-right
-        1.0f,  1.0f, -1.0f,  1.0f,  0.0f,  0.0f, 1.0f, 1.0f, // top-right         
-        1.0f, -1.0f, -1.0f,  1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-right
-        1.0f,  1.0f,  1.0f,  1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-left
-        1.0f, -1.0f,  1.0f,  1.0f,  0.0f,  0.0f, 0.0f, 0.0f, // bottom-left     
-        // bottom face
-        -1.0f, -1.0f, -1.0f,  0.0f, -1.0f,  0.0f, 0.0f, 1.0f, // top-right
-        1.0f, -1.0f, -1.0f,  0.0f, -1.0f,  0.0f, 1.0f, 1.0f, // top-left
-        1.0f, -1.0f,  1.0f,  0.0f, -1.0f,  0.0f, 1.0f, 0.0f, // bottom-left
-        1.0f, -1.0f,  1.0f,  0.0f, -1.0f,  0.0f, 1.0f, 0.0f, // bottom-left
-        -1.0f, -1.0f,  1.0f,  0.0f, -1.0f,  0.0f, 0.0f, 0.0f, // bottom-right
-        -1.0f, -1.0f, -1.0f,  0.0f, -1.0f,  0.0f, 0.0f, 1.0f, // top-right
-        // top face
-        -1.0f,  1.0f, -1.0f,  0.0f,  1.0f,  0.0f, 0.0f, 1.0f, // top-left
-        1.0f,  1.0f , 1.0f,  0.0f,  1.0f,  0.0f, 1.0f, 0.0f, // bottom-right
-        1.0f,  1.0f, -1.0f,  0.0f,  1.0f,  0.0f, 1.0f, 1.0f, // top-right     
-        1.0f,  1.0f,  1.0f,  0.0f,  1.0f,  0.0f, 1.0f, 0.0f, // bottom-right
-        -1.0f,  1.0f, -1.0f,  0.0f,  1.0f,  0.0f, 0.0f, 1.0f, // top-left
-        -1.0f,  1.0f,  1.0f,  0.0f,  1.0f,  0.0f, 0.0f, 0.0f  // bottom-left 
-            
-    };
-    glGenVertexArrays(1, &containerVAO);
-    glGenBuffers(1, &containerVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, containerVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(containerVertices), containerVertices, GL_STATIC_DRAW);
-    glBindVertexArray(containerVAO);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0); //positions
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float))); //normals
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float))); //texcoords
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
 
+    //Textures (decoded on the thread pool, drawn with a placeholder until they are uploaded)
+    TextureLoader textureLoader(threadPool, config["async_textures"], config["texture_compression"]["state"], config["texture_compression"]["cache"]);
+    if (config["texture_streaming"]["state"])
+        textureLoader.enableStreaming((size_t)config["texture_streaming"]["budget_mb"].get<double>() * 1024 * 1024, config["texture_streaming"]["resident_size"]);
+
+    //Scene settings (meshes, materials and instances read from the scene file, textures loaded as SRGB)
+    std::ifstream scene_file(config["scene"].get<std::string>());
+    json sceneConfig = json::parse(scene_file);
+    Scene scene(sceneConfig, [&textureLoader](const char* path, bool gammaCorrection) { return textureLoader.load(path, gammaCorrection); },
+        threadPool, config["indirect_draws"], measureMeshes);
+
     //Frame settings (useful for post-processing operations)
     unsigned int frameVAO;
     unsigned int frameVBO;
@@ -295,7 +351,6 @@ int main()
     glBindVertexArray(0);
 
     // TEXTURES
-    unsigned int containerTexture = loadTexture(std::filesystem::path("resources/textures/container.png").string().c_str(), true); // note that we're loading the texture as an SRGB texture
     std::vector<std::string> skyboxFaces{
         std::filesystem::path("resources/skybox/px.jpg").string(),
         std::filesystem::path("resources/skybox/nx.jpg").string(),
@@ -304,40 +359,147 @@ int main()
         std::filesystem::path("resources/skybox/pz.jpg").string(),
         std::filesystem::path("resources/skybox/nz.jpg").string(),
     };
-    unsigned int skyboxTexture = loadCubemapSkyboxTexture(skyboxFaces);
+    // an HDR environment map (equirectangular .hdr / .exr) replaces the 8-bit faces when configured
+    json skyboxSettings = config["skybox"];
+    std::string environmentPath = skyboxSettings["environment"];
+    unsigned int skyboxTexture = environmentPath.empty() ? textureLoader.loadCubemap(skyboxFaces)
+        : textureLoader.loadEnvironment(environmentPath, skyboxSettings["face_size"], skyboxSettings["format"] == "rgb16f", skyboxSettings["intensity"]);
+
+    // IMAGE BASED LIGHTING (baked from the skybox on the thread pool, or read from its cache)
+    json iblConfig = config["ibl"];
+    IBLSettings iblSettings;
+    iblSettings.specularSize = iblConfig["specular_size"];
+    iblSettings.specularLevels = iblConfig["specular_levels"];
+    iblSettings.samples = iblConfig["samples"];
+    iblSettings.cacheDirectory = iblConfig["cache"];
+    ImageBasedLighting ibl(threadPool, iblSettings);
+    float iblIntensity = iblConfig["intensity"];
+    float iblRoughness = iblConfig["roughness"];
+    if (iblConfig["state"])
+    {
+        if (environmentPath.empty())
+            ibl.bakeFaces(skyboxFaces);
+        else
+            ibl.bakeEnvironment(environmentPath, skyboxSettings["intensity"]);
+    }
+
+    //Program settings (uniforms that never change and handles of the per-frame ones, set again when programs are reloaded)
+    auto configurePrograms = [&]() {
+        lightShader.useProgram();
+        lightShader.setInt("difTex", 0);
+        lightBuffer.attach(lightShader);
+        lightClusters.setUniforms(lightShader, win_width, win_height);
+        ibl.attach(lightShader);
+        if (ibl.ready)
+            ibl.setUniforms(lightShader, iblIntensity, iblRoughness);
+        gbufferShader.useProgram();
+        gbufferShader.setInt("difTex", 0);
+        deferredShader.useProgram();
+        deferredShader.setInt("gAlbedo", gBufferUnit);
+        deferredShader.setInt("gNormal", gBufferUnit + 1);
+        deferredShader.setInt("gDepth", gBufferUnit + 2);
+        lightBuffer.attach(deferredShader);
+        lightClusters.setUniforms(deferredShader, win_width, win_height);
+        ibl.attach(deferredShader);
+        if (ibl.ready)
+            ibl.setUniforms(deferredShader, iblIntensity, iblRoughness);
+        skyboxShader.useProgram();
+        skyboxShader.setInt("skybox", 0);
+        brightShader.useProgram();
+        brightShader.setInt("hdrBuffer", 0);
+        blurShader.useProgram();
+        blurShader.setInt("brightFrame", 0);
+        if (blurComputeShader)
+        {
+            blurComputeShader->useProgram();
+            blurComputeShader->setInt("brightFrame", 0);
+        }
+        blurKernel = BlurKernel(); //uploaded again by the next blur
+        hdrShader.useProgram();
+        hdrShader.setInt("hdrBuffer", 0);
+        hdrShader.setInt("bloomBuffer", 1);
+
+        gbufferProjection = gbufferShader.uniform("projection");
+        gbufferView = gbufferShader.uniform("view");
+        deferredInverseProjection = deferredShader.uniform("inverseProjection");
+        deferredInverseView = deferredShader.uniform("inverseView");
+        deferredLightCount = deferredShader.uniform("lightCount");
+        deferredClustered = deferredShader.uniform("clustered");
+        depthProjection = depthShader.uniform("projection");
+        depthView = depthShader.uniform("view");
+        lightProjection = lightShader.uniform("projection");
+        lightView = lightShader.uniform("view");
+        lightLightCount = lightShader.uniform("lightCount");
+        lightClustered = lightShader.uniform("clustered");
+        lightViewPos = lightShader.uniform("viewPos");
+        skyboxView = skyboxShader.uniform("view");
+        skyboxProjection = skyboxShader.uniform("projection");
+        brightThreshold = brightShader.uniform("threshold");
+        brightKnee = brightShader.uniform("knee");
+        blurDirection = blurShader.uniform("blurDirection");
+        if (blurComputeShader)
+            blurComputeDirection = blurComputeShader->uniform("blurDirection");
+        gbufferMeshes = Scene::uniforms(gbufferShader);
+        depthMeshes = Scene::uniforms(depthShader);
+        lightMeshes = Scene::uniforms(lightShader);
+        hdrEnabled = hdrShader.uniform("hdr");
+        hdrBloom = hdrShader.uniform("bloom");
+        hdrExposure = hdrShader.uniform("exposure");
+        hdrMaxLuminance = hdrShader.uniform("maxPixelScreenLuminance");
+        hdrAvgLuminance = hdrShader.uniform("avgPixelScreenLuminance");
+    };
+    configurePrograms();
+    std::cout << "uniforms: " << Shader::locationQueries << " locations looked up after link" << std::endl;
+
+    //Shader hot reload (programs whose sources change are rebuilt in the background and swapped in between frames)
+    std::unique_ptr<ShaderReloader> shaderReloader;
+    if (config["shader_reload"]["state"])
+    {
+        shaderReloader = std::make_unique<ShaderReloader>(window, config["shader_reload"]["directory"]);
+        for (Shader* shader : { &lightShader, &gbufferShader, &depthShader, &deferredShader, &skyboxShader, &brightShader, &blurShader, &hdrShader })
+            shaderReloader->watch(*shader);
+        if (blurComputeShader)
+            shaderReloader->watch(*blurComputeShader);
+    }
 
     // FBOs (FrameBufferObjects)
     unsigned int hdrFBO;
     glGenFramebuffers(1, &hdrFBO);
     glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
 
-    unsigned int colorBuffers[2]; //creates two images : one for color and the other for brightness 
-    glGenTextures(2, colorBuffers);
-    for (unsigned int i = 0; i < 2; i++)
-    {
-        glBindTexture(GL_TEXTURE_2D, colorBuffers[i]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, win_width, win_height, 0, GL_RGBA, GL_FLOAT, NULL);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, colorBuffers[i], 0);
-    }
+    unsigned int colorBuffer; //hdr color image (bright pixels are extracted later at reduced resolution)
+    glGenTextures(1, &colorBuffer);
+    glBindTexture(GL_TEXTURE_2D, colorBuffer);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, win_width, win_height, 0, GL_RGBA, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorBuffer, 0);
     
-    //create depth buffer (renderbuffer)
-    unsigned int rboDepth;
-    glGenRenderbuffers(1, &rboDepth);
-    glBindRenderbuffer(GL_RENDERBUFFER, rboDepth);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, win_width, win_height);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rboDepth);
-
-    //Color attachments we'll use (of this framebuffer) for rendering 
-    unsigned int attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
-    glDrawBuffers(2, attachments);
+    //create depth buffer (texture, shared with the G-buffer of deferred shading)
+    unsigned int depthBuffer;
+    glGenTextures(1, &depthBuffer);
+    glBindTexture(GL_TEXTURE_2D, depthBuffer);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, win_width, win_height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthBuffer, 0);
+
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
         std::cout << "Framebuffer not complete!" << std::endl;
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+    // G-buffer for deferred shading (albedo and normal, depth shared with the hdr framebuffer)
+    GBuffer gBuffer(win_width, win_height, depthBuffer);
+
     // ping-pong-framebuffers for two-pass gaussian blurring (first horizontally and than vertically)
     // these framebuffers keep passing data from one to another
+    // they have reduced resolution : the bright pass writes into the first one, then the blur starts from it
+    unsigned int bloom_width = std::max(1u, win_width / illum_settings.bloomDownsample);
+    unsigned int bloom_height = std::max(1u, win_height / illum_settings.bloomDownsample);
     unsigned int pingpongFBO[2];
     unsigned int pingpongColorbuffers[2];
     glGenFramebuffers(2, pingpongFBO);
@@ -346,7 +508,7 @@ int main()
     {
         glBindFramebuffer(GL_FRAMEBUFFER, pingpongFBO[i]);
         glBindTexture(GL_TEXTURE_2D, pingpongColorbuffers[i]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, win_width, win_height, 0, GL_RGBA, GL_FLOAT, NULL);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, bloom_width, bloom_height, 0, GL_RGBA, GL_FLOAT, NULL);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -357,44 +519,24 @@ int main()
             std::cout << "Framebuffer not complete!" << std::endl;
     }
 
-    // LIGHTS
-    // light positions
-    std::vector<glm::vec3> lightPositions;
-    lightPositions.push_back(glm::vec3( 49.5f,  49.5f, -255.5f)); //sun
-    lightPositions.push_back(glm::vec3( 0.0f, 0.0f, -40.5f));
-    lightPositions.push_back(glm::vec3( 2.5f, 0.0f, -22.5f));
-    lightPositions.push_back(glm::vec3( 0.0f, -2.5f, -22.5f));
-    lightPositions.push_back(glm::vec3( -2.5f, 0.0f, -22.5f));
-    lightPositions.push_back(glm::vec3( 0.0f, 2.5f, -22.5f));
-    lightPositions.push_back(glm::vec3( 2.5f, 0.0f, -15.0f));
-    lightPositions.push_back(glm::vec3( 0.0f, -2.5f, -15.0f));
-    lightPositions.push_back(glm::vec3( -2.5f, 0.0f, -15.0f));
-    lightPositions.push_back(glm::vec3( 0.0f, 2.5f, -15.0f));
-    lightPositions.push_back(glm::vec3( 2.5f, 0.0f, -7.5f));
-    lightPositions.push_back(glm::vec3( 0.0f, -2.5f, -7.5f));
-    lightPositions.push_back(glm::vec3( -2.5f, 0.0f, -7.5f));
-    lightPositions.push_back(glm::vec3( 0.0f, 2.5f, -7.5f));
-    
-    //light colors
-    std::vector<glm::vec3> lightColors;
-    lightColors.push_back(glm::vec3(300.0f, 300.0f, 300.0f));
-    lightColors.push_back(glm::vec3(200.0f, 200.0f, 200.0f));
-    lightColors.push_back(glm::vec3(1.0f, 0.0f, 0.0f));
-    lightColors.push_back(glm::vec3(0.0f, 1.0f, 0.0f));
-    lightColors.push_back(glm::vec3(0.0f, 0.0f, 1.0f));
-    lightColors.push_back(glm::vec3(1.0f, 1.0f, 0.0f));
-    lightColors.push_back(glm::vec3(1.0f, 0.0f, 0.0f));
-    lightColors.push_back(glm::vec3(0.0f, 1.0f, 0.0f));
-    lightColors.push_back(glm::vec3(0.0f, 0.0f, 1.0f));
-    lightColors.push_back(glm::vec3(1.0f, 1.0f, 0.0f));
-    lightColors.push_back(glm::vec3(1.0f, 0.0f, 0.0f));
-    lightColors.push_back(glm::vec3(0.0f, 1.0f, 0.0f));
-    lightColors.push_back(glm::vec3(0.0f, 0.0f, 1.0f));
-    lightColors.push_back(glm::vec3(1.0f, 1.0f, 0.0f));
+    // LIGHTS (read from the scene file, animated every frame)
+    LightSet lightSet = loadLightSet(sceneConfig["lights"]);
+    std::vector<glm::vec3>& lightPositions = lightSet.positions;
+    std::vector<glm::vec3>& lightColors = lightSet.colors;
+
+    std::cout << "g-buffer: " << gBuffer.footprintBytes() / (1024.0 * 1024.0) << " MB" << std::endl;
+    if (config["benchmark"]["animation"]["state"])
+        benchmarkLightAnimation(config["benchmark"]["animation"]["lights"], config["benchmark"]["animation"]["frames"], threadPool);
+    if (config["benchmark"]["culling"]["state"])
+        benchmarkCulling(config["benchmark"]["culling"]["instances"], config["benchmark"]["culling"]["frames"], threadPool);
+    if (config["benchmark"]["lights"]["state"])
+        lightBenchmark.start(lightPositions, lightColors, lightBuffer.capacity);
 
     // IMAGE FRAME DATA
     float* imageFrameData = new float[win_width * win_height * 3]; 
 
+    unsigned long long reportedLocationQueries = Shader::locationQueries; //glGetUniformLocation calls at the last status line
+
     // RENDER LOOP
     while (!glfwWindowShouldClose(window))
     {
@@ -403,53 +545,156 @@ int main()
         deltaTimeFrame = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
+        // TEXTURE UPLOADS (textures decoded since the last frame replace their placeholder)
+        textureLoader.update();
+        // SHADER HOT RELOAD (programs rebuilt since the last frame replace the old ones, their settings are set again)
+        if (shaderReloader && shaderReloader->update() > 0)
+        {
+            configurePrograms();
+            programGeneration++;
+        }
+        if (ibl.update())
+        {
+            lightShader.useProgram();
+            ibl.setUniforms(lightShader, iblIntensity, iblRoughness);
+            deferredShader.useProgram();
+            ibl.setUniforms(deferredShader, iblIntensity, iblRoughness);
+        }
+
         // CAMERA VIEW & PERSPECTIVE
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (GLfloat)win_width / (GLfloat)win_height, 0.1f, 100.0f);
+        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (GLfloat)win_width / (GLfloat)win_height, nearPlane, farPlane);
         glm::mat4 view = camera.GetViewMatrix();
 
         // INPUT PROCESSING
         processWindowInput(window);
-        processIlluminationInput(window, &illum_settings, &illuminationChangeKeyPressed, &dynamicExposureKeyPressed, &bloomKeyPressed);
+        processIlluminationInput(window, &illum_settings, &illuminationChangeKeyPressed, &dynamicExposureKeyPressed, &bloomKeyPressed, &glareKeyPressed, &bloomComputeKeyPressed, &clusteredKeyPressed, &deferredKeyPressed);
+        processDebugInput(window, &bloomReferenceKeyPressed, &bloomReferenceRequested);
+
+        // LIGHT ANIMATIONS (the light benchmark replaces the scene lights while it runs)
+        if (lightSet.animated() && !lightBenchmark.active)
+            lightSet.update(currentFrame, threadPool);
+
+        // BLOOM INPUTS (camera, lights and bloom settings)
+        bloomInputs.begin();
+        bloomInputs.add(view);
+        bloomInputs.add(projection);
+        bloomInputs.add(lightPositions);
+        bloomInputs.add(lightColors);
+        bloomInputs.add(illum_settings.bloomStdDev);
+        bloomInputs.add(illum_settings.bloomKernelSize);
+        bloomInputs.add(illum_settings.bloomBlurPasses);
+        bloomInputs.add(illum_settings.bloomThreshold);
+        bloomInputs.add(illum_settings.bloomKnee);
+        bloomInputs.add(illum_settings.glareState);
+        bloomInputs.add(glareKernel.generation);
+        bloomInputs.add(illum_settings.deferredShading);
+        bloomInputs.add(illum_settings.clusteredShading);
+        bloomInputs.add(iblIntensity);
+        bloomInputs.add(iblRoughness);
+        bloomInputs.add(scene.generation);
+        bloomInputs.add(textureLoader.generation);
+        bloomInputs.add(ibl.generation);
+        bloomInputs.add(programGeneration);
+        unsigned long long sceneGeneration = bloomInputs.end();
 
         // WHITE SCREEN RENDERING (if something doesn't work with rendering, we obtain only a white window)
         glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
 
-        // FRAMEBUFFER RENDERING (CONTAINER)
-        glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        lightShader.useProgram();
-        lightShader.setMat4("projection", projection);
-        lightShader.setMat4("view", view);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, containerTexture);
-        for (unsigned int i = 0; i < lightPositions.size(); i++)
+        // INSTANCES CULLING (BVH against the frustum, only the visible instances are drawn)
+        Frustum frustum(projection * view);
+        scene.cull(frustum);
+
+        // TEXTURE STREAMING (screen size of the visible materials, their finer mip levels are streamed by the next updates)
+        if (textureLoader.streaming)
+            scene.textureFootprints(camera.Position, win_height / glm::radians(camera.Zoom),
+                [&textureLoader](GLuint texture, float pixels) { textureLoader.streaming->request(texture, pixels); });
+
+        // LIGHTS CULLING & UPLOAD (only lights in the frustum that reach a draw are uploaded)
+        drawBounds.clear();
+        scene.appendBounds(drawBounds);
+        cullLights(lightPositions, lightColors, lightBuffer.cutoff, frustum, drawBounds, visibleLights);
+        lightBuffer.update(lightPositions, lightColors, visibleLights);
+        bool clusteredShading = lightBenchmark.active ? lightBenchmark.clustered() : illum_settings.clusteredShading;
+        if (ibl.ready)
+            ibl.bind();
+        if (clusteredShading)
         {
-            lightShader.setVec3("lights[" + std::to_string(i) + "].Position", lightPositions[i]);
-            lightShader.setVec3("lights[" + std::to_string(i) + "].Color", lightColors[i]);
+            lightClusters.build(lightBuffer.lights(), view, projection, threadPool);
+            lightClusters.bind();
+        }
+
+        if (illum_settings.deferredShading)
+        {
+            // G-BUFFER RENDERING (SCENE)
+            gBuffer.beginGeometry();
+            gbufferShader.useProgram();
+            gbufferShader.setMat4(gbufferProjection, projection);
+            gbufferShader.setMat4(gbufferView, view);
+            shadingTimers.begin("geometry");
+            scene.draw(gbufferShader, gbufferMeshes);
+            shadingTimers.end();
+            gBuffer.endGeometry();
+
+            // DEFERRED LIGHTING (one fullscreen pass into the hdr framebuffer, sky pixels left to the skybox)
+            glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
+            glClear(GL_COLOR_BUFFER_BIT);
+            glDisable(GL_DEPTH_TEST);
+            deferredShader.useProgram();
+            deferredShader.setMat4(deferredInverseProjection, glm::inverse(projection));
+            deferredShader.setMat4(deferredInverseView, glm::inverse(view));
+            deferredShader.setInt(deferredLightCount, lightBuffer.count);
+            deferredShader.setBool(deferredClustered, clusteredShading);
+            gBuffer.bindTextures(gBufferUnit);
+            glBindVertexArray(frameVAO);
+            shadingTimers.begin("lighting");
+            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+            shadingTimers.end();
+            glBindVertexArray(0);
+            glEnable(GL_DEPTH_TEST);
+        }
+        else
+        {
+            // FRAMEBUFFER RENDERING (SCENE)
+            glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            if (depthPrepass.beginFrame())
+            {
+                // DEPTH PRE-PASS (the lighting pass then shades only the visible fragments)
+                depthShader.useProgram();
+                depthShader.setMat4(depthProjection, projection);
+                depthShader.setMat4(depthView, view);
+                depthPrepass.beginDepth();
+                shadingTimers.begin("depth");
+                scene.draw(depthShader, depthMeshes);
+                shadingTimers.end();
+                depthPrepass.endDepth();
+            }
+            lightShader.useProgram();
+            lightShader.setMat4(lightProjection, projection);
+            lightShader.setMat4(lightView, view);
+            lightShader.setInt(lightLightCount, lightBuffer.count);
+            lightShader.setBool(lightClustered, clusteredShading);
+            lightShader.setVec3(lightViewPos, camera.Position);
+            shadingTimers.begin("lighting");
+            depthPrepass.beginLighting();
+            scene.draw(lightShader, lightMeshes);
+            depthPrepass.endLighting();
+            shadingTimers.end();
         }
-        lightShader.setVec3("viewPos", camera.Position);
-        glm::mat4 containerModel = glm::mat4(1.0f);
-        containerModel = glm::translate(containerModel, glm::vec3(0.0f, 0.0f, -15.0));
-        containerModel = glm::scale(containerModel, glm::vec3(3.0f, 3.0f, 27.5f));
-        lightShader.setMat4("model", containerModel);
-        lightShader.setInt("inverse_normals", true);
-        glBindVertexArray(containerVAO);
-        glDrawArrays(GL_TRIANGLES, 0, 30);
-        glBindVertexArray(0);
 
         // SKYBOX RENDERING
         glDepthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
         skyboxShader.useProgram();
         view = glm::mat4(glm::mat3(camera.GetViewMatrix())); // remove translation from the view matrix
-        skyboxShader.setMat4("view", view);
-        skyboxShader.setMat4("projection", projection);
+        skyboxShader.setMat4(skyboxView, view);
+        skyboxShader.setMat4(skyboxProjection, projection);
         glBindVertexArray(skyboxVAO);
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
+        glDrawElements(GL_TRIANGLES, (GLsizei)skyboxMesh.indices.size(), skyboxMesh.indexType(), (void*)0);
         glBindVertexArray(0);
         glDepthFunc(GL_LESS);
-        glReadBuffer(GL_BACK);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
 
         glReadPixels(0, 0, win_width, win_height, GL_RGB, GL_FLOAT, imageFrameData);  
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -457,17 +702,110 @@ int main()
         // POST-PROCESSING OPERATIONS
 
         // BLOOM FILTER
-        bool horizontal = true, first_blurring = true;
-        unsigned int blurPass = 2*config["illumination"]["bloom"]["two_dim_blur_pass"].get<unsigned int>();
-        blurShader.useProgram();
-        for (unsigned int i = 0; i < blurPass; i++)
+        bool horizontal = true;
+        bool bloomUpToDate = illum_settings.bloomCache && bloomGeneration == sceneGeneration && !bloomReferenceRequested;
+        if (illum_settings.bloomState && bloomUpToDate)
+        {
+            // nothing the bright image depends on has changed : the last result is still valid
+            horizontal = bloomResultHorizontal;
+            skippedBloomPasses += 1 + (illum_settings.glareState ? 0 : 2 * illum_settings.bloomBlurPasses);
+        }
+        else if (illum_settings.bloomState)
         {
-            glBindFramebuffer(GL_FRAMEBUFFER, pingpongFBO[horizontal]);
-            blurShader.setInt("horizontal", horizontal);
-            glBindTexture(GL_TEXTURE_2D, first_blurring ? colorBuffers[1] : pingpongColorbuffers[!horizontal]);  // bind texture of other framebuffer (or scene if first iteration)
-            horizontal = !horizontal;
-            if (first_blurring)
-                first_blurring = false;
+            GLint viewport[4];
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            glViewport(0, 0, bloom_width, bloom_height);
+            glActiveTexture(GL_TEXTURE0);
+            glBindVertexArray(frameVAO);
+
+            // bright pass : downsample the hdr image keeping only what is over the soft threshold
+            glBindFramebuffer(GL_FRAMEBUFFER, pingpongFBO[0]);
+            brightShader.useProgram();
+            brightShader.setFloat(brightThreshold, illum_settings.bloomThreshold);
+            brightShader.setFloat(brightKnee, illum_settings.bloomKnee);
+            glBindTexture(GL_TEXTURE_2D, colorBuffer);
+            bloomTimers.begin("bright");
+            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+            bloomTimers.end();
+            ImageRGBA32F brightImage;
+            if (bloomReferenceRequested && !illum_settings.glareState)
+            {
+                brightImage = ImageRGBA32F(bloom_width, bloom_height);
+                glReadPixels(0, 0, bloom_width, bloom_height, GL_RGBA, GL_FLOAT, brightImage.pixels.data());
+            }
+
+            if (illum_settings.glareState)
+            {
+                // star glare : wide non-separable kernel convolved on the CPU (directly or through FFT)
+                bloomReferenceRequested = false; // the CPU reference checks the gaussian blur only
+                ImageRGBA32F glareImage(bloom_width, bloom_height);
+                glReadPixels(0, 0, bloom_width, bloom_height, GL_RGBA, GL_FLOAT, glareImage.pixels.data());
+                glareConvolver.convolve(glareImage, glareKernel, threadPool);
+                if ((int)glareConvolver.lastPath != glarePathReported)
+                {
+                    glarePathReported = glareConvolver.lastPath;
+                    std::cout << "glare convolution: " << (glareConvolver.lastPath == GLARE_FFT ? "fft" : "spatial") << " (kernel " << glareKernel.size() << "x" << glareKernel.size() << ")" << std::endl;
+                }
+                glBindTexture(GL_TEXTURE_2D, pingpongColorbuffers[1]);
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, bloom_width, bloom_height, GL_RGBA, GL_FLOAT, glareImage.pixels.data());
+                horizontal = false; // the bloom result is read from pingpongColorbuffers[!horizontal]
+            }
+            else
+            {
+                // gaussian blur
+                if (blurKernel.stdDev != illum_settings.bloomStdDev || blurKernel.kernelSize != illum_settings.bloomKernelSize)
+                {
+                    blurKernel = computeBlurKernel(illum_settings.bloomStdDev, illum_settings.bloomKernelSize);
+                    uploadBlurKernel(blurShader, blurKernel);
+                    if (blurComputeShader)
+                        uploadBlurKernelCompute(*blurComputeShader, blurKernel);
+                }
+                unsigned int blurPass = 2 * illum_settings.bloomBlurPasses;
+                if (illum_settings.bloomCompute)
+                {
+                    // compute path : one work group per tile of a row (or column), writing with image stores
+                    blurComputeShader->useProgram();
+                    for (unsigned int i = 0; i < blurPass; i++)
+                    {
+                        blurComputeShader->setInt(blurComputeDirection, horizontal);
+                        glBindTexture(GL_TEXTURE_2D, pingpongColorbuffers[!horizontal]);
+                        glExt.BindImageTexture(0, pingpongColorbuffers[horizontal], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+                        unsigned int lineLength = horizontal ? bloom_width : bloom_height;
+                        unsigned int lines = horizontal ? bloom_height : bloom_width;
+                        bloomTimers.begin(horizontal ? "blur horizontal" : "blur vertical");
+                        glExt.DispatchCompute((lineLength + BLUR_TILE_SIZE - 1) / BLUR_TILE_SIZE, lines, 1);
+                        bloomTimers.end();
+                        glExt.MemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+                        horizontal = !horizontal;
+                    }
+                }
+                else
+                {
+                    blurShader.useProgram();
+                    for (unsigned int i = 0; i < blurPass; i++)
+                    {
+                        glBindFramebuffer(GL_FRAMEBUFFER, pingpongFBO[horizontal]);
+                        blurShader.setInt(blurDirection, horizontal);
+                        glBindTexture(GL_TEXTURE_2D, pingpongColorbuffers[!horizontal]);  // bind texture of other framebuffer (bright pass output if first iteration)
+                        bloomTimers.begin(horizontal ? "blur horizontal" : "blur vertical");
+                        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+                        bloomTimers.end();
+                        horizontal = !horizontal;
+                    }
+                }
+                if (bloomReferenceRequested)
+                {
+                    ImageRGBA32F gpuBloomImage(bloom_width, bloom_height);
+                    glBindFramebuffer(GL_FRAMEBUFFER, pingpongFBO[!horizontal]);
+                    glReadPixels(0, 0, bloom_width, bloom_height, GL_RGBA, GL_FLOAT, gpuBloomImage.pixels.data());
+                    checkBloomReference(brightImage, gpuBloomImage, &illum_settings);
+                    bloomReferenceRequested = false;
+                }
+            }
+            glBindVertexArray(0);
+            glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+            bloomGeneration = sceneGeneration;
+            bloomResultHorizontal = horizontal;
         }
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
@@ -484,25 +822,68 @@ int main()
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         hdrShader.useProgram();
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, colorBuffers[0]);//Apply FB color texture
+        glBindTexture(GL_TEXTURE_2D, colorBuffer);//Apply FB color texture
         glActiveTexture(GL_TEXTURE1);
         glBindTexture(GL_TEXTURE_2D, pingpongColorbuffers[!horizontal]);//Apply Bloom Filter texture 
-        hdrShader.setInt("hdr", illum_settings.hdr);
-        hdrShader.setInt("bloom", illum_settings.bloomState);
-        hdrShader.setFloat("exposure", illum_settings.exposure);
+        hdrShader.setInt(hdrEnabled, illum_settings.hdr);
+        hdrShader.setInt(hdrBloom, illum_settings.bloomState);
+        hdrShader.setFloat(hdrExposure, illum_settings.exposure);
         //Drago-only Tone-Mapping uniform variables
-        hdrShader.setFloat("maxPixelScreenLuminance", illum_settings.maxPixelScreenLuminance);
-        hdrShader.setFloat("avgPixelScreenLuminance", illum_settings.avgPixelScreenLuminance);
+        hdrShader.setFloat(hdrMaxLuminance, illum_settings.maxPixelScreenLuminance);
+        hdrShader.setFloat(hdrAvgLuminance, illum_settings.avgPixelScreenLuminance);
         glBindVertexArray(frameVAO);
         glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
         glBindVertexArray(0);
 
-        std::cout << "hdr: " << illum_settings.hdr << "| dynamicExp: " << (illum_settings.dynamicExposure ? "on" : "off") << "| bloom: " << (illum_settings.bloomState ? "on" : "off") << "| exposure: " << illum_settings.exposure << std::endl;
+        // BLOOM TIMINGS (averages printed every 120 frames)
+        frameCount++;
+        if (bloomTimersCompute != illum_settings.bloomCompute)
+        {
+            bloomTimers.clear();
+            bloomTimersCompute = illum_settings.bloomCompute;
+        }
+        if (frameCount % 120 == 0)
+            bloomTimers.report(illum_settings.bloomCompute ? "compute blur" : "fragment blur");
+        bloomTimers.nextFrame();
+
+        // SHADING TIMINGS (and G-buffer traffic in deferred mode, every 120 frames)
+        if (shadingTimersDeferred != illum_settings.deferredShading)
+        {
+            shadingTimers.clear();
+            shadingTimersDeferred = illum_settings.deferredShading;
+        }
+        if (frameCount % 120 == 0)
+        {
+            if (!lightBenchmark.active) // the benchmark averages the lighting timer over its steps
+                shadingTimers.report(illum_settings.deferredShading ? "deferred shading" : "forward shading");
+            if (illum_settings.deferredShading)
+                gBuffer.report();
+            if (textureLoader.streaming)
+                textureLoader.streaming->report();
+        }
+        shadingTimers.nextFrame();
+
+        // STATUS (every 120 frames: settings and statistics of the last frame, uniform lookups since the last status)
+        if (frameCount % 120 == 0)
+        {
+            std::cout << "hdr: " << illum_settings.hdr << "| dynamicExp: " << (illum_settings.dynamicExposure ? "on" : "off") << "| bloom: " << (illum_settings.bloomState ? (illum_settings.glareState ? "glare" : (illum_settings.bloomCompute ? "on (compute)" : "on")) : "off") << "| exposure: " << illum_settings.exposure << "| skipped bloom passes: " << skippedBloomPasses << "| lights: " << lightBuffer.count << "/" << lightPositions.size() << (clusteredShading ? " (clustered)" : "") << "| shading: ";
+            if (illum_settings.deferredShading)
+                std::cout << "deferred";
+            else
+                std::cout << "forward (depth pre-pass: " << depthPrepass.status() << ")";
+            std::cout << "| draws: " << scene.drawCalls << (scene.indirect ? " indirect (" : " (") << scene.visibleInstances << "/" << scene.instanceCount() << " instances, culled in " << scene.cullMilliseconds << " ms)" << "| uniform lookups: " << Shader::locationQueries - reportedLocationQueries << std::endl;
+            reportedLocationQueries = Shader::locationQueries;
+        }
+        lightBenchmark.frameRendered(lightClusters, lightPositions, lightColors);
 
         glfwSwapBuffers(window);
+        if (frameCount == 1)
+            std::cout << "first frame after " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startupBegin).count()
+                      << " ms (" << textureLoader.pending() << " textures still loading)" << std::endl;
         glfwPollEvents();
     }
 
+    shaderReloader.reset(); //stops the compiler thread while the contexts exist
     glfwDestroyWindow(window);
     glfwTerminate();
     return 0;
@@ -532,7 +913,7 @@ void processWindowInput(GLFWwindow* window)
 
 // process illumination input: whether relevant keys are pressed/released illumination change
 // ---------------------------------------------------------------------------------------------------------
-void processIlluminationInput(GLFWwindow* window, Illumination* illum, bool* illuminationChangeKeyPressed, bool* dynamicExposureKeyPressed, bool* bloomKeyPressed)
+void processIlluminationInput(GLFWwindow* window, Illumination* illum, bool* illuminationChangeKeyPressed, bool* dynamicExposureKeyPressed, bool* bloomKeyPressed, bool* glareKeyPressed, bool* bloomComputeKeyPressed, bool* clusteredKeyPressed, bool* deferredKeyPressed)
 {
     if (glfwGetKey(window, GLFW_KEY_0) == GLFW_PRESS && !(*illuminationChangeKeyPressed))
     {
@@ -579,6 +960,47 @@ void processIlluminationInput(GLFWwindow* window, Illumination* illum, bool* ill
         *bloomKeyPressed = false;
     }
 
+    if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS && !(*glareKeyPressed))
+    {
+        (*illum).glareState = !(*illum).glareState;
+        *glareKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_G) == GLFW_RELEASE)
+    {
+        *glareKeyPressed = false;
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS && !(*bloomComputeKeyPressed))
+    {
+        // compute blur can be chosen only on an OpenGL 4.3 context
+        (*illum).bloomCompute = !(*illum).bloomCompute && glExt.computeShaders;
+        *bloomComputeKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_C) == GLFW_RELEASE)
+    {
+        *bloomComputeKeyPressed = false;
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS && !(*clusteredKeyPressed))
+    {
+        (*illum).clusteredShading = !(*illum).clusteredShading;
+        *clusteredKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_L) == GLFW_RELEASE)
+    {
+        *clusteredKeyPressed = false;
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS && !(*deferredKeyPressed))
+    {
+        (*illum).deferredShading = !(*illum).deferredShading;
+        *deferredKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_M) == GLFW_RELEASE)
+    {
+        *deferredKeyPressed = false;
+    }
+
     if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
     {
         if ((*illum).exposure > 0.0f)
@@ -592,6 +1014,21 @@ void processIlluminationInput(GLFWwindow* window, Illumination* illum, bool* ill
     }
 }
 
+// process debug input: whether relevant keys are pressed/released for debug operations
+// ---------------------------------------------------------------------------------------------------------
+void processDebugInput(GLFWwindow* window, bool* bloomReferenceKeyPressed, bool* bloomReferenceRequested)
+{
+    if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS && !(*bloomReferenceKeyPressed))
+    {
+        *bloomReferenceRequested = true;
+        *bloomReferenceKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_R) == GLFW_RELEASE)
+    {
+        *bloomReferenceKeyPressed = false;
+    }
+}
+
 // Whenever the window size changed (by OS or user resize) this callback function executes
 // ---------------------------------------------------------------------------------------------
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
@@ -629,86 +1066,6 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
     camera.ProcessMouseScroll(static_cast<float>(yoffset));
 }
 
-// Utility function for loading a 2D texture from file
-// --------------------------------------------------------
-unsigned int loadTexture(char const * path, bool gammaCorrection)
-{
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum internalFormat;
-        GLenum dataFormat;
-        if (nrComponents == 1)
-        {
-            internalFormat = dataFormat = GL_RED;
-        }
-        else if (nrComponents == 3)
-        {
-            internalFormat = gammaCorrection ? GL_SRGB : GL_RGB;
-            dataFormat = GL_RGB;
-        }
-        else if (nrComponents == 4)
-        {
-            internalFormat = gammaCorrection ? GL_SRGB_ALPHA : GL_RGBA;
-            dataFormat = GL_RGBA;
-        }
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, dataFormat, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
-
-    return textureID;
-}
-
-// Utility function for loading skybox from faces
-// ----------------------------------------------------------------------
-unsigned int loadCubemapSkyboxTexture(std::vector<std::string> faces)
-{
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-
-    int width, height, nrComponents;
-    for (unsigned int i = 0; i < faces.size(); i++)
-    {
-        unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrComponents, 0);
-        if (data)
-        {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
-        }
-        else
-        {
-            std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
-        }
-    }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-    return textureID;
-}
-
 // Utility function for calculate average, maximum and minimum luminance of a screen frame
 // -----------------------------------------------------------------------------------------
 float* calculateLuminanceScreenStats(float* imageFrameData, int width, int height) {
@@ -758,4 +1115,30 @@ void updateExposure(Illumination* illum){
     // Limit exposure into a range [minExposure,maxExposure] for infinite exposure in dark scene 
     // behaviour and viceversa
     (*illum).exposure = std::clamp((*illum).exposure, (*illum).minExposure, (*illum).maxExposure);
-}
\ No newline at end of file
+}
+
+// Utility function for comparing the GPU bloom blur with the CPU reference blur applied to the same bright image
+// -----------------------------------------------------------------------------------------------------------------
+void checkBloomReference(const ImageRGBA32F& brightImage, const ImageRGBA32F& gpuBloomImage, Illumination* illum)
+{
+    ImageRGBA32F cpuBloomImage = brightImage;
+    double startTime = glfwGetTime();
+    blurGaussian(cpuBloomImage, (*illum).bloomStdDev, (*illum).bloomKernelSize, (*illum).bloomBlurPasses, threadPool);
+    double cpuTime = glfwGetTime() - startTime;
+
+    // compare only rgb (alpha is not blurred on the GPU), relative to the brightest reference value
+    float maxValue = 1e-6f;
+    float maxError = 0.0f;
+    double totalError = 0.0;
+    for (size_t i = 0; i < cpuBloomImage.pixels.size(); i++)
+    {
+        if (i % 4 == 3)
+            continue;
+        float error = std::abs(cpuBloomImage.pixels[i] - gpuBloomImage.pixels[i]);
+        maxValue = std::max(maxValue, cpuBloomImage.pixels[i]);
+        maxError = std::max(maxError, error);
+        totalError += error;
+    }
+    std::cout << "bloom reference: " << cpuBloomImage.width << "x" << cpuBloomImage.height << " | cpu blur: " << cpuTime * 1000.0 << " ms (" << threadPool.size() << " threads)"
+              << " | max error: " << maxError / maxValue << " | mean error: " << totalError / (cpuBloomImage.pixels.size() * 3 / 4) / maxValue << " (relative to max " << maxValue << ")" << std::endl;
+}